@@ -0,0 +1,498 @@
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+#include "aio.h"
+#include "parallel.h"
+
+/* One queued request; len/offset/buf advance as short transfers are continued */
+typedef struct
+{
+    int fd;
+    int write;
+    unsigned char *buf;
+    size_t len;
+    uint64_t offset;
+    unsigned tag;
+    int failed;
+    struct iovec iov;           /* io_uring: the vector the SQE points at */
+} AioRequest;
+
+struct AioQueue
+{
+    AioMode backend;            /* e_aio_uring or e_aio_threads */
+    unsigned depth;
+    AioRequest *req;            /* depth slots */
+    unsigned *free_slots;
+    unsigned nfree;
+
+    /* io_uring rings, mapped from ring_fd */
+    int ring_fd;
+    void *sq_ptr;
+    size_t sq_size;
+    void *cq_ptr;
+    size_t cq_size;
+    struct io_uring_sqe *sqes;
+    size_t sqes_size;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_cqe *cqes;
+
+    /* Thread backend: FIFOs of slot numbers, guarded by lock */
+    pthread_t threads[AIO_THREADS];
+    int nthreads;
+    pthread_mutex_t lock;
+    pthread_cond_t work;
+    pthread_cond_t done;
+    unsigned *pending;
+    unsigned pending_head;
+    unsigned pending_len;
+    unsigned *completed;
+    unsigned completed_head;
+    unsigned completed_len;
+    int stop;
+};
+
+static int uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags)
+{
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static Status uring_init(AioQueue *q)
+{
+    struct io_uring_params p;
+
+    memset(&p, 0, sizeof(p));
+    q->ring_fd = (int)syscall(__NR_io_uring_setup, q->depth, &p);
+    if (q->ring_fd < 0)
+        return e_failure;
+
+    q->sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    q->cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    q->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+
+    /* Newer kernels map both rings with one mmap */
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        if (q->cq_size > q->sq_size)
+            q->sq_size = q->cq_size;
+        q->cq_size = 0;
+    }
+
+    q->sq_ptr = mmap(NULL, q->sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, q->ring_fd,
+                     IORING_OFF_SQ_RING);
+    q->cq_ptr = q->cq_size == 0 ? q->sq_ptr
+                                : mmap(NULL, q->cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                                       q->ring_fd, IORING_OFF_CQ_RING);
+    q->sqes = mmap(NULL, q->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, q->ring_fd,
+                   IORING_OFF_SQES);
+    if (q->sq_ptr == MAP_FAILED || q->cq_ptr == MAP_FAILED || q->sqes == MAP_FAILED)
+        return e_failure;
+
+    q->sq_tail = (unsigned *)((char *)q->sq_ptr + p.sq_off.tail);
+    q->sq_mask = (unsigned *)((char *)q->sq_ptr + p.sq_off.ring_mask);
+    q->sq_array = (unsigned *)((char *)q->sq_ptr + p.sq_off.array);
+    q->cq_head = (unsigned *)((char *)q->cq_ptr + p.cq_off.head);
+    q->cq_tail = (unsigned *)((char *)q->cq_ptr + p.cq_off.tail);
+    q->cq_mask = (unsigned *)((char *)q->cq_ptr + p.cq_off.ring_mask);
+    q->cqes = (struct io_uring_cqe *)((char *)q->cq_ptr + p.cq_off.cqes);
+    return e_success;
+}
+
+static void uring_close(AioQueue *q)
+{
+    if (q->sqes != NULL && q->sqes != MAP_FAILED)
+        munmap(q->sqes, q->sqes_size);
+    if (q->cq_size > 0 && q->cq_ptr != NULL && q->cq_ptr != MAP_FAILED)
+        munmap(q->cq_ptr, q->cq_size);
+    if (q->sq_ptr != NULL && q->sq_ptr != MAP_FAILED)
+        munmap(q->sq_ptr, q->sq_size);
+    if (q->ring_fd >= 0)
+        close(q->ring_fd);
+
+    q->sqes = NULL;
+    q->cq_ptr = NULL;
+    q->sq_ptr = NULL;
+    q->cq_size = 0;
+    q->ring_fd = -1;
+}
+
+/* Put the rest of request slot on the submission ring and hand it to the kernel */
+static Status uring_submit(AioQueue *q, unsigned slot)
+{
+    AioRequest *r = &q->req[slot];
+    unsigned tail = *q->sq_tail;
+    unsigned idx = tail & *q->sq_mask;
+    struct io_uring_sqe *sqe = &q->sqes[idx];
+
+    r->iov.iov_base = r->buf;
+    r->iov.iov_len = r->len;
+
+    /* Vectored ops: available since the first io_uring kernels */
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = r->write ? IORING_OP_WRITEV : IORING_OP_READV;
+    sqe->fd = r->fd;
+    sqe->addr = (uint64_t)(uintptr_t)&r->iov;
+    sqe->len = 1;
+    sqe->off = r->offset;
+    sqe->user_data = slot;
+
+    q->sq_array[idx] = idx;
+    __atomic_store_n(q->sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+    for (;;)
+    {
+        int n = uring_enter(q->ring_fd, 1, 0, 0);
+        if (n == 1)
+            return e_success;
+        if (n < 0 && errno == EINTR)
+            continue;
+        return e_failure;
+    }
+}
+
+/* Next finished slot: short transfers and EINTR/EAGAIN are resubmitted first */
+static Status uring_reap(AioQueue *q, unsigned *slot)
+{
+    for (;;)
+    {
+        unsigned head = *q->cq_head;
+
+        if (head == __atomic_load_n(q->cq_tail, __ATOMIC_ACQUIRE))
+        {
+            if (uring_enter(q->ring_fd, 0, 1, IORING_ENTER_GETEVENTS) < 0 && errno != EINTR)
+                return e_failure;
+            continue;
+        }
+
+        struct io_uring_cqe *cqe = &q->cqes[head & *q->cq_mask];
+        AioRequest *r = &q->req[(unsigned)cqe->user_data];
+        int res = cqe->res;
+
+        *slot = (unsigned)cqe->user_data;
+        __atomic_store_n(q->cq_head, head + 1, __ATOMIC_RELEASE);
+
+        if (res == -EINTR || res == -EAGAIN)
+            r->failed = uring_submit(q, *slot) == e_failure;
+        else if (res <= 0)
+            r->failed = 1;
+        else
+        {
+            r->buf += res;
+            r->len -= (size_t)res;
+            r->offset += (uint64_t)res;
+            if (r->len > 0)
+                r->failed = uring_submit(q, *slot) == e_failure;
+            else
+                return e_success;
+        }
+
+        if (r->failed)
+            return e_success;
+    }
+}
+
+static void *io_thread(void *arg)
+{
+    AioQueue *q = arg;
+
+    for (;;)
+    {
+        pthread_mutex_lock(&q->lock);
+        while (!q->stop && q->pending_len == 0)
+            pthread_cond_wait(&q->work, &q->lock);
+        if (q->pending_len == 0)
+        {
+            pthread_mutex_unlock(&q->lock);
+            break;
+        }
+        unsigned slot = q->pending[q->pending_head];
+        q->pending_head = (q->pending_head + 1) % q->depth;
+        q->pending_len--;
+        pthread_mutex_unlock(&q->lock);
+
+        AioRequest *r = &q->req[slot];
+        Status s = r->write ? pwrite_full(r->fd, r->buf, r->len, (off_t)r->offset)
+                            : pread_full(r->fd, r->buf, r->len, (off_t)r->offset);
+
+        pthread_mutex_lock(&q->lock);
+        r->failed = s == e_failure;
+        q->completed[(q->completed_head + q->completed_len) % q->depth] = slot;
+        q->completed_len++;
+        pthread_cond_signal(&q->done);
+        pthread_mutex_unlock(&q->lock);
+    }
+    return NULL;
+}
+
+static Status threads_init(AioQueue *q)
+{
+    q->pending = malloc(q->depth * sizeof(*q->pending));
+    q->completed = malloc(q->depth * sizeof(*q->completed));
+    if (q->pending == NULL || q->completed == NULL)
+        return e_failure;
+
+    pthread_mutex_init(&q->lock, NULL);
+    pthread_cond_init(&q->work, NULL);
+    pthread_cond_init(&q->done, NULL);
+    for (int i = 0; i < AIO_THREADS; i++)
+        if (pthread_create(&q->threads[i], NULL, io_thread, q) == 0)
+            q->nthreads++;
+    return q->nthreads > 0 ? e_success : e_failure;
+}
+
+static void threads_close(AioQueue *q)
+{
+    if (q->pending != NULL && q->completed != NULL)
+    {
+        pthread_mutex_lock(&q->lock);
+        q->stop = 1;
+        pthread_cond_broadcast(&q->work);
+        pthread_mutex_unlock(&q->lock);
+        for (int i = 0; i < q->nthreads; i++)
+            pthread_join(q->threads[i], NULL);
+
+        pthread_cond_destroy(&q->done);
+        pthread_cond_destroy(&q->work);
+        pthread_mutex_destroy(&q->lock);
+    }
+    free(q->pending);
+    free(q->completed);
+}
+
+AioQueue *aio_create(AioMode mode, unsigned depth)
+{
+    AioQueue *q;
+
+    if (mode == e_aio_off || depth == 0 || (q = calloc(1, sizeof(*q))) == NULL)
+        return NULL;
+
+    q->depth = depth;
+    q->ring_fd = -1;
+    q->req = calloc(depth, sizeof(*q->req));
+    q->free_slots = malloc(depth * sizeof(*q->free_slots));
+    if (q->req == NULL || q->free_slots == NULL)
+    {
+        aio_destroy(q);
+        return NULL;
+    }
+    for (unsigned i = 0; i < depth; i++)
+        q->free_slots[q->nfree++] = depth - 1 - i;
+
+    /* io_uring may be missing or blocked (old kernel, seccomp): fall back to threads */
+    q->backend = e_aio_uring;
+    if (mode != e_aio_threads && uring_init(q) == e_success)
+        return q;
+    uring_close(q);
+
+    q->backend = e_aio_threads;
+    if (mode != e_aio_uring && threads_init(q) == e_success)
+        return q;
+
+    aio_destroy(q);
+    return NULL;
+}
+
+const char *aio_backend(const AioQueue *q)
+{
+    return q->backend == e_aio_uring ? "io_uring" : "threads";
+}
+
+static Status aio_queue(AioQueue *q, int fd, int write, void *buf, size_t len, uint64_t offset, unsigned tag)
+{
+    if (q->nfree == 0)
+        return e_failure;
+
+    unsigned slot = q->free_slots[--q->nfree];
+    AioRequest *r = &q->req[slot];
+
+    r->fd = fd;
+    r->write = write;
+    r->buf = buf;
+    r->len = len;
+    r->offset = offset;
+    r->tag = tag;
+    r->failed = 0;
+
+    if (q->backend == e_aio_uring)
+    {
+        if (uring_submit(q, slot) == e_failure)
+        {
+            q->free_slots[q->nfree++] = slot;
+            return e_failure;
+        }
+        return e_success;
+    }
+
+    pthread_mutex_lock(&q->lock);
+    q->pending[(q->pending_head + q->pending_len) % q->depth] = slot;
+    q->pending_len++;
+    pthread_cond_signal(&q->work);
+    pthread_mutex_unlock(&q->lock);
+    return e_success;
+}
+
+Status aio_read(AioQueue *q, int fd, void *buf, size_t len, uint64_t offset, unsigned tag)
+{
+    return aio_queue(q, fd, 0, buf, len, offset, tag);
+}
+
+Status aio_write(AioQueue *q, int fd, const void *buf, size_t len, uint64_t offset, unsigned tag)
+{
+    return aio_queue(q, fd, 1, (void *)buf, len, offset, tag);
+}
+
+Status aio_wait(AioQueue *q, unsigned *tag)
+{
+    unsigned slot;
+
+    if (q->nfree == q->depth)
+        return e_failure;
+
+    if (q->backend == e_aio_uring)
+    {
+        if (uring_reap(q, &slot) == e_failure)
+            return e_failure;
+    }
+    else
+    {
+        pthread_mutex_lock(&q->lock);
+        while (q->completed_len == 0)
+            pthread_cond_wait(&q->done, &q->lock);
+        slot = q->completed[q->completed_head];
+        q->completed_head = (q->completed_head + 1) % q->depth;
+        q->completed_len--;
+        pthread_mutex_unlock(&q->lock);
+    }
+
+    *tag = q->req[slot].tag;
+    q->free_slots[q->nfree++] = slot;
+    return q->req[slot].failed ? e_failure : e_success;
+}
+
+void aio_destroy(AioQueue *q)
+{
+    unsigned tag;
+
+    if (q == NULL)
+        return;
+
+    /* The kernel or an I/O thread may still be using the callers' buffers; stop if the ring breaks */
+    while (q->req != NULL && q->nfree < q->depth)
+    {
+        unsigned before = q->nfree;
+        aio_wait(q, &tag);
+        if (q->nfree == before)
+            break;
+    }
+
+    if (q->backend == e_aio_uring)
+        uring_close(q);
+    else
+        threads_close(q);
+    free(q->req);
+    free(q->free_slots);
+    free(q);
+}
+
+/* Window buffer states in aio_stream() */
+enum { e_win_idle, e_win_reading, e_win_ready, e_win_writing };
+
+Status aio_stream(AioQueue *q, int src_fd, int dst_fd, uint64_t start, uint64_t end, size_t window,
+                  unsigned char *bufs, aio_window_fn fn, void *ctx, Stats *stats)
+{
+    uint64_t count = end > start ? (end - start + window - 1) / window : 0;
+    unsigned char *owned = bufs == NULL ? malloc((size_t)AIO_DEPTH * window) : NULL;
+    uint64_t win[AIO_DEPTH];
+    int state[AIO_DEPTH];
+    unsigned busy = 0;
+    uint64_t next = 0;
+    Status ret = e_success;
+
+    if (bufs == NULL && (bufs = owned) == NULL)
+        return e_failure;
+
+    /* Window w always uses buffer w % AIO_DEPTH, so they are handed to fn in order */
+    for (unsigned b = 0; b < AIO_DEPTH; b++)
+    {
+        win[b] = b;
+        state[b] = e_win_idle;
+        if (b < count && ret == e_success)
+        {
+            size_t len = end - (start + b * window) < window ? (size_t)(end - (start + b * window)) : window;
+            ret = aio_read(q, src_fd, bufs + b * window, len, start + b * window, b);
+            state[b] = e_win_reading;
+            busy += ret == e_success;
+        }
+    }
+
+    while (ret == e_success && (next < count || busy > 0))
+    {
+        unsigned b = next % AIO_DEPTH;
+        unsigned tag;
+
+        if (next < count && state[b] == e_win_ready)
+        {
+            uint64_t off = start + next * window;
+            size_t len = end - off < window ? (size_t)(end - off) : window;
+
+            if (fn != NULL && fn(ctx, bufs + b * window, len, off) == e_failure)
+                ret = e_failure;
+            else if ((ret = aio_write(q, dst_fd, bufs + b * window, len, off, b)) == e_success)
+            {
+                state[b] = e_win_writing;
+                busy++;
+                next++;
+            }
+            continue;
+        }
+
+        ret = aio_wait(q, &tag);
+        busy--;
+        if (ret == e_failure)
+            break;
+
+        uint64_t off = start + win[tag] * window;
+        size_t len = end - off < window ? (size_t)(end - off) : window;
+
+        if (state[tag] == e_win_reading)
+        {
+            stats_add_read(stats, len);
+            state[tag] = e_win_ready;
+            continue;
+        }
+
+        /* Written: the buffer takes the window AIO_DEPTH further on */
+        stats_add_write(stats, len);
+        state[tag] = e_win_idle;
+        win[tag] += AIO_DEPTH;
+        if (win[tag] < count)
+        {
+            off = start + win[tag] * window;
+            len = end - off < window ? (size_t)(end - off) : window;
+            ret = aio_read(q, src_fd, bufs + tag * window, len, off, tag);
+            state[tag] = e_win_reading;
+            busy += ret == e_success;
+        }
+    }
+
+    /* Nothing may land in the buffers once they are freed or reused */
+    while (busy > 0)
+    {
+        unsigned tag;
+        aio_wait(q, &tag);
+        busy--;
+    }
+
+    free(owned);
+    return ret;
+}
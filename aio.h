@@ -0,0 +1,64 @@
+#ifndef AIO_H
+#define AIO_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "types.h"
+#include "stats.h"
+
+/*
+ * Overlapped positional I/O. Requests are queued and complete in any
+ * order; the io_uring backend talks to the kernel rings directly, the
+ * fallback runs pread/pwrite on a few I/O threads.
+ */
+
+/* Image bytes per pipeline window, and windows in flight */
+#define AIO_WINDOW (1024 * 1024)
+#define AIO_DEPTH  4
+
+/* Threads the fallback backend runs the requests on */
+#define AIO_THREADS 2
+
+typedef enum
+{
+    e_aio_auto,         /* io_uring when the kernel allows it, else threads */
+    e_aio_uring,
+    e_aio_threads,
+    e_aio_off           /* plain stdio, no pipeline */
+} AioMode;
+
+typedef struct AioQueue AioQueue;
+
+/* Queue for up to `depth` requests in flight; NULL if the mode is unavailable */
+AioQueue *aio_create(AioMode mode, unsigned depth);
+
+/* "io_uring" or "threads" */
+const char *aio_backend(const AioQueue *q);
+
+/*
+ * Start reading or writing len bytes at offset. Short transfers are
+ * continued internally; tag comes back from aio_wait() once all of it
+ * is done.
+ */
+Status aio_read(AioQueue *q, int fd, void *buf, size_t len, uint64_t offset, unsigned tag);
+Status aio_write(AioQueue *q, int fd, const void *buf, size_t len, uint64_t offset, unsigned tag);
+
+/* Wait for one request to finish; e_failure (tag still set) if it failed */
+Status aio_wait(AioQueue *q, unsigned *tag);
+
+/* Wait out whatever is still in flight and free the queue */
+void aio_destroy(AioQueue *q);
+
+/* Called on each window between its read and its write, in file order */
+typedef Status (*aio_window_fn)(void *ctx, unsigned char *buf, size_t len, uint64_t offset);
+
+/*
+ * Stream file bytes [start, end) from src_fd to the same offsets of
+ * dst_fd through AIO_DEPTH windows of `window` bytes at bufs (NULL:
+ * allocated for the call): reads run ahead and writes drain behind while
+ * fn (NULL = plain copy) works on the window in between.
+ */
+Status aio_stream(AioQueue *q, int src_fd, int dst_fd, uint64_t start, uint64_t end, size_t window,
+                  unsigned char *bufs, aio_window_fn fn, void *ctx, Stats *stats);
+
+#endif
@@ -0,0 +1,96 @@
+#include <string.h>
+#include "archive.h"
+#include "common.h"
+
+int archive_name_ok(const char *name)
+{
+    size_t len = strlen(name);
+
+    return len > 0 && len <= ARCHIVE_NAME_MAX && strchr(name, '/') == NULL &&
+           strcmp(name, ".") != 0 && strcmp(name, "..") != 0;
+}
+
+size_t archive_toc_len(const ArchiveEntry *entries, int count)
+{
+    size_t len = ARCHIVE_TOC_FIXED;
+
+    for (int i = 0; i < count; i++)
+        len += ARCHIVE_ENTRY_FIXED + strlen(entries[i].name);
+    return len;
+}
+
+uint64_t archive_build_toc(ArchiveEntry *entries, int count, unsigned char *toc)
+{
+    size_t toc_len = archive_toc_len(entries, count);
+    uint64_t offset = toc_len;
+    unsigned char *p = toc + ARCHIVE_TOC_FIXED;
+
+    stego_put_be(toc, (uint32_t)count, 4);
+    stego_put_be(toc + 4, (uint32_t)toc_len, 4);
+
+    for (int i = 0; i < count; i++)
+    {
+        size_t name_len = strlen(entries[i].name);
+
+        entries[i].offset = offset;
+        offset += entries[i].size;
+
+        *p++ = (unsigned char)name_len;
+        memcpy(p, entries[i].name, name_len);
+        p += name_len;
+        stego_put_be(p, entries[i].offset, 8);
+        stego_put_be(p + 8, entries[i].size, 8);
+        p += 16;
+    }
+    return offset;
+}
+
+Status archive_toc_header(const unsigned char *hdr, uint64_t payload_size, uint32_t *count, uint32_t *toc_len)
+{
+    *count = (uint32_t)stego_get_be(hdr, 4);
+    *toc_len = (uint32_t)stego_get_be(hdr + 4, 4);
+
+    /* Every entry needs its fixed fields plus a name byte */
+    if (*toc_len < ARCHIVE_TOC_FIXED || *toc_len > payload_size ||
+        *count > (*toc_len - ARCHIVE_TOC_FIXED) / (ARCHIVE_ENTRY_FIXED + 1))
+        return e_failure;
+    return e_success;
+}
+
+Status archive_parse_toc(const unsigned char *toc, size_t toc_len, uint64_t payload_size,
+                         ArchiveEntry *entries, uint32_t count)
+{
+    const unsigned char *p = toc + ARCHIVE_TOC_FIXED;
+    const unsigned char *end = toc + toc_len;
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+        if (end - p < ARCHIVE_ENTRY_FIXED)
+            return e_failure;
+
+        size_t name_len = *p++;
+        if ((size_t)(end - p) < name_len + 16)
+            return e_failure;
+
+        memcpy(entries[i].name, p, name_len);
+        entries[i].name[name_len] = '\0';
+        p += name_len;
+        entries[i].offset = stego_get_be(p, 8);
+        entries[i].size = stego_get_be(p + 8, 8);
+        p += 16;
+
+        if (!archive_name_ok(entries[i].name) || strlen(entries[i].name) != name_len ||
+            entries[i].offset < toc_len || entries[i].offset > payload_size ||
+            entries[i].size > payload_size - entries[i].offset)
+            return e_failure;
+    }
+    return p == end ? e_success : e_failure;
+}
+
+const ArchiveEntry *archive_find(const ArchiveEntry *entries, uint32_t count, const char *name)
+{
+    for (uint32_t i = 0; i < count; i++)
+        if (strcmp(entries[i].name, name) == 0)
+            return &entries[i];
+    return NULL;
+}
@@ -0,0 +1,77 @@
+#ifndef ARCHIVE_H
+#define ARCHIVE_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "types.h"
+#include "stats.h"
+
+/*
+ * Archive payloads (v2 flag STEGO_FLAG_ARCHIVE): a table of contents
+ * followed by every member back to back. Big-endian throughout:
+ *   TOC:   entry count (32) | TOC length (32) | entries
+ *   entry: name length (8) | name | offset (64) | size (64)
+ * Offsets count payload bytes from the start of the TOC, so a member is
+ * just a --range of the payload.
+ */
+
+#define ARCHIVE_EXTN        ".arc"  /* extension stored in the stego header */
+#define ARCHIVE_TOC_FIXED   8
+#define ARCHIVE_ENTRY_FIXED (1 + 8 + 8)
+#define ARCHIVE_NAME_MAX    255
+
+typedef struct
+{
+    char name[ARCHIVE_NAME_MAX + 1];
+    uint64_t offset;
+    uint64_t size;
+} ArchiveEntry;
+
+/* A member name is a plain file name: no '/', not "." or "..", 1-255 bytes */
+int archive_name_ok(const char *name);
+
+/* TOC bytes for these entries */
+size_t archive_toc_len(const ArchiveEntry *entries, int count);
+
+/*
+ * Assign member offsets in order and write the TOC (archive_toc_len()
+ * bytes) into toc. Returns the whole payload size.
+ */
+uint64_t archive_build_toc(ArchiveEntry *entries, int count, unsigned char *toc);
+
+/* Read the entry count and TOC length from the first ARCHIVE_TOC_FIXED bytes */
+Status archive_toc_header(const unsigned char *hdr, uint64_t payload_size, uint32_t *count, uint32_t *toc_len);
+
+/* Parse count entries, checking names and that every member lies inside the payload */
+Status archive_parse_toc(const unsigned char *toc, size_t toc_len, uint64_t payload_size,
+                         ArchiveEntry *entries, uint32_t count);
+
+/* Entry called name, or NULL */
+const ArchiveEntry *archive_find(const ArchiveEntry *entries, uint32_t count, const char *name);
+
+/* Encode side: the TOC then every member file, read as one stream (archive_io.c) */
+typedef struct
+{
+    char **paths;
+    ArchiveEntry *entries;
+    int count;
+    unsigned char *toc;
+    size_t toc_len;
+    uint64_t total;             /* payload size: TOC plus members */
+
+    uint64_t pos;               /* payload bytes handed out so far */
+    int member;                 /* member open in fp */
+    FILE *fp;
+    Stats *stats;
+} ArchiveSource;
+
+/* Size every member (regular files, unique names) and build the TOC */
+Status archive_source_open(ArchiveSource *src, char **paths, int count, Stats *stats);
+
+/* Next payload bytes; short only when a member shrank or failed to open */
+size_t archive_source_read(ArchiveSource *src, unsigned char *buf, size_t n);
+
+void archive_source_close(ArchiveSource *src);
+
+#endif
@@ -0,0 +1,142 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include "archive.h"
+#include "diag.h"
+
+static int cmp_names(const void *a, const void *b)
+{
+    return strcmp(((const ArchiveEntry *)a)->name, ((const ArchiveEntry *)b)->name);
+}
+
+/* Member names are the base names of the paths; they must be unique */
+static Status check_names(const ArchiveEntry *entries, int count)
+{
+    ArchiveEntry *sorted = malloc(count * sizeof(*sorted));
+    Status ret = e_success;
+
+    if (sorted == NULL)
+        return e_failure;
+
+    memcpy(sorted, entries, count * sizeof(*sorted));
+    qsort(sorted, count, sizeof(*sorted), cmp_names);
+    for (int i = 1; i < count; i++)
+    {
+        if (strcmp(sorted[i - 1].name, sorted[i].name) == 0)
+        {
+            diag_error("Error! Two archive members are named %s\n", sorted[i].name);
+            ret = e_failure;
+            break;
+        }
+    }
+
+    free(sorted);
+    return ret;
+}
+
+Status archive_source_open(ArchiveSource *src, char **paths, int count, Stats *stats)
+{
+    memset(src, 0, sizeof(*src));
+    src->paths = paths;
+    src->count = count;
+    src->stats = stats;
+
+    if (count < 1 || count > 0xFFFF)
+    {
+        diag_error("Error! An archive holds 1 to 65535 files\n");
+        return e_failure;
+    }
+
+    src->entries = calloc(count, sizeof(*src->entries));
+    if (src->entries == NULL)
+        return e_failure;
+
+    for (int i = 0; i < count; i++)
+    {
+        const char *base = strrchr(paths[i], '/');
+        struct stat st;
+
+        base = base != NULL ? base + 1 : paths[i];
+        if (!archive_name_ok(base))
+        {
+            diag_error("Error! %s is not a valid archive member name\n", paths[i]);
+            return e_failure;
+        }
+        if (stat(paths[i], &st) != 0 || !S_ISREG(st.st_mode))
+        {
+            diag_error("Error! Archive member %s is not a readable regular file\n", paths[i]);
+            return e_failure;
+        }
+        strcpy(src->entries[i].name, base);
+        src->entries[i].size = (uint64_t)st.st_size;
+    }
+
+    if (check_names(src->entries, count) == e_failure)
+        return e_failure;
+
+    src->toc_len = archive_toc_len(src->entries, count);
+    src->toc = malloc(src->toc_len);
+    if (src->toc == NULL)
+        return e_failure;
+    src->total = archive_build_toc(src->entries, count, src->toc);
+    return e_success;
+}
+
+size_t archive_source_read(ArchiveSource *src, unsigned char *buf, size_t n)
+{
+    size_t done = 0;
+
+    while (done < n && src->pos < src->total)
+    {
+        if (src->pos < src->toc_len)
+        {
+            size_t take = src->toc_len - src->pos < n - done ? (size_t)(src->toc_len - src->pos) : n - done;
+            memcpy(buf + done, src->toc + src->pos, take);
+            src->pos += take;
+            done += take;
+            continue;
+        }
+
+        /* Step to the member holding pos (empty members are passed over) */
+        const ArchiveEntry *e = &src->entries[src->member];
+        if (src->pos == e->offset + e->size)
+        {
+            if (src->fp != NULL)
+                fclose(src->fp);
+            src->fp = NULL;
+            src->member++;
+            continue;
+        }
+
+        if (src->fp == NULL)
+        {
+            src->fp = fopen(src->paths[src->member], "r");
+            if (src->fp == NULL)
+            {
+                perror("fopen");
+                return done;
+            }
+        }
+
+        uint64_t left = e->offset + e->size - src->pos;
+        size_t take = left < n - done ? (size_t)left : n - done;
+        size_t got = stats_fread(src->stats, buf + done, take, src->fp);
+        src->pos += got;
+        done += got;
+        if (got < take)
+            return done;
+    }
+    return done;
+}
+
+void archive_source_close(ArchiveSource *src)
+{
+    if (src->fp != NULL)
+        fclose(src->fp);
+    free(src->entries);
+    free(src->toc);
+    src->fp = NULL;
+    src->entries = NULL;
+    src->toc = NULL;
+}
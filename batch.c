@@ -0,0 +1,350 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+#include "batch.h"
+#include "encode.h"
+#include "decode.h"
+#include "parallel.h"
+#include "stats.h"
+#include "pipe_io.h"
+#include "diag.h"
+
+/* State shared by the batch workers */
+typedef struct
+{
+    const BatchConfig *cfg;
+    BatchJob *jobs;
+    BatchWorker *workers;       /* per-worker buffers */
+
+    pthread_mutex_t out_lock;   /* guards stdout and the counters below */
+    uint64_t ok;
+    uint64_t failed;
+    uint64_t payload_bytes;
+} BatchRun;
+
+static double now_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int batch_parse_job(char *line, BatchJob *job)
+{
+    char *save = NULL;
+    int argc = 1;
+    int extra = 0;
+
+    job->line = line;
+    job->argv[0] = "batch";
+    for (char *tok = strtok_r(line, " \t\r\n", &save); tok != NULL; tok = strtok_r(NULL, " \t\r\n", &save))
+    {
+        if (tok[0] == '#')
+            break;
+        if (argc < 5)
+            job->argv[argc++] = tok;
+        else
+            extra = 1;
+    }
+    for (int i = argc; i < 6; i++)
+        job->argv[i] = NULL;
+
+    if (argc == 1)
+        return 0;
+
+    job->op = e_unsupported;
+    if (strcmp(job->argv[1], "e") == 0 && argc == 5)
+    {
+        job->op = e_encode;
+        job->argv[1] = "-e";
+    }
+    else if (strcmp(job->argv[1], "d") == 0 && argc == 4)
+    {
+        job->op = e_decode;
+        job->argv[1] = "-d";
+    }
+    else if (strcmp(job->argv[1], "i") == 0 && argc == 3)
+    {
+        job->op = e_inspect;
+        job->argv[1] = "-i";
+    }
+
+    /* "-" would hand the process's own stdin/stdout to one job */
+    for (int i = 2; i < argc; i++)
+        if (pipe_is_std(job->argv[i]))
+            job->op = e_unsupported;
+
+    /* So would guessing which of too many paths were meant */
+    if (extra)
+        job->op = e_unsupported;
+
+    return 1;
+}
+
+Status batch_worker_init(BatchWorker *w, const BatchConfig *cfg)
+{
+    w->dec_buf_size = cfg->block_size ? cfg->block_size : DECODE_BUF_DEFAULT;
+    w->dec_buf = malloc(w->dec_buf_size);
+    w->enc_buf = malloc(2 * ENCODE_IO_BUF_SIZE);
+    w->aio = NULL;
+    w->aio_buf = NULL;
+
+    /* One queue per worker for all its jobs; without one, encodes use stdio */
+    if (!cfg->use_mmap && cfg->aio != e_aio_off && (w->aio = aio_create(cfg->aio, 2 * AIO_DEPTH)) != NULL &&
+        (w->aio_buf = malloc(ENCODE_AIO_BUF_SIZE)) == NULL)
+    {
+        aio_destroy(w->aio);
+        w->aio = NULL;
+    }
+    return w->dec_buf != NULL && w->enc_buf != NULL ? e_success : e_failure;
+}
+
+void batch_worker_free(BatchWorker *w)
+{
+    free(w->dec_buf);
+    free(w->enc_buf);
+    aio_destroy(w->aio);
+    free(w->aio_buf);
+    w->dec_buf = NULL;
+    w->enc_buf = NULL;
+    w->aio = NULL;
+    w->aio_buf = NULL;
+}
+
+/* Read the manifest into an array of jobs */
+static BatchJob *load_manifest(const char *fname, size_t *njobs)
+{
+    FILE *fp = fopen(fname, "r");
+    BatchJob *jobs = NULL;
+    size_t count = 0, cap = 0;
+    char *line = NULL;
+    size_t line_cap = 0;
+    int lineno = 0;
+    int failed = 0;
+
+    if (fp == NULL)
+    {
+        perror("fopen");
+        printf("Error! Unable to open manifest %s\n", fname);
+        return NULL;
+    }
+
+    while (!failed && getline(&line, &line_cap, fp) != -1)
+    {
+        lineno++;
+        if (count == cap)
+        {
+            cap = cap ? 2 * cap : 256;
+            BatchJob *grown = realloc(jobs, cap * sizeof(*jobs));
+            if (grown == NULL)
+            {
+                failed = 1;
+                break;
+            }
+            jobs = grown;
+        }
+
+        char *copy = strdup(line);
+        if (copy == NULL)
+            failed = 1;
+        else if (batch_parse_job(copy, &jobs[count]))
+            jobs[count++].lineno = lineno;
+        else
+            free(copy);
+    }
+
+    /* A job list cut short would still report success for the jobs it kept */
+    if (failed || !feof(fp))
+    {
+        printf("Error! Unable to read manifest %s (line %d)\n", fname, lineno);
+        for (size_t i = 0; i < count; i++)
+            free(jobs[i].line);
+        free(jobs);
+        jobs = NULL;
+    }
+    else if (jobs == NULL)
+        jobs = calloc(1, sizeof(*jobs));
+
+    free(line);
+    fclose(fp);
+    *njobs = count;
+    return jobs;
+}
+
+void batch_run_job(const BatchConfig *cfg, const BatchJob *job, BatchWorker *w, BatchResult *res)
+{
+    double start = now_seconds();
+
+    memset(res, 0, sizeof(*res));
+    res->status = e_failure;
+    res->queue_ms = -1;
+
+    /* Error lines would otherwise land in the JSON result stream */
+    diag_capture(res->error, sizeof(res->error));
+
+    if (job->op == e_encode)
+    {
+        EncodeInfo encInfo = {0};
+        encInfo.header_version = cfg->header_version;
+        encInfo.depth = cfg->depth;
+        encInfo.channels = cfg->channels;
+        encInfo.use_mmap = cfg->use_mmap;
+        encInfo.compress = cfg->compress;
+        encInfo.checksum = cfg->checksum;
+        encInfo.key = cfg->key;
+        encInfo.threads = 1;
+        encInfo.quiet = 1;
+        encInfo.io_buf = w->enc_buf;
+        encInfo.aio = w->aio != NULL ? cfg->aio : e_aio_off;
+        encInfo.aio_queue = w->aio;
+        encInfo.aio_shared = 1;
+        encInfo.aio_buf = w->aio_buf;
+
+        if (read_and_validate_encode_args((char **)job->argv, &encInfo) == e_success)
+            res->status = encInfo.use_mmap ? do_encoding_mmap(&encInfo) : do_encoding(&encInfo);
+        res->payload_bytes = encInfo.size_secret_file;
+    }
+    else if (job->op == e_decode)
+    {
+        DecodeInfo decInfo = {0};
+        decInfo.img_buf = w->dec_buf;
+        decInfo.buf_size = w->dec_buf_size;
+        decInfo.threads = 1;
+        decInfo.quiet = 1;
+        decInfo.key = cfg->key;
+
+        if (read_and_validate_decode_args((char **)job->argv, &decInfo) == e_success)
+            res->status = do_decoding(&decInfo);
+        res->payload_bytes = decInfo.size_secret_file;
+        res->corrupt = decInfo.checksum_failed;
+    }
+    else if (job->op == e_inspect)
+    {
+        res->status = probe_image(job->argv[2], cfg->channels, &res->probe);
+        res->payload_bytes = res->probe.secret_size;
+        if (res->status == e_failure && res->probe.error != NULL)
+            snprintf(res->error, sizeof(res->error), "%s", res->probe.error);
+    }
+    else
+    {
+        int piped = 0;
+        for (int i = 2; job->argv[i] != NULL; i++)
+            piped |= pipe_is_std(job->argv[i]);
+        snprintf(res->error, sizeof(res->error), "%s",
+                 piped ? "\"-\" (stdin/stdout) is not accepted as a job path" : "invalid manifest line");
+    }
+
+    diag_capture(NULL, 0);
+    if (res->status == e_failure && res->error[0] == '\0')
+        snprintf(res->error, sizeof(res->error), "%s", res->corrupt ? "checksum mismatch" : "failed");
+    res->ms = (now_seconds() - start) * 1e3;
+}
+
+void batch_print_result(const BatchJob *job, const BatchResult *res, const char *id_field, FILE *out)
+{
+    const char *op = job->op == e_encode ? "encode" : job->op == e_decode ? "decode" :
+                     job->op == e_inspect ? "inspect" : "invalid";
+
+    fprintf(out, "{\"%s\":%d,\"op\":", id_field, job->lineno);
+    json_print_string(op, out);
+    fprintf(out, ",\"input\":");
+    json_print_string(job->argv[2] != NULL ? job->argv[2] : "", out);
+    if (job->op != e_inspect)
+    {
+        fprintf(out, ",\"output\":");
+        json_print_string(job->op == e_encode ? job->argv[4] : job->argv[3] != NULL ? job->argv[3] : "", out);
+    }
+    fprintf(out, ",\"status\":\"%s\",\"payload_bytes\":%llu,\"ms\":%.3f",
+            res->status == e_success ? "ok" : res->corrupt ? "corrupt" : "failed",
+            (unsigned long long)res->payload_bytes, res->ms);
+    if (res->queue_ms >= 0)
+        fprintf(out, ",\"queue_ms\":%.3f", res->queue_ms);
+    if (res->status == e_failure)
+    {
+        fprintf(out, ",\"error\":");
+        json_print_string(res->error, out);
+    }
+    if (job->op == e_inspect)
+    {
+        fprintf(out, ",\"probe\":");
+        probe_print_json(job->argv[2], res->status, &res->probe, out);
+    }
+    fprintf(out, "}");
+}
+
+/* Run job `index` on worker `worker` and print its result line */
+static Status run_job(void *ctx, int worker, uint64_t index, uint64_t len)
+{
+    BatchRun *run = ctx;
+    BatchJob *job = &run->jobs[index];
+    BatchResult res;
+
+    (void)len;
+    batch_run_job(run->cfg, job, &run->workers[worker], &res);
+
+    pthread_mutex_lock(&run->out_lock);
+    if (res.status == e_success)
+    {
+        run->ok++;
+        run->payload_bytes += res.payload_bytes;
+    }
+    else
+        run->failed++;
+
+    batch_print_result(job, &res, "line", stdout);
+    printf("\n");
+    fflush(stdout);
+    pthread_mutex_unlock(&run->out_lock);
+
+    return e_success;
+}
+
+Status run_batch(const char *manifest_fname, const BatchConfig *cfg)
+{
+    size_t njobs = 0;
+    BatchJob *jobs = load_manifest(manifest_fname, &njobs);
+    if (jobs == NULL)
+        return e_failure;
+
+    int workers = cfg->workers < 1 ? 1 : cfg->workers;
+    if ((size_t)workers > njobs)
+        workers = njobs > 0 ? (int)njobs : 1;
+
+    BatchRun run = { cfg, jobs, NULL, PTHREAD_MUTEX_INITIALIZER, 0, 0, 0 };
+    Status ret = e_failure;
+
+    /* I/O buffers are allocated once per worker and reused by every job it runs */
+    run.workers = calloc(workers, sizeof(*run.workers));
+    int have_bufs = run.workers != NULL;
+    for (int i = 0; have_bufs && i < workers; i++)
+        have_bufs = batch_worker_init(&run.workers[i], cfg) == e_success;
+
+    if (!have_bufs)
+        printf("Error! Unable to allocate batch worker buffers.\n");
+    else
+    {
+        double start = now_seconds();
+        parallel_for_chunks(workers, njobs, 1, run_job, &run);
+        double elapsed = now_seconds() - start;
+
+        printf("{\"summary\":{\"jobs\":%zu,\"ok\":%llu,\"failed\":%llu,\"workers\":%d,"
+               "\"payload_bytes\":%llu,\"seconds\":%.3f,\"jobs_per_sec\":%.1f,\"payload_mb_per_sec\":%.2f}}\n",
+               njobs, (unsigned long long)run.ok, (unsigned long long)run.failed, workers,
+               (unsigned long long)run.payload_bytes, elapsed,
+               elapsed > 0 ? njobs / elapsed : 0.0,
+               elapsed > 0 ? run.payload_bytes / elapsed / (1024.0 * 1024.0) : 0.0);
+        ret = run.failed == 0 ? e_success : e_failure;
+    }
+
+    for (int i = 0; run.workers != NULL && i < workers; i++)
+        batch_worker_free(&run.workers[i]);
+    free(run.workers);
+    for (size_t i = 0; i < njobs; i++)
+        free(jobs[i].line);
+    free(jobs);
+    pthread_mutex_destroy(&run.out_lock);
+
+    return ret;
+}
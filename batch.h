@@ -0,0 +1,89 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "types.h"
+#include "bmp.h"
+#include "probe.h"
+#include "aio.h"
+
+/*
+ * Batch mode: run many encode/decode jobs from a manifest in one process.
+ * Manifest lines (whitespace separated, '#' starts a comment):
+ *   e <carrier.bmp> <secret> <output.bmp>
+ *   d <stego.bmp> <output_file>
+ *   i <image.bmp>
+ * "-" (stdin/stdout) is not accepted as a path: such lines are invalid,
+ * as are lines with more fields than their operation takes.
+ */
+
+typedef struct
+{
+    int workers;            /* concurrent jobs */
+    int header_version;     /* header written by encode jobs */
+    int depth;              /* payload bits per carrier byte for encode jobs */
+    ChannelMode channels;   /* carrier bytes used by encode jobs */
+    int use_mmap;           /* encode jobs go through the mmap path */
+    size_t block_size;      /* decode slice size (0 = default) */
+    int compress;           /* encode jobs LZ-compress the secret */
+    int checksum;           /* encode jobs append a CRC32C of the secret */
+    const char *key;        /* --key: keyed (scattered) layout for every job, or NULL */
+    AioMode aio;            /* overlapped I/O backend for encode jobs */
+} BatchConfig;
+
+/* One manifest line, tokenised into an argv the CLI validators accept */
+typedef struct
+{
+    char *line;             /* owns the strings argv points into */
+    int lineno;
+    OperationType op;       /* e_unsupported for a malformed line */
+    char *argv[6];          /* { "batch", "-e"/"-d"/"-i", positional..., NULL } */
+} BatchJob;
+
+/* Buffers a worker allocates once and reuses for every job it runs */
+typedef struct
+{
+    unsigned char *dec_buf;     /* decode slice */
+    size_t dec_buf_size;
+    char *enc_buf;              /* 2 * ENCODE_IO_BUF_SIZE stdio buffers */
+    AioQueue *aio;              /* overlapped encode queue (and its I/O threads), or NULL */
+    unsigned char *aio_buf;     /* ENCODE_AIO_BUF_SIZE pipeline buffers, with aio */
+} BatchWorker;
+
+typedef struct
+{
+    Status status;
+    int corrupt;            /* decode failed its checksum */
+    uint64_t payload_bytes;
+    double ms;              /* time spent running the job */
+    double queue_ms;        /* time spent waiting for a worker, or < 0 if not tracked */
+    ProbeResult probe;      /* inspect jobs */
+    char error[160];        /* why the job failed: its first error line */
+} BatchResult;
+
+/* Split a manifest line into job (argv points into line); returns 0 for blank and comment lines */
+int batch_parse_job(char *line, BatchJob *job);
+
+/* Allocate a worker's buffers, and its aio queue unless the config's encodes do not overlap */
+Status batch_worker_init(BatchWorker *w, const BatchConfig *cfg);
+void batch_worker_free(BatchWorker *w);
+
+/*
+ * Run one job with a worker's buffers; failures are recorded in res, never
+ * returned, and their error lines are kept in res->error instead of printed.
+ */
+void batch_run_job(const BatchConfig *cfg, const BatchJob *job, BatchWorker *w, BatchResult *res);
+
+/* The JSON object for a finished job, without a trailing newline; id_field names job->lineno */
+void batch_print_result(const BatchJob *job, const BatchResult *res, const char *id_field, FILE *out);
+
+/*
+ * Run every job in the manifest and print one JSON result line per job
+ * (with "error" for a failed one) plus a final summary line. Fails if the manifest cannot be read or
+ * any job failed.
+ */
+Status run_batch(const char *manifest_fname, const BatchConfig *cfg);
+
+#endif
@@ -0,0 +1,358 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "encode.h"
+#include "decode.h"
+#include "types.h"
+#include "common.h"
+#include "lsb_kernel.h"
+
+/*
+ * Throughput benchmark: times the LSB kernels and the full encode/decode
+ * paths over synthetic carriers and prints one JSON document to stdout.
+ *
+ *   ./bench_bin [max_size] [reps] [threads]
+ *
+ * max_size (K/M/G suffix, default 64M) caps the size sweep, reps is the
+ * number of timed runs after one warmup run (default 5).
+ */
+
+#define BENCH_DEFAULT_MAX   (64ULL << 20)
+#define BENCH_DEFAULT_REPS  5
+#define BENCH_KERNEL_MAX    (16ULL << 20)  /* in-memory kernels stop here */
+#define BENCH_BMP_WIDTH     1024
+
+static const uint64_t bench_sizes[] = {
+    4ULL << 10, 64ULL << 10, 1ULL << 20, 16ULL << 20, 256ULL << 20, 1ULL << 30
+};
+
+typedef struct
+{
+    int reps;
+    int threads;
+    char dir[256];
+    int first;              /* no result printed yet */
+} Bench;
+
+/* One timed operation over `bytes` bytes; returns e_failure to abort */
+typedef Status (*bench_fn)(void *ctx);
+
+static double now_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static uint64_t parse_size(const char *str)
+{
+    char *end;
+    unsigned long long val = strtoull(str, &end, 10);
+
+    if (*end == 'K' || *end == 'k')
+        val <<= 10;
+    else if (*end == 'M' || *end == 'm')
+        val <<= 20;
+    else if (*end == 'G' || *end == 'g')
+        val <<= 30;
+    return val;
+}
+
+/* Warm up once, time bench->reps runs and print the JSON result entry */
+static Status run_bench(Bench *bench, const char *name, uint64_t bytes, bench_fn fn, void *ctx)
+{
+    double times[64];
+    int reps = bench->reps;
+
+    if (fn(ctx) == e_failure)
+        return e_failure;
+
+    for (int i = 0; i < reps; i++)
+    {
+        double start = now_seconds();
+        if (fn(ctx) == e_failure)
+            return e_failure;
+        times[i] = now_seconds() - start;
+    }
+    qsort(times, reps, sizeof(double), cmp_double);
+
+    double median = times[reps / 2];
+    printf("%s\n    {\"bench\":\"%s\",\"bytes\":%llu,\"reps\":%d,"
+           "\"min_s\":%.9f,\"median_s\":%.9f,\"max_s\":%.9f,\"mb_s\":%.2f,\"ns_per_byte\":%.4f}",
+           bench->first ? "" : ",", name, (unsigned long long)bytes, reps,
+           times[0], median, times[reps - 1],
+           bytes / median / 1e6, median * 1e9 / bytes);
+    fflush(stdout);
+    bench->first = 0;
+    return e_success;
+}
+
+/* In-memory kernel state */
+typedef struct
+{
+    unsigned char *data;
+    unsigned char *carrier;
+    uint64_t n;             /* payload bytes */
+} KernelCtx;
+
+static Status bench_encode_byte(void *ctx)
+{
+    KernelCtx *k = ctx;
+    for (uint64_t i = 0; i < k->n; i++)
+        encode_byte_to_lsb((char)k->data[i], k->carrier + 8 * i);
+    return e_success;
+}
+
+static Status bench_decode_byte(void *ctx)
+{
+    KernelCtx *k = ctx;
+    for (uint64_t i = 0; i < k->n; i++)
+        k->data[i] = decode_byte_from_lsb(k->carrier + 8 * i);
+    return e_success;
+}
+
+static Status bench_embed_block(void *ctx)
+{
+    KernelCtx *k = ctx;
+    lsb_embed_block(k->data, k->n, k->carrier);
+    return e_success;
+}
+
+static Status bench_extract_block(void *ctx)
+{
+    KernelCtx *k = ctx;
+    lsb_extract_block(k->carrier, k->n, k->data);
+    return e_success;
+}
+
+/* File-level state */
+typedef struct
+{
+    char carrier[300];
+    char secret[300];
+    char stego[300];
+    char output[300];
+    char copy[300];
+    int threads;
+} FileCtx;
+
+static Status bench_copy_remaining(void *ctx)
+{
+    FileCtx *f = ctx;
+    FILE *src = fopen(f->carrier, "rb");
+    FILE *dst = fopen(f->copy, "wb");
+    Status ret = e_failure;
+
+    if (src != NULL && dst != NULL)
+        ret = copy_remaining_img_data(src, dst, NULL);
+    if (src != NULL)
+        fclose(src);
+    if (dst != NULL && fclose(dst) != 0)
+        ret = e_failure;
+    return ret;
+}
+
+static Status bench_do_encoding(void *ctx)
+{
+    FileCtx *f = ctx;
+    EncodeInfo encInfo = {0};
+
+    encInfo.src_image_fname = f->carrier;
+    encInfo.secret_fname = f->secret;
+    encInfo.stego_image_fname = f->stego;
+    encInfo.header_version = STEGO_V2;
+    encInfo.depth = 1;
+    encInfo.threads = f->threads;
+    encInfo.quiet = 1;
+    return do_encoding(&encInfo);
+}
+
+static Status bench_do_decoding(void *ctx)
+{
+    FileCtx *f = ctx;
+    DecodeInfo decInfo = {0};
+
+    decInfo.stego_image_fname = f->stego;
+    decInfo.secret_fname = f->output;
+    decInfo.threads = f->threads;
+    decInfo.quiet = 1;
+    return do_decoding(&decInfo);
+}
+
+static void fill_random(unsigned char *buf, uint64_t n)
+{
+    uint64_t x = 0x9E3779B97F4A7C15ULL;
+    for (uint64_t i = 0; i < n; i++)
+    {
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        buf[i] = (unsigned char)x;
+    }
+}
+
+/* Write a 24bpp BMP with at least `bytes` bytes of random pixel data */
+static Status write_carrier(const char *fname, uint64_t bytes)
+{
+    uint64_t row = BENCH_BMP_WIDTH * 3;
+    uint64_t height = (bytes + row - 1) / row;
+    uint64_t pixels = row * height;
+    unsigned char hdr[54] = {'B', 'M'};
+    unsigned char buf[1 << 16];
+    FILE *fp = fopen(fname, "wb");
+
+    if (fp == NULL)
+        return e_failure;
+
+    uint32_t fields[] = {
+        (uint32_t)(54 + pixels), 0, 54, 40, BENCH_BMP_WIDTH, (uint32_t)height
+    };
+    memcpy(hdr + 2, fields, sizeof(fields));   /* little-endian host */
+    hdr[26] = 1;
+    hdr[28] = 24;
+    fwrite(hdr, 1, sizeof(hdr), fp);
+
+    fill_random(buf, sizeof(buf));
+    for (uint64_t left = pixels; left > 0;)
+    {
+        size_t n = left < sizeof(buf) ? (size_t)left : sizeof(buf);
+        if (fwrite(buf, 1, n, fp) != n)
+        {
+            fclose(fp);
+            return e_failure;
+        }
+        left -= n;
+    }
+
+    return fclose(fp) == 0 ? e_success : e_failure;
+}
+
+static Status write_secret(const char *fname, uint64_t bytes)
+{
+    unsigned char buf[1 << 16];
+    FILE *fp = fopen(fname, "wb");
+
+    if (fp == NULL)
+        return e_failure;
+
+    fill_random(buf, sizeof(buf));
+    for (uint64_t left = bytes; left > 0;)
+    {
+        size_t n = left < sizeof(buf) ? (size_t)left : sizeof(buf);
+        if (fwrite(buf, 1, n, fp) != n)
+        {
+            fclose(fp);
+            return e_failure;
+        }
+        left -= n;
+    }
+
+    return fclose(fp) == 0 ? e_success : e_failure;
+}
+
+static Status bench_kernels(Bench *bench, uint64_t n)
+{
+    KernelCtx k;
+    Status ret = e_failure;
+
+    k.n = n;
+    k.data = malloc(n);
+    k.carrier = malloc(8 * n);
+    if (k.data != NULL && k.carrier != NULL)
+    {
+        fill_random(k.data, n);
+        fill_random(k.carrier, 8 * n);
+
+        if (run_bench(bench, "encode_byte_to_lsb", n, bench_encode_byte, &k) == e_success &&
+            run_bench(bench, "decode_byte_from_lsb", n, bench_decode_byte, &k) == e_success &&
+            run_bench(bench, "lsb_embed_block", n, bench_embed_block, &k) == e_success &&
+            run_bench(bench, "lsb_extract_block", n, bench_extract_block, &k) == e_success)
+            ret = e_success;
+    }
+
+    free(k.data);
+    free(k.carrier);
+    return ret;
+}
+
+/* End-to-end runs over a carrier of `bytes` pixel bytes, filled with payload */
+static Status bench_files(Bench *bench, uint64_t bytes)
+{
+    FileCtx f;
+    uint64_t payload = bytes / 8 > 1024 ? bytes / 8 - 1024 : bytes / 16;
+    Status ret = e_failure;
+
+    snprintf(f.carrier, sizeof(f.carrier), "%s/carrier.bmp", bench->dir);
+    snprintf(f.secret, sizeof(f.secret), "%s/secret.bin", bench->dir);
+    snprintf(f.stego, sizeof(f.stego), "%s/stego.bmp", bench->dir);
+    snprintf(f.output, sizeof(f.output), "%s/output.bin", bench->dir);
+    snprintf(f.copy, sizeof(f.copy), "%s/copy.bmp", bench->dir);
+    f.threads = bench->threads;
+
+    if (write_carrier(f.carrier, bytes) == e_success &&
+        write_secret(f.secret, payload) == e_success &&
+        run_bench(bench, "copy_remaining_img_data", bytes, bench_copy_remaining, &f) == e_success &&
+        run_bench(bench, "do_encoding", bytes, bench_do_encoding, &f) == e_success &&
+        run_bench(bench, "do_decoding", bytes, bench_do_decoding, &f) == e_success)
+        ret = e_success;
+
+    unlink(f.carrier);
+    unlink(f.secret);
+    unlink(f.stego);
+    unlink(f.output);
+    unlink(f.copy);
+    return ret;
+}
+
+int main(int argc, char *argv[])
+{
+    Bench bench = { BENCH_DEFAULT_REPS, 1, "", 1 };
+    uint64_t max_size = argc > 1 ? parse_size(argv[1]) : BENCH_DEFAULT_MAX;
+
+    if (argc > 2)
+        bench.reps = atoi(argv[2]);
+    if (argc > 3)
+        bench.threads = atoi(argv[3]);
+    if (max_size == 0 || bench.reps < 1 || bench.reps > 64 || bench.threads < 1)
+    {
+        fprintf(stderr, "Usage: %s [max_size[K|M|G]] [reps 1-64] [threads]\n", argv[0]);
+        return 1;
+    }
+
+    const char *tmp = getenv("TMPDIR");
+    snprintf(bench.dir, sizeof(bench.dir), "%s/stego-bench-XXXXXX", tmp != NULL ? tmp : "/tmp");
+    if (mkdtemp(bench.dir) == NULL)
+    {
+        perror("mkdtemp");
+        return 1;
+    }
+
+    lsb_kernel_init();
+    printf("{\"kernel\":\"%s\",\"reps\":%d,\"threads\":%d,\"max_size\":%llu,\"results\":[",
+           lsb_kernel_name(), bench.reps, bench.threads, (unsigned long long)max_size);
+
+    Status ret = e_success;
+    for (size_t i = 0; i < sizeof(bench_sizes) / sizeof(bench_sizes[0]) && ret == e_success; i++)
+    {
+        uint64_t size = bench_sizes[i];
+        if (size > max_size)
+            break;
+
+        if (size <= BENCH_KERNEL_MAX)
+            ret = bench_kernels(&bench, size);
+        if (ret == e_success)
+            ret = bench_files(&bench, size);
+    }
+
+    printf("\n  ],\"status\":\"%s\"}\n", ret == e_success ? "ok" : "failed");
+    rmdir(bench.dir);
+    return ret == e_success ? 0 : 1;
+}
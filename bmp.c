@@ -0,0 +1,194 @@
+#include <string.h>
+#include "bmp.h"
+
+/* Compression values accepted for uncompressed carriers */
+#define BI_RGB       0
+#define BI_BITFIELDS 3
+
+static uint32_t get_le32(const unsigned char *p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint16_t get_le16(const unsigned char *p)
+{
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+/* Byte index of the single byte covered by an 8-bit channel mask, -1 otherwise */
+static int mask_byte(uint32_t mask)
+{
+    for (int i = 0; i < 4; i++)
+        if (mask == 0xFFu << (8 * i))
+            return i;
+    return -1;
+}
+
+Status bmp_parse(const unsigned char *hdr, size_t len, uint64_t file_size, BmpInfo *info)
+{
+    memset(info, 0, sizeof(*info));
+
+    if (len < 14 + 40 || hdr[0] != 'B' || hdr[1] != 'M')
+    {
+        info->error = "not a BMP file";
+        return e_failure;
+    }
+
+    info->file_size = file_size;
+    info->data_offset = get_le32(hdr + 10);
+    info->dib_size = get_le32(hdr + 14);
+    info->width = (int32_t)get_le32(hdr + 18);
+    info->height = (int32_t)get_le32(hdr + 22);
+    info->bpp = get_le16(hdr + 28);
+    uint16_t planes = get_le16(hdr + 26);
+    uint32_t compression = get_le32(hdr + 30);
+
+    if (info->dib_size < 40 || planes != 1 || info->width <= 0 || info->height == 0)
+    {
+        info->error = "unsupported BMP header";
+        return e_failure;
+    }
+
+    if (info->bpp != 24 && info->bpp != 32)
+    {
+        info->error = "only 24bpp and 32bpp BMP images are supported";
+        return e_failure;
+    }
+
+    if (compression != BI_RGB && !(compression == BI_BITFIELDS && info->bpp == 32))
+    {
+        info->error = "compressed BMP images are not supported";
+        return e_failure;
+    }
+
+    if (info->data_offset < 14 + info->dib_size || info->data_offset > file_size)
+    {
+        info->error = "invalid BMP pixel data offset";
+        return e_failure;
+    }
+
+    if (info->height < 0)
+    {
+        info->top_down = 1;
+        info->height = -info->height;
+    }
+
+    /* Alpha position: V4/V5 masks when present, else the conventional top byte */
+    info->alpha_channel = 3;
+    if (info->bpp == 32 && compression == BI_BITFIELDS && info->dib_size >= 56 && len >= 14 + 56)
+    {
+        int idx = mask_byte(get_le32(hdr + 14 + 52));
+        if (idx >= 0)
+            info->alpha_channel = (uint32_t)idx;
+    }
+
+    info->row_stride = (((uint64_t)info->width * info->bpp + 31) / 32) * 4;
+    info->pixel_bytes = info->row_stride * (uint64_t)info->height;
+    if (info->pixel_bytes > file_size - info->data_offset)
+        info->pixel_bytes = file_size - info->data_offset;
+
+    return bmp_select_channels(info, e_channels_all);
+}
+
+Status bmp_select_channels(BmpInfo *info, ChannelMode mode)
+{
+    if (mode == e_channels_alpha)
+    {
+        if (info->bpp != 32)
+        {
+            info->error = "alpha-only embedding needs a 32bpp image";
+            return e_failure;
+        }
+        info->channels = e_channels_alpha;
+        info->carrier_stride = 4;
+        info->carrier_channel = info->alpha_channel;
+        info->row_carrier = (uint64_t)info->width;
+    }
+    else
+    {
+        info->channels = e_channels_all;
+        info->carrier_stride = 1;
+        info->carrier_channel = 0;
+        info->row_carrier = (uint64_t)info->width * (info->bpp / 8);
+    }
+
+    /*
+     * Whole rows, then what a truncated last row holds; one byte short of
+     * a full row, so no carrier byte's span reaches past the file.
+     */
+    uint64_t rows = info->pixel_bytes / info->row_stride;
+    uint64_t part = (info->pixel_bytes % info->row_stride) / info->carrier_stride;
+    info->carrier_bytes = rows * info->row_carrier + (part < info->row_carrier ? part : info->row_carrier - 1);
+    return e_success;
+}
+
+void bmp_select_v1_layout(BmpInfo *info)
+{
+    /* A larger DIB header was carrier too; the original encoder copied only 54 bytes */
+    info->pixel_bytes += info->data_offset - BMP_V1_DATA_OFFSET;
+    info->data_offset = BMP_V1_DATA_OFFSET;
+    info->channels = e_channels_all;
+    info->carrier_stride = 1;
+    info->carrier_channel = 0;
+    info->row_carrier = info->row_stride;
+    info->carrier_bytes = info->pixel_bytes;
+}
+
+uint64_t bmp_carrier_fit(const BmpInfo *info, uint64_t i, uint64_t len)
+{
+    uint64_t end = bmp_raw_pos(info, i) + len;
+    uint64_t col = end % info->row_stride / info->carrier_stride;
+    uint64_t j = end / info->row_stride * info->row_carrier +
+                 (col < info->row_carrier ? col : info->row_carrier - 1);
+
+    if (j > info->carrier_bytes)
+        j = info->carrier_bytes;
+    return j > i ? j - i : 0;
+}
+
+void bmp_gather(const BmpInfo *info, const unsigned char *raw, uint64_t first, size_t n, unsigned char *out)
+{
+    uint64_t col = first % info->row_carrier;
+    size_t pad = (size_t)(info->row_stride - info->row_carrier * info->carrier_stride);
+
+    raw += info->carrier_channel;
+    while (n > 0)
+    {
+        size_t run = info->row_carrier - col < n ? (size_t)(info->row_carrier - col) : n;
+
+        if (info->carrier_stride == 1)
+            memmove(out, raw, run);
+        else
+            for (size_t i = 0; i < run; i++)
+                out[i] = raw[i * info->carrier_stride];
+
+        /* On to the first pixel of the next row */
+        raw += run * info->carrier_stride + pad;
+        out += run;
+        n -= run;
+        col = 0;
+    }
+}
+
+void bmp_scatter(const BmpInfo *info, const unsigned char *in, uint64_t first, size_t n, unsigned char *raw)
+{
+    uint64_t col = first % info->row_carrier;
+    size_t pad = (size_t)(info->row_stride - info->row_carrier * info->carrier_stride);
+
+    raw += info->carrier_channel;
+    while (n > 0)
+    {
+        size_t run = info->row_carrier - col < n ? (size_t)(info->row_carrier - col) : n;
+
+        if (info->carrier_stride == 1)
+            memcpy(raw, in, run);
+        else
+            for (size_t i = 0; i < run; i++)
+                raw[i * info->carrier_stride] = in[i];
+
+        raw += run * info->carrier_stride + pad;
+        in += run;
+        n -= run;
+        col = 0;
+    }
+}
@@ -0,0 +1,127 @@
+#ifndef BMP_H
+#define BMP_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include "types.h"
+
+/* Bytes needed to parse any supported header (file header + V5 DIB header) */
+#define BMP_HEADER_MAX (14 + 124)
+
+/* Which bytes of the pixel array carry the payload */
+typedef enum
+{
+    e_channels_all,     /* every byte of the pixel array */
+    e_channels_alpha    /* only the alpha byte of each 32bpp pixel */
+} ChannelMode;
+
+/*
+ * Parsed BMP geometry. Carrier bytes are the selected channels of each
+ * row's pixels, rows in file order; the padding that ends a row is never
+ * a carrier byte, except in the v1 layout (bmp_select_v1_layout). Carrier
+ * byte i lives at bmp_carrier_offset(info, i).
+ */
+typedef struct
+{
+    uint64_t file_size;
+    uint32_t data_offset;       /* bfOffBits: start of the pixel array */
+    uint32_t dib_size;          /* 40 = INFO, 108 = V4, 124 = V5 */
+    int32_t width;
+    int32_t height;             /* always positive */
+    int top_down;               /* negative height in the header */
+    uint16_t bpp;               /* 24 or 32 */
+    uint32_t alpha_channel;     /* byte index of alpha within a 32bpp pixel */
+    uint64_t row_stride;        /* bytes per row, padding included */
+    uint64_t pixel_bytes;       /* pixel array bytes actually present in the file */
+
+    ChannelMode channels;
+    uint32_t carrier_stride;    /* 1, or 4 for alpha-only */
+    uint32_t carrier_channel;
+    uint64_t row_carrier;       /* carrier bytes per row */
+    uint64_t carrier_bytes;     /* usable carrier bytes for the channel mode */
+
+    const char *error;          /* why parsing or channel selection failed */
+} BmpInfo;
+
+/*
+ * Parse a BMP header from memory (at least BMP_HEADER_MAX bytes or the
+ * whole file). Nothing is printed; on failure info->error says why.
+ */
+Status bmp_parse(const unsigned char *hdr, size_t len, uint64_t file_size, BmpInfo *info);
+
+/* Read and parse the header, leaving fp at the start of the pixel array (bmp_io.c) */
+Status bmp_read_header(FILE *fp, BmpInfo *info);
+
+/* Largest header (bfOffBits) accepted from a stream that cannot seek */
+#define BMP_STREAM_HEADER_MAX 4096
+
+/*
+ * Read the whole header (data_offset bytes) from a pipe into hdr and parse
+ * it, leaving fp at the start of the pixel array (bmp_io.c)
+ */
+Status bmp_read_stream_header(FILE *fp, BmpInfo *info, unsigned char *hdr, size_t cap);
+
+/* Select the carrier bytes; alpha-only needs a 32bpp image */
+Status bmp_select_channels(BmpInfo *info, ChannelMode mode);
+
+/* Where the original encoder put the "#*" payload: right after a 54-byte header */
+#define BMP_V1_DATA_OFFSET 54
+
+/*
+ * Switch to the layout of v1 ("#*") images: every byte from
+ * BMP_V1_DATA_OFFSET on, in file order, row padding included.
+ */
+void bmp_select_v1_layout(BmpInfo *info);
+
+/* Offset of the pixel holding carrier byte i within the pixel array */
+static inline uint64_t bmp_raw_pos(const BmpInfo *info, uint64_t i)
+{
+    return i / info->row_carrier * info->row_stride + i % info->row_carrier * info->carrier_stride;
+}
+
+/* File offset of the pixel holding carrier byte i */
+static inline uint64_t bmp_pixel_offset(const BmpInfo *info, uint64_t i)
+{
+    return info->data_offset + bmp_raw_pos(info, i);
+}
+
+/* File offset of carrier byte i */
+static inline uint64_t bmp_carrier_offset(const BmpInfo *info, uint64_t i)
+{
+    return bmp_pixel_offset(info, i) + info->carrier_channel;
+}
+
+/* Raw pixel bytes from the pixel of carrier byte i to that of i + n, padding included */
+static inline uint64_t bmp_raw_span(const BmpInfo *info, uint64_t i, uint64_t n)
+{
+    return bmp_raw_pos(info, i + n) - bmp_raw_pos(info, i);
+}
+
+/* Carrier bytes whose raw span fits in len bytes wherever they start */
+static inline uint64_t bmp_carrier_window(const BmpInfo *info, uint64_t len)
+{
+    uint64_t pad = info->row_stride - info->row_carrier * info->carrier_stride;
+
+    /* n bytes cross at most n / row_carrier + 1 row ends */
+    return len > pad ? (len - pad) * info->row_carrier / info->row_stride : 0;
+}
+
+/* Raw pixels are the carrier itself: every byte selected, no row padding */
+static inline int bmp_contiguous(const BmpInfo *info)
+{
+    return info->carrier_stride == 1 && info->row_stride == info->row_carrier;
+}
+
+/* Carrier bytes from i on whose raw span fits in len bytes */
+uint64_t bmp_carrier_fit(const BmpInfo *info, uint64_t i, uint64_t len);
+
+/*
+ * Move n carrier bytes, the first of them carrier byte `first`, between
+ * raw pixel data and a packed buffer, skipping row padding. raw points at
+ * the pixel holding carrier byte first, i.e. at bmp_pixel_offset(info,
+ * first). bmp_gather() may compact in place (out == raw).
+ */
+void bmp_gather(const BmpInfo *info, const unsigned char *raw, uint64_t first, size_t n, unsigned char *out);
+void bmp_scatter(const BmpInfo *info, const unsigned char *in, uint64_t first, size_t n, unsigned char *raw);
+
+#endif
@@ -0,0 +1,379 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/stat.h>
+#include "bmp_index.h"
+#include "common.h"
+#include "crc32c.h"
+#include "parallel.h"
+#include "probe.h"
+#include "stats.h"
+
+/* Pixel bytes read per scan step */
+#define BMP_INDEX_SCAN (1024 * 1024)
+
+/* Largest sidecar accepted: the fixed fields plus a busy map for a 4 GB carrier */
+#define BMP_INDEX_MAX (64 + BMP_HEADER_MAX + 4 * (((uint64_t)1 << 32) / BMP_INDEX_TILE + 1))
+
+/* Pretend extension length the -x capacity figures assume (".txt") */
+#define BMP_INDEX_EXTN_LEN 4
+
+/* State shared by the index workers */
+typedef struct
+{
+    char **files;
+
+    pthread_mutex_t out_lock;   /* guards stdout and the counters below */
+    uint64_t built;
+    uint64_t cached;
+    uint64_t errors;
+} IndexRun;
+
+static double now_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static uint64_t mtime_ns(const struct stat *st)
+{
+    return (uint64_t)st->st_mtim.tv_sec * 1000000000u + (uint64_t)st->st_mtim.tv_nsec;
+}
+
+/* "<fname>.sidx", or with ".tmp" appended too; NULL if out of memory */
+static char *sidecar_name(const char *fname, int tmp)
+{
+    size_t len = strlen(fname) + sizeof(BMP_INDEX_SUFFIX) + (tmp ? 4 : 0);
+    char *name = malloc(len);
+
+    if (name != NULL)
+        snprintf(name, len, "%s%s%s", fname, BMP_INDEX_SUFFIX, tmp ? ".tmp" : "");
+    return name;
+}
+
+static uint32_t tiles_for(const BmpInfo *bmp)
+{
+    return (uint32_t)((bmp->carrier_bytes + BMP_INDEX_TILE - 1) / BMP_INDEX_TILE);
+}
+
+void bmp_index_free(BmpIndex *idx)
+{
+    free(idx->busy);
+    idx->busy = NULL;
+}
+
+/* Count busy carrier bytes per tile; fp is at the pixel array */
+static Status scan_pixels(FILE *fp, BmpIndex *idx)
+{
+    uint32_t px = idx->bmp.bpp / 8;
+    unsigned char *buf = malloc(px + BMP_INDEX_SCAN);
+    uint64_t total = idx->bmp.carrier_bytes;
+
+    if (buf == NULL)
+        return e_failure;
+
+    /* buf[0, px) holds the pixel before the chunk, for the flat check */
+    for (uint64_t i = 0; i < total;)
+    {
+        uint64_t want = bmp_carrier_window(&idx->bmp, BMP_INDEX_SCAN);
+        if (want > total - i)
+            want = total - i;
+        size_t got = fread(buf + px, 1, (size_t)bmp_raw_span(&idx->bmp, i, want), fp);
+        size_t n = (size_t)bmp_carrier_fit(&idx->bmp, i, got);
+
+        if (n == 0)
+            break;
+        bmp_gather(&idx->bmp, buf + px, i, n, buf + px);
+        for (size_t j = 0; j < n; j++)
+        {
+            unsigned char b = buf[px + j];
+            uint64_t g = i + j;
+
+            if (b != 0 && b != 255 && (g < px || b != buf[j]))
+            {
+                idx->busy[g / BMP_INDEX_TILE]++;
+                idx->busy_total++;
+            }
+        }
+        memmove(buf, buf + n, px);
+        i += n;
+    }
+
+    free(buf);
+    return e_success;
+}
+
+Status bmp_index_build(const char *fname, BmpIndex *idx)
+{
+    struct stat st;
+    FILE *fp = fopen(fname, "rb");
+    Status ret = e_failure;
+
+    memset(idx, 0, sizeof(*idx));
+    idx->bmp.error = "unable to open the file";
+    if (fp == NULL)
+        return e_failure;
+
+    if (fstat(fileno(fp), &st) == 0)
+    {
+        idx->mtime_ns = mtime_ns(&st);
+        idx->header_len = (uint32_t)fread(idx->header, 1, sizeof(idx->header), fp);
+
+        if (bmp_parse(idx->header, idx->header_len, (uint64_t)st.st_size, &idx->bmp) == e_success &&
+            fseeko(fp, idx->bmp.data_offset, SEEK_SET) == 0)
+        {
+            idx->tiles = tiles_for(&idx->bmp);
+            idx->busy = calloc(idx->tiles ? idx->tiles : 1, sizeof(*idx->busy));
+            idx->bmp.error = "unable to read the pixel data";
+            if (idx->busy != NULL)
+                ret = scan_pixels(fp, idx);
+        }
+    }
+
+    fclose(fp);
+    if (ret == e_failure)
+        bmp_index_free(idx);
+    return ret;
+}
+
+Status bmp_index_save(const char *fname, const BmpIndex *idx)
+{
+    size_t len = 4 + 4 + 8 + 8 + 4 + idx->header_len + 4 + 4 + 4 * (size_t)idx->tiles + CRC32C_BYTES;
+    unsigned char *out = malloc(len);
+    char *path = sidecar_name(fname, 0);
+    char *tmp = sidecar_name(fname, 1);
+    unsigned char *p = out;
+    Status ret = e_failure;
+
+    if (out != NULL && path != NULL && tmp != NULL)
+    {
+        memcpy(p, BMP_INDEX_MAGIC, 4), p += 4;
+        stego_put_be(p, BMP_INDEX_VERSION, 4), p += 4;
+        stego_put_be(p, idx->bmp.file_size, 8), p += 8;
+        stego_put_be(p, idx->mtime_ns, 8), p += 8;
+        stego_put_be(p, idx->header_len, 4), p += 4;
+        memcpy(p, idx->header, idx->header_len), p += idx->header_len;
+        stego_put_be(p, BMP_INDEX_TILE, 4), p += 4;
+        stego_put_be(p, idx->tiles, 4), p += 4;
+        for (uint32_t t = 0; t < idx->tiles; t++)
+            stego_put_be(p, idx->busy[t], 4), p += 4;
+        stego_put_be(p, crc32c_update(0, out, len - CRC32C_BYTES), CRC32C_BYTES);
+
+        /* Readers see the old sidecar or the new one, never half of one */
+        FILE *fp = fopen(tmp, "wb");
+        if (fp != NULL)
+        {
+            int written = fwrite(out, 1, len, fp) == len;
+            if (fclose(fp) == 0 && written && rename(tmp, path) == 0)
+                ret = e_success;
+            else
+                remove(tmp);
+        }
+    }
+
+    free(out);
+    free(path);
+    free(tmp);
+    return ret;
+}
+
+/* Parse and validate a sidecar against the image's stat */
+static Status parse_sidecar(const unsigned char *in, size_t len, const struct stat *st, BmpIndex *idx)
+{
+    const unsigned char *p = in;
+    const unsigned char *end = in + len - CRC32C_BYTES;
+
+    if (len < 4 + 4 + 8 + 8 + 4 + 4 + 4 + CRC32C_BYTES ||
+        (uint32_t)stego_get_be(end, CRC32C_BYTES) != crc32c_update(0, in, len - CRC32C_BYTES) ||
+        memcmp(p, BMP_INDEX_MAGIC, 4) != 0 || stego_get_be(p + 4, 4) != BMP_INDEX_VERSION)
+        return e_failure;
+    p += 8;
+
+    /* Stale once the image changed size or was touched */
+    uint64_t file_size = stego_get_be(p, 8);
+    idx->mtime_ns = stego_get_be(p + 8, 8);
+    idx->header_len = (uint32_t)stego_get_be(p + 16, 4);
+    p += 20;
+    if (file_size != (uint64_t)st->st_size || idx->mtime_ns != mtime_ns(st) ||
+        idx->header_len > sizeof(idx->header) || (size_t)(end - p) < idx->header_len + 8)
+        return e_failure;
+
+    memcpy(idx->header, p, idx->header_len);
+    p += idx->header_len;
+    if (bmp_parse(idx->header, idx->header_len, file_size, &idx->bmp) == e_failure)
+        return e_failure;
+
+    idx->tiles = (uint32_t)stego_get_be(p + 4, 4);
+    if (stego_get_be(p, 4) != BMP_INDEX_TILE || idx->tiles != tiles_for(&idx->bmp) ||
+        (size_t)(end - p - 8) != 4 * (size_t)idx->tiles)
+        return e_failure;
+    p += 8;
+
+    idx->busy = calloc(idx->tiles ? idx->tiles : 1, sizeof(*idx->busy));
+    if (idx->busy == NULL)
+        return e_failure;
+    for (uint32_t t = 0; t < idx->tiles; t++, p += 4)
+    {
+        idx->busy[t] = (uint32_t)stego_get_be(p, 4);
+        idx->busy_total += idx->busy[t];
+    }
+    return e_success;
+}
+
+/* Load the sidecar of fname, checked against st (the image as opened) */
+static Status load_sidecar(const char *fname, const struct stat *st, BmpIndex *idx)
+{
+    char *path = sidecar_name(fname, 0);
+    FILE *fp = path != NULL ? fopen(path, "rb") : NULL;
+    unsigned char *in = NULL;
+    struct stat sst;
+    Status ret = e_failure;
+
+    memset(idx, 0, sizeof(*idx));
+    if (fp != NULL && fstat(fileno(fp), &sst) == 0 && (uint64_t)sst.st_size <= BMP_INDEX_MAX &&
+        (in = malloc(sst.st_size > 0 ? (size_t)sst.st_size : 1)) != NULL &&
+        fread(in, 1, (size_t)sst.st_size, fp) == (size_t)sst.st_size)
+        ret = parse_sidecar(in, (size_t)sst.st_size, st, idx);
+
+    if (ret == e_failure)
+        bmp_index_free(idx);
+    if (fp != NULL)
+        fclose(fp);
+    free(in);
+    free(path);
+    return ret;
+}
+
+Status bmp_index_load(const char *fname, BmpIndex *idx)
+{
+    struct stat st;
+
+    memset(idx, 0, sizeof(*idx));
+    if (stat(fname, &st) != 0)
+        return e_failure;
+    return load_sidecar(fname, &st, idx);
+}
+
+/* One JSON line per image; the caller holds the output lock */
+static void print_index(const char *fname, Status status, int cached, const BmpIndex *idx)
+{
+    printf("{\"file\":");
+    json_print_string(fname, stdout);
+
+    if (status == e_failure)
+    {
+        printf(",\"error\":");
+        json_print_string(idx->bmp.error != NULL ? idx->bmp.error : "unable to write the index", stdout);
+        printf("}\n");
+        return;
+    }
+
+    const BmpInfo *bmp = &idx->bmp;
+    uint64_t header = stego_header_bytes(STEGO_V2, BMP_INDEX_EXTN_LEN);
+    uint64_t room = bmp->carrier_bytes > header ? bmp->carrier_bytes - header : 0;
+
+    printf(",\"cached\":%s,\"width\":%d,\"height\":%d,\"bpp\":%u,\"carrier_bytes\":%llu,\"tiles\":%u,"
+           "\"busy_bytes\":%llu,\"capacity\":[%llu,%llu,%llu,%llu]}\n",
+           cached ? "true" : "false", bmp->width, bmp->height, bmp->bpp, (unsigned long long)bmp->carrier_bytes,
+           idx->tiles, (unsigned long long)idx->busy_total, (unsigned long long)(room / 8),
+           (unsigned long long)(room * 2 / 8), (unsigned long long)(room * 3 / 8), (unsigned long long)(room * 4 / 8));
+}
+
+/* Reuse a fresh sidecar, else scan the image and write one */
+static Status index_image(const char *fname, BmpIndex *idx, int *cached)
+{
+    *cached = bmp_index_load(fname, idx) == e_success;
+    if (*cached)
+        return e_success;
+
+    if (bmp_index_build(fname, idx) == e_failure)
+        return e_failure;
+    if (bmp_index_save(fname, idx) == e_failure)
+    {
+        bmp_index_free(idx);
+        idx->bmp.error = "unable to write the index";
+        return e_failure;
+    }
+    return e_success;
+}
+
+static Status index_job(void *ctx, int worker, uint64_t index, uint64_t len)
+{
+    IndexRun *run = ctx;
+    const char *fname = run->files[index];
+    BmpIndex idx;
+    int cached;
+
+    (void)worker;
+    (void)len;
+    Status status = index_image(fname, &idx, &cached);
+
+    pthread_mutex_lock(&run->out_lock);
+    if (status == e_failure)
+        run->errors++;
+    else if (cached)
+        run->cached++;
+    else
+        run->built++;
+    print_index(fname, status, cached, &idx);
+    pthread_mutex_unlock(&run->out_lock);
+
+    bmp_index_free(&idx);
+    return e_success;
+}
+
+Status run_index(const char *path, int workers)
+{
+    struct stat st;
+
+    if (stat(path, &st) != 0)
+    {
+        perror("stat");
+        printf("Error! Unable to index %s\n", path);
+        return e_failure;
+    }
+
+    if (!S_ISDIR(st.st_mode))
+    {
+        BmpIndex idx;
+        int cached;
+        Status status = index_image(path, &idx, &cached);
+
+        print_index(path, status, cached, &idx);
+        bmp_index_free(&idx);
+        return status;
+    }
+
+    size_t nfiles = 0;
+    char **files = list_bmp_files(path, &nfiles);
+    if (files == NULL)
+    {
+        printf("Error! Unable to read directory %s\n", path);
+        return e_failure;
+    }
+
+    if (workers < 1)
+        workers = 1;
+    if ((size_t)workers > nfiles)
+        workers = nfiles > 0 ? (int)nfiles : 1;
+
+    IndexRun run = { files, PTHREAD_MUTEX_INITIALIZER, 0, 0, 0 };
+    double start = now_seconds();
+    parallel_for_chunks(workers, nfiles, 1, index_job, &run);
+    double elapsed = now_seconds() - start;
+
+    printf("{\"summary\":{\"files\":%zu,\"built\":%llu,\"cached\":%llu,\"errors\":%llu,\"workers\":%d,"
+           "\"seconds\":%.3f}}\n",
+           nfiles, (unsigned long long)run.built, (unsigned long long)run.cached, (unsigned long long)run.errors,
+           workers, elapsed);
+
+    for (size_t i = 0; i < nfiles; i++)
+        free(files[i]);
+    free(files);
+    pthread_mutex_destroy(&run.out_lock);
+
+    return e_success;
+}
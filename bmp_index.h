@@ -0,0 +1,56 @@
+#ifndef BMP_INDEX_H
+#define BMP_INDEX_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include "types.h"
+#include "bmp.h"
+
+/*
+ * Carrier sidecar index ("<image>.sidx"), built once per cover image by
+ * -x and trusted for as long as the image keeps the size and mtime it was
+ * built from. It stores the raw BMP header, so the geometry is re-parsed
+ * without opening the image, and a per-tile map of busy carrier bytes:
+ * bytes that are neither saturated (0 or 255) nor equal to the same
+ * channel of the previous pixel, the textured areas a content-aware
+ * layout would prefer. Fields are big-endian; a CRC32C of the rest ends
+ * the file.
+ */
+
+#define BMP_INDEX_SUFFIX  ".sidx"
+#define BMP_INDEX_MAGIC   "SIDX"
+#define BMP_INDEX_VERSION 2
+
+/* Carrier bytes (all channels) per tile of the busy map */
+#define BMP_INDEX_TILE (64 * 1024)
+
+typedef struct
+{
+    BmpInfo bmp;                /* all channels selected */
+    uint64_t mtime_ns;          /* image mtime the index was built for */
+    uint32_t header_len;
+    unsigned char header[BMP_HEADER_MAX];
+    uint32_t tiles;
+    uint32_t *busy;             /* per tile: busy carrier bytes */
+    uint64_t busy_total;
+} BmpIndex;
+
+/* Scan the image into idx; free it with bmp_index_free() */
+Status bmp_index_build(const char *fname, BmpIndex *idx);
+
+/* Write idx as the sidecar of fname (through a temporary file and rename) */
+Status bmp_index_save(const char *fname, const BmpIndex *idx);
+
+/* Load the sidecar of fname; fails if it is missing, corrupt or stale */
+Status bmp_index_load(const char *fname, BmpIndex *idx);
+
+void bmp_index_free(BmpIndex *idx);
+
+/*
+ * Index mode (-x): build or refresh the sidecar of an image, or of every
+ * .bmp directly inside a directory on `workers` threads, printing one
+ * JSON line per image (and a summary line for a directory).
+ */
+Status run_index(const char *path, int workers);
+
+#endif
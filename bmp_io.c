@@ -0,0 +1,57 @@
+#include <stdio.h>
+#include <string.h>
+#include <sys/types.h>
+#include "bmp.h"
+
+/* stdio side of the parser; kept out of bmp.c so libstego never touches FILE */
+Status bmp_read_header(FILE *fp, BmpInfo *info)
+{
+    unsigned char hdr[BMP_HEADER_MAX];
+
+    memset(info, 0, sizeof(*info));
+    info->error = "unable to read the BMP header";
+    if (fseeko(fp, 0, SEEK_END) != 0)
+        return e_failure;
+    off_t file_size = ftello(fp);
+    rewind(fp);
+
+    size_t len = fread(hdr, 1, sizeof(hdr), fp);
+    if (bmp_parse(hdr, len, file_size < 0 ? 0 : (uint64_t)file_size, info) == e_failure)
+        return e_failure;
+
+    if (fseeko(fp, info->data_offset, SEEK_SET) != 0)
+    {
+        info->error = "unable to seek to the pixel data";
+        return e_failure;
+    }
+
+    return e_success;
+}
+
+Status bmp_read_stream_header(FILE *fp, BmpInfo *info, unsigned char *hdr, size_t cap)
+{
+    memset(info, 0, sizeof(*info));
+    info->error = "unable to read the BMP header";
+
+    /* The file header says how many bytes precede the pixel array */
+    if (cap < 14 + 40 || fread(hdr, 1, 14, fp) != 14)
+        return e_failure;
+
+    uint32_t data_offset = (uint32_t)hdr[10] | ((uint32_t)hdr[11] << 8) |
+                           ((uint32_t)hdr[12] << 16) | ((uint32_t)hdr[13] << 24);
+    if (data_offset < 14 + 40 || data_offset > cap)
+    {
+        info->error = "BMP header too large to stream";
+        return e_failure;
+    }
+
+    if (fread(hdr + 14, 1, data_offset - 14, fp) != data_offset - 14)
+        return e_failure;
+
+    /* The stream length is unknown: trust the header for the pixel span */
+    if (bmp_parse(hdr, data_offset, UINT64_MAX, info) == e_failure)
+        return e_failure;
+
+    info->file_size = info->data_offset + info->pixel_bytes;
+    return e_success;
+}
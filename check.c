@@ -0,0 +1,415 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "stego.h"
+#include "types.h"
+#include "lsb_kernel.h"
+#include "crc32c.h"
+#include "common.h"
+#include "serve.h"
+
+/*
+ * make check, part one: the kernels and the library, called directly (the
+ * SIMD kernels against the scalar ones, the depth kernels, CRC32C, and
+ * in-memory round trips over the option combinations under every kernel
+ * variant, whose stego images must match the scalar ones byte for byte).
+ * check.sh drives a.out end to end. Prints a line per failure; exit
+ * status 1 if any.
+ *
+ *   ./check_bin                            run the checks
+ *   ./check_bin bmp <file> <w> <h> <bpp>   write a noise carrier for check.sh
+ *   ./check_bin serve <socket> <req>...    send requests to --serve, print the replies
+ */
+
+/* Variants compared against "scalar"; missing ones are skipped */
+static const char *const check_kernels[] = { "scalar", "sse2", "avx2" };
+#define CHECK_KERNELS (sizeof(check_kernels) / sizeof(check_kernels[0]))
+
+static int failures;
+
+#define CHECK(cond, ...) \
+    do { if (!(cond)) { printf("FAIL: " __VA_ARGS__); printf("\n"); failures++; } } while (0)
+
+static void fill_random(unsigned char *buf, uint64_t n, uint64_t seed)
+{
+    uint64_t x = 0x9E3779B97F4A7C15ULL ^ seed;
+    for (uint64_t i = 0; i < n; i++)
+    {
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        buf[i] = (unsigned char)x;
+    }
+}
+
+static void put_le32(unsigned char *p, uint32_t v)
+{
+    for (int i = 0; i < 4; i++, v >>= 8)
+        p[i] = (unsigned char)v;
+}
+
+/*
+ * In-memory BMP of noise pixels; rows are padded to 4 bytes. Pixel values
+ * stay in a narrow band, like neighbouring pixels of a photo.
+ */
+static unsigned char *make_bmp(uint32_t width, uint32_t height, int bpp, size_t *len)
+{
+    size_t stride = ((size_t)width * (bpp / 8) + 3) & ~(size_t)3;
+    size_t pixels = stride * height;
+    unsigned char *img = calloc(1, 54 + pixels);
+
+    if (img == NULL)
+        return NULL;
+    img[0] = 'B';
+    img[1] = 'M';
+    put_le32(img + 2, (uint32_t)(54 + pixels));
+    put_le32(img + 10, 54);
+    put_le32(img + 14, 40);
+    put_le32(img + 18, width);
+    put_le32(img + 22, height);
+    img[26] = 1;
+    img[28] = (unsigned char)bpp;
+    put_le32(img + 34, (uint32_t)pixels);
+
+    fill_random(img + 54, pixels, width * 31 + height);
+    for (size_t i = 0; i < pixels; i++)
+        img[54 + i] = (unsigned char)(96 + img[54 + i] % 64);
+    *len = 54 + pixels;
+    return img;
+}
+
+/* Each variant's embed/extract/RS output against the scalar kernels */
+static void check_kernel(const char *name)
+{
+    enum { MAX_N = 4099, MAX_RS = 5000 };
+    static unsigned char data[MAX_N], carrier[8 * MAX_N + 8], want[8 * MAX_N + 8], got[8 * MAX_N + 8];
+    static unsigned char out_want[MAX_N], out_got[MAX_N], mask[MAX_RS];
+    const size_t sizes[] = { 0, 1, 2, 3, 7, 8, 15, 16, 17, 31, 32, 33, 63, 64, 65, 255, 1000, MAX_N };
+
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++)
+    {
+        size_t n = sizes[s];
+
+        /* Unaligned carriers too: the kernels load and store unaligned */
+        for (size_t off = 0; off < 8; off += 3)
+        {
+            fill_random(data, n, n);
+            fill_random(carrier, sizeof(carrier), n + off);
+            memcpy(want, carrier, sizeof(carrier));
+            memcpy(got, carrier, sizeof(carrier));
+
+            lsb_embed_scalar(data, n, want + off);
+            lsb_embed_block(data, n, got + off);
+            CHECK(memcmp(want, got, sizeof(got)) == 0, "%s embed, %zu bytes at +%zu", name, n, off);
+
+            lsb_extract_scalar(carrier + off, n, out_want);
+            lsb_extract_block(carrier + off, n, out_got);
+            CHECK(memcmp(out_want, out_got, n) == 0, "%s extract, %zu bytes at +%zu", name, n, off);
+        }
+    }
+
+    /* Every channel layout scan.c uses: 1 to 4 byte pixels, sparse and dense masks */
+    for (size_t stride = 1; stride <= 4; stride++)
+    {
+        for (size_t n = 0; n + 3 * stride <= MAX_RS; n = n * 3 + 1)
+        {
+            uint64_t want_rs[8] = {0}, got_rs[8] = {0};
+
+            fill_random(carrier, n + 3 * stride, n + stride);
+            fill_random(mask, n, n);
+            for (size_t i = 0; i < n; i++)
+                mask[i] = mask[i] % (stride + 1) == 0 ? 0xFF : 0;
+
+            lsb_rs_scalar(carrier, mask, n, stride, want_rs);
+            lsb_rs_count(carrier, mask, n, stride, got_rs);
+            CHECK(memcmp(want_rs, got_rs, sizeof(got_rs)) == 0, "%s RS counts, %zu bytes stride %zu",
+                  name, n, stride);
+        }
+    }
+}
+
+/* The depth kernels round-trip and leave the bits above depth alone */
+static void check_depth(void)
+{
+    enum { N = 1001 };
+    static unsigned char data[N], out[N], carrier[8 * N], orig[8 * N];
+
+    for (int depth = 1; depth <= 4; depth++)
+    {
+        for (size_t n = 0; n <= N; n += n < 16 ? 1 : 197)
+        {
+            size_t used = (size_t)lsb_carrier_bytes(n, depth);
+            unsigned char keep = (unsigned char)~((1u << depth) - 1);
+            int kept = 1;
+
+            fill_random(data, n, n);
+            fill_random(orig, used, depth);
+            memcpy(carrier, orig, used);
+            lsb_embed_depth(data, n, carrier, depth);
+            lsb_extract_depth(carrier, n, out, depth);
+            for (size_t i = 0; i < used; i++)
+                kept &= (carrier[i] & keep) == (orig[i] & keep);
+            CHECK(memcmp(data, out, n) == 0 && kept, "depth %d round trip, %zu bytes", depth, n);
+        }
+    }
+}
+
+static void check_crc(void)
+{
+    const unsigned char vec[] = "123456789";
+
+    CHECK(crc32c_update(0, vec, 9) == 0xE3069283u, "%s CRC32C check value", crc32c_name());
+    CHECK(crc32c_combine(crc32c_update(0, vec, 4), crc32c_update(0, vec + 4, 5), 5) == 0xE3069283u,
+          "CRC32C combine");
+}
+
+/* Row padding is not carrier: the stego image keeps the carrier's */
+static int padding_kept(const unsigned char *img, const unsigned char *stego)
+{
+    uint32_t width = img[18] | img[19] << 8 | (uint32_t)img[20] << 16 | (uint32_t)img[21] << 24;
+    uint32_t height = img[22] | img[23] << 8 | (uint32_t)img[24] << 16 | (uint32_t)img[25] << 24;
+    size_t used = (size_t)width * (img[28] / 8);
+    size_t stride = (used + 3) & ~(size_t)3;
+
+    for (size_t r = 0; r < height; r++)
+        if (memcmp(img + 54 + r * stride + used, stego + 54 + r * stride + used, stride - used) != 0)
+            return 0;
+    return 1;
+}
+
+/* Secret of n bytes: compressible text, then noise */
+static void make_secret(unsigned char *buf, size_t n)
+{
+    static const char text[] = "the quick brown fox jumps over the lazy dog; ";
+
+    for (size_t i = 0; i < n / 2; i++)
+        buf[i] = (unsigned char)text[i % (sizeof(text) - 1)];
+    fill_random(buf + n / 2, n - n / 2, n);
+}
+
+/*
+ * One option set on one carrier: encode, read the header back, decode the
+ * whole secret and a range. want holds the scalar variant's stego image;
+ * the other variants must produce the same bytes.
+ */
+static void check_round_trip(const char *kernel, const char *what, const unsigned char *img, size_t len,
+                             const StegoOptions *opts, unsigned char *want)
+{
+    uint64_t cap;
+    StegoHeader hdr;
+    unsigned char *stego = malloc(len);
+    unsigned char *secret = NULL, *out = NULL;
+
+    if (stego == NULL || stego_capacity(img, len, opts, &cap) == e_failure || cap < 16)
+    {
+        CHECK(0, "%s %s: no capacity", kernel, what);
+        free(stego);
+        return;
+    }
+
+    size_t n = (size_t)(cap / 2);
+    secret = malloc(n);
+    out = malloc(n);
+    if (secret == NULL || out == NULL)
+    {
+        CHECK(0, "%s %s: out of memory", kernel, what);
+        goto done;
+    }
+    make_secret(secret, n);
+
+    if (stego_encode(img, len, secret, n, opts, stego, len) == e_failure)
+    {
+        CHECK(0, "%s %s: encode", kernel, what);
+        goto done;
+    }
+    CHECK(padding_kept(img, stego), "%s %s: row padding changed", kernel, what);
+    if (strcmp(kernel, "scalar") == 0)
+        memcpy(want, stego, len);
+    else
+        CHECK(memcmp(want, stego, len) == 0, "%s %s: stego image differs from scalar", kernel, what);
+
+    if (stego_read_header(stego, len, &hdr) == e_failure)
+    {
+        CHECK(0, "%s %s: header", kernel, what);
+        goto done;
+    }
+    hdr.key = opts->key;
+    CHECK(hdr.depth == (opts->depth ? opts->depth : 1) && hdr.channels == opts->channels &&
+          hdr.secret_size == n, "%s %s: header fields", kernel, what);
+    CHECK(stego_decode(stego, len, &hdr, out, n) == e_success && memcmp(out, secret, n) == 0,
+          "%s %s: decode", kernel, what);
+    CHECK(stego_decode_range(stego, len, &hdr, n / 3, n / 3, out) == e_success &&
+          memcmp(out, secret + n / 3, n / 3) == 0, "%s %s: decode range", kernel, what);
+
+done:
+    free(stego);
+    free(secret);
+    free(out);
+}
+
+/* Option combinations over a padded 24bpp and a 32bpp carrier */
+static void check_options(const char *kernel, unsigned char **want)
+{
+    struct { uint32_t width, height; int bpp; } carriers[] = { { 101, 37, 24 }, { 64, 48, 32 } };
+    size_t slot = 0;
+
+    for (size_t c = 0; c < sizeof(carriers) / sizeof(carriers[0]); c++)
+    {
+        size_t len;
+        unsigned char *img = make_bmp(carriers[c].width, carriers[c].height, carriers[c].bpp, &len);
+
+        if (img == NULL)
+        {
+            CHECK(0, "out of memory");
+            return;
+        }
+        for (int mode = 0; mode < 16; mode++)
+        {
+            for (int depth = 1; depth <= 4; depth++, slot++)
+            {
+                StegoOptions opts = {0};
+                char what[96];
+
+                opts.depth = depth;
+                opts.extension = ".bin";
+                opts.compress = mode & 1;
+                opts.checksum = (mode >> 1) & 1;
+                opts.key = mode & 4 ? "check key" : NULL;
+                opts.channels = mode & 8 ? e_channels_alpha : e_channels_all;
+                if (opts.channels == e_channels_alpha && carriers[c].bpp != 32)
+                    continue;
+                snprintf(what, sizeof(what), "%ubpp depth %d%s%s%s%s", (unsigned)carriers[c].bpp, depth,
+                         opts.compress ? " compress" : "", opts.checksum ? " checksum" : "",
+                         opts.key ? " key" : "", mode & 8 ? " alpha" : "");
+
+                if (want[slot] == NULL && (want[slot] = malloc(len)) == NULL)
+                    CHECK(0, "out of memory");
+                else
+                    check_round_trip(kernel, what, img, len, &opts, want[slot]);
+            }
+        }
+        free(img);
+    }
+}
+
+/* The noise carrier make_bmp builds, as a file */
+static int write_bmp(const char *fname, const char *w, const char *h, const char *bpp)
+{
+    size_t len;
+    int depth = atoi(bpp);
+    unsigned char *img = depth == 24 || depth == 32 ? make_bmp(atoi(w), atoi(h), depth, &len) : NULL;
+    FILE *fp = img != NULL ? fopen(fname, "wb") : NULL;
+    int ok = fp != NULL && fwrite(img, 1, len, fp) == len;
+
+    if (fp != NULL && fclose(fp) != 0)
+        ok = 0;
+    free(img);
+    return ok ? 0 : 1;
+}
+
+static int read_full(int fd, unsigned char *buf, size_t len)
+{
+    while (len > 0)
+    {
+        ssize_t got = read(fd, buf, len);
+        if (got <= 0)
+            return 0;
+        buf += got;
+        len -= (size_t)got;
+    }
+    return 1;
+}
+
+/* A --serve client: every request back to back, then one reply per line as it arrives */
+static int serve_client(const char *path, int count, char **requests)
+{
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    unsigned char buf[4 + SERVE_MAX_REQUEST];
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+    if (fd < 0 || strlen(path) >= sizeof(addr.sun_path))
+        return 1;
+    strcpy(addr.sun_path, path);
+
+    /* The server may still be starting: give it five seconds */
+    for (int tries = 0; connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0; tries++)
+    {
+        if (tries == 50)
+        {
+            close(fd);
+            return 1;
+        }
+        usleep(100000);
+    }
+
+    for (int i = 0; i < count; i++)
+    {
+        size_t n = strlen(requests[i]);
+
+        if (n == 0 || n > SERVE_MAX_REQUEST)
+        {
+            close(fd);
+            return 1;
+        }
+        stego_put_be(buf, n, 4);
+        memcpy(buf + 4, requests[i], n);
+        if (write(fd, buf, 4 + n) != (ssize_t)(4 + n))
+            break;
+    }
+
+    int replies = 0;
+    while (replies < count && read_full(fd, buf, 4))
+    {
+        size_t n = (size_t)stego_get_be(buf, 4);
+        if (n > SERVE_MAX_REQUEST || !read_full(fd, buf, n))
+            break;
+        printf("%.*s\n", (int)n, (const char *)buf);
+        replies++;
+    }
+    close(fd);
+    return replies == count ? 0 : 1;
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned char *want[2 * 16 * 4] = {0};
+    int ran = 0;
+
+    if (argc == 6 && strcmp(argv[1], "bmp") == 0)
+        return write_bmp(argv[2], argv[3], argv[4], argv[5]);
+    if (argc >= 3 && strcmp(argv[1], "serve") == 0)
+        return serve_client(argv[2], argc - 3, argv + 3);
+    if (argc != 1)
+    {
+        fprintf(stderr, "Usage: %s [bmp <file> <width> <height> <24|32> | serve <socket> <request>...]\n",
+                argv[0]);
+        return 1;
+    }
+
+    /* The library's own selection runs once: get it done before switching variants */
+    lsb_kernel_init();
+    check_crc();
+    check_depth();
+
+    for (size_t k = 0; k < CHECK_KERNELS; k++)
+    {
+        if (!lsb_kernel_select(check_kernels[k]))
+        {
+            printf("kernel %s: not available, skipped\n", check_kernels[k]);
+            continue;
+        }
+        if (k > 0)
+            check_kernel(check_kernels[k]);
+        check_options(check_kernels[k], want);
+        printf("kernel %s: checked\n", check_kernels[k]);
+        ran++;
+    }
+
+    for (size_t i = 0; i < sizeof(want) / sizeof(want[0]); i++)
+        free(want[i]);
+    printf("%s: %d kernel variants, %d failures\n", failures ? "FAILED" : "passed", ran, failures);
+    return failures != 0;
+}
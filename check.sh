@@ -0,0 +1,240 @@
+#!/bin/sh
+# make check, part two: round trips through a.out over the encoder and
+# decoder paths, and the exit statuses of failed runs. Carriers come from
+# check_bin: a padded 24bpp image, an unpadded one and a 32bpp one.
+#
+#   ./check.sh [a.out] [check_bin]
+
+A=${1:-./a.out}
+C=${2:-./check_bin}
+case $A in /*) ;; *) A=$PWD/$A ;; esac
+case $C in /*) ;; *) C=$PWD/$C ;; esac
+F=$(cd "$(dirname "$0")" && pwd)/fixtures
+
+DIR=$(mktemp -d "${TMPDIR:-/tmp}/stego-check-XXXXXX") || exit 1
+trap 'rm -rf "$DIR"' EXIT
+cd "$DIR" || exit 1
+
+runs=0
+failures=0
+
+fail()
+{
+    echo "FAIL: $*"
+    failures=$((failures + 1))
+}
+
+# Encode $1 with secret $2, decode with the same key, compare; rest: options
+round_trip()
+{
+    img=$1 secret=$2
+    shift 2
+    key=$(echo "$*" | sed -n 's/.*\(--key [^ ]*\).*/\1/p')
+    runs=$((runs + 1))
+    rm -f s.bmp out
+    if ! "$A" -e "$img" "$secret" s.bmp --quiet "$@" > log; then
+        fail "encode $img $secret $*"; cat log
+    elif ! "$A" -d s.bmp out --quiet $key > log || ! cmp -s out "$secret"; then
+        fail "decode $img $secret $*"; cat log
+    elif ! "$A" -d s.bmp out --quiet --block-size 64K $key > log || ! cmp -s out "$secret"; then
+        fail "64K-block decode $img $secret $*"; cat log
+    elif ! "$A" -d s.bmp out --quiet -j 4 --block-size 64K $key > log || ! cmp -s out "$secret"; then
+        fail "parallel decode $img $secret $*"; cat log
+    fi
+}
+
+"$C" bmp pad24.bmp 333 400 24 && "$C" bmp c24.bmp 512 300 24 && "$C" bmp c32.bmp 512 400 32 || {
+    echo "FAIL: cannot write the carriers"
+    exit 1
+}
+head -c 20000 /dev/urandom > noise.bin
+yes "the quick brown fox jumps over the lazy dog" | head -c 40000 > text.txt
+: > empty.bin
+
+for img in pad24.bmp c24.bmp; do
+    for depth in 1 2 3 4; do
+        for opts in "" "--compress" "--checksum" "--key k1" "--compress --checksum --key k1"; do
+            for path in "" "--mmap" "-j 4" "--aio threads" "--aio off"; do
+                round_trip $img noise.bin --depth $depth $opts $path
+            done
+            round_trip $img text.txt --depth $depth $opts
+        done
+    done
+    round_trip $img empty.bin
+    round_trip $img noise.bin --legacy
+done
+for depth in 1 2 3 4; do
+    for path in "" "--mmap" "-j 4"; do
+        round_trip c32.bmp noise.bin --alpha --depth $depth $path
+    done
+    round_trip c32.bmp noise.bin --alpha --depth $depth --checksum --key k2
+done
+
+# Past PARALLEL_MIN_PAYLOAD, so -j really splits the payload across workers
+"$C" bmp big24.bmp 1843 1800 24 || fail "cannot write big24.bmp"
+head -c 1100000 /dev/urandom > big.bin
+round_trip big24.bmp big.bin -j 4
+round_trip big24.bmp big.bin -j 4 --checksum
+round_trip big24.bmp big.bin -j 4 --key k3
+
+# Many AIO_WINDOWs through the overlapped encoder, on an unpadded carrier
+"$C" bmp wide24.bmp 2048 1200 24 || fail "cannot write wide24.bmp"
+for aio in "" "--aio threads"; do
+    round_trip wide24.bmp big.bin --depth 2 -j 1 $aio
+done
+
+# Text larger than the carrier's raw capacity fits once compressed
+yes "the quick brown fox jumps over the lazy dog" | head -c 3000000 > big.txt
+round_trip big24.bmp big.txt --compress
+echo "round trips: $runs"
+
+# Pipes: image and secret through stdin/stdout
+"$A" -e - noise.bin - --depth 2 < pad24.bmp > p.bmp && "$A" -d - - < p.bmp > out && cmp -s out noise.bin ||
+    fail "pipe round trip"
+"$A" -e pad24.bmp /dev/fd/3 p.bmp --secret-size 40000 --ext .txt --quiet 3< text.txt > log &&
+    "$A" -d p.bmp out --quiet > log && cmp -s out text.txt || fail "piped secret"
+
+# Ranges, and a range past the end of the secret
+"$A" -e c24.bmp noise.bin s.bmp --quiet > log
+head -c 6234 noise.bin | tail -c 5000 > want
+"$A" -d s.bmp out --range 1234:5000 --quiet > log && cmp -s out want || fail "range decode"
+"$A" -d s.bmp out --range 1234:5000 --quiet -j 4 --block-size 64K > log && cmp -s out want ||
+    fail "range decode through 64K blocks"
+"$A" -d s.bmp out --range 20001:1 --quiet > log && fail "range past the end exits 0"
+
+# In-place re-encoding
+cp s.bmp inplace.bmp
+"$A" -e inplace.bmp text.txt --in-place --quiet > log && "$A" -d inplace.bmp out --quiet > log &&
+    cmp -s out text.txt || fail "in-place re-encode"
+
+# Archives: the whole set into a directory, and one member
+"$A" -a c24.bmp a.bmp noise.bin text.txt empty.bin --checksum --depth 3 --quiet > log || fail "archive encode"
+rm -rf adir
+"$A" -d a.bmp adir --quiet > log && cmp -s adir/noise.bin noise.bin && cmp -s adir/text.txt text.txt &&
+    cmp -s adir/empty.bin empty.bin || fail "archive decode"
+"$A" -d a.bmp out --file text.txt --quiet > log && cmp -s out text.txt || fail "archive member"
+mkdir old && echo keep > old/keep.txt
+"$A" -d a.bmp old --quiet > log && cmp -s old/text.txt text.txt && [ "$(cat old/keep.txt)" = keep ] ||
+    fail "archive decode into an existing directory"
+
+# A flipped carrier bit fails the checksum: status 3, no output left behind
+"$A" -e c24.bmp noise.bin s.bmp --checksum --quiet > log
+cp s.bmp bad.bmp
+byte=$(od -An -tu1 -j 20000 -N 1 s.bmp)
+printf "\\$(printf %o $((byte ^ 1)))" | dd of=bad.bmp bs=1 seek=20000 conv=notrunc 2>/dev/null
+rm -f out
+"$A" -d bad.bmp out --quiet > log
+status=$?
+[ $status -eq 3 ] || fail "checksum mismatch exit status $status"
+[ -e out ] && fail "corrupt output kept"
+cp a.bmp bad.bmp
+byte=$(od -An -tu1 -j 20000 -N 1 a.bmp)
+printf "\\$(printf %o $((byte ^ 1)))" | dd of=bad.bmp bs=1 seek=20000 conv=notrunc 2>/dev/null
+rm -rf bad.d
+"$A" -d bad.bmp bad.d --quiet > log
+status=$?
+[ $status -eq 3 ] || fail "archive checksum mismatch exit status $status"
+[ -e bad.d ] && fail "corrupt archive members kept"
+"$A" -d bad.bmp old --quiet > log
+[ "$(ls old)" = "$(printf 'empty.bin\nkeep.txt\nnoise.bin\ntext.txt')" ] && cmp -s old/text.txt text.txt ||
+    fail "corrupt archive extracted into an existing directory"
+ls -d *.part* > /dev/null 2>&1 && fail "temporary archive directory left behind"
+
+# Serve: requests from one connection, back to back, then a clean stop
+"$A" --serve serve.sock -j 2 > serve.log &
+server=$!
+"$C" serve serve.sock "e c24.bmp noise.bin v1.bmp" "i c24.bmp" "x bogus" > log
+"$C" serve serve.sock "d v1.bmp v1.out" "stats" >> log
+kill $server && wait $server || fail "serve stop"
+[ "$(grep -c '"status":"ok"' log)" -eq 3 ] && grep -q '"status":"failed"' log && grep -q '"op":"stats"' log &&
+    cmp -s v1.out noise.bin && [ ! -e serve.sock ] || { fail "serve"; cat serve.log log; }
+
+# A full serve queue answers "busy" at once instead of growing: one worker, a slow encode, then a burst
+"$A" --serve serve.sock -j 1 > serve.log &
+server=$!
+set -- "e big24.bmp big.bin sb.bmp"
+for i in $(seq 100); do set -- "$@" "i c24.bmp"; done
+"$C" serve serve.sock "$@" > log
+kill $server && wait $server || fail "serve stop after a burst"
+[ "$(wc -l < log)" -eq 101 ] && grep -q '"status":"busy"' log && grep -q '"op":"encode",.*"status":"ok"' log ||
+    { fail "serve queue limit"; cat serve.log log; }
+
+# --stats: one JSON line on stderr; --quiet: nothing on stdout
+"$A" -e c24.bmp noise.bin s.bmp --stats --quiet > log 2> stats && [ ! -s log ] &&
+    grep -q '^{"op":"encode","status":"ok",.*"stages":\[' stats || { fail "encode --stats"; cat log stats; }
+"$A" -d s.bmp out --stats --quiet > log 2> stats && [ ! -s log ] &&
+    grep -q '^{"op":"decode","status":"ok",' stats || { fail "decode --stats"; cat log stats; }
+
+# v1 images from the original encoder: fixtures/v1-pad24.bmp holds
+# v1-pad24.txt in check_bin's 333x48 noise carrier, whose rows are padded.
+# It must decode, and --legacy must reproduce it byte for byte.
+"$C" bmp v1pad.bmp 333 48 24 || fail "cannot write v1pad.bmp"
+for path in "" "-j 4 --block-size 64K"; do
+    "$A" -d "$F/v1-pad24.bmp" out --quiet $path > log && cmp -s out "$F/v1-pad24.txt" ||
+        { fail "decode the v1 fixture $path"; cat log; }
+done
+"$A" -d - - < "$F/v1-pad24.bmp" > out 2> log && cmp -s out "$F/v1-pad24.txt" || fail "decode the piped v1 fixture"
+for path in "" "--mmap" "-j 4" "--aio threads" "--aio off"; do
+    "$A" -e v1pad.bmp "$F/v1-pad24.txt" v1.bmp --legacy --quiet $path > log && cmp -s v1.bmp "$F/v1-pad24.bmp" ||
+        { fail "--legacy $path differs from the original encoder"; cat log; }
+done
+
+# A secret that does not fit: non-zero status, no new output image, an existing one untouched
+for path in "" --mmap; do
+    rm -f big.bmp
+    "$A" -e pad24.bmp pad24.bmp big.bmp $path --quiet > log && fail "oversized secret exits 0 $path"
+    [ -e big.bmp ] && fail "oversized secret left an output image $path"
+    cp c24.bmp old.bmp
+    "$A" -e pad24.bmp pad24.bmp old.bmp $path --quiet > log
+    cmp -s old.bmp c24.bmp || fail "oversized secret overwrote an existing image $path"
+done
+
+# Index sidecar: reused while the image is unchanged; its depth-1 capacity is exact
+cp c24.bmp x24.bmp
+"$A" -x x24.bmp > log && [ -s x24.bmp.sidx ] && grep -q '"cached":false' log || fail "index build"
+"$A" -x x24.bmp | grep -q '"cached":true' || fail "index reuse"
+cap=$(sed -n 's/.*"capacity":\[\([0-9]*\),.*/\1/p' log)
+head -c "$cap" /dev/urandom > fits.bin
+head -c $((cap + 1)) /dev/urandom > over.bin
+round_trip x24.bmp fits.bin
+"$A" -e x24.bmp over.bin s.bmp --quiet > log && fail "index capacity plus one byte encoded"
+touch -d @0 x24.bmp
+"$A" -x x24.bmp | grep -q '"cached":false' || fail "stale index reused"
+
+# Batch jobs: one JSON line each
+printf 'e c24.bmp noise.bin b1.bmp\nd b1.bmp b1.out\ni b1.bmp\n' > jobs
+"$A" -b jobs > log && [ "$(grep -c '"status":"ok"' log)" -eq 3 ] && cmp -s b1.out noise.bin ||
+    { fail "batch"; cat log; }
+printf 'e c24.bmp noise.bin b2.bmp b3.bmp\ni b1.bmp # a comment\n' > jobs
+"$A" -b jobs > log
+grep -q '"line":1,"op":"invalid",' log && grep -q '"line":2,"op":"inspect",.*"status":"ok"' log &&
+    [ ! -e b2.bmp ] || { fail "batch line with an extra field"; cat log; }
+"$A" -b . > log && fail "unreadable manifest exits 0"
+
+# One batch worker reuses its overlapped queue and windows across encodes
+printf 'e wide24.bmp big.bin b4.bmp\ne wide24.bmp noise.bin b5.bmp\ne wide24.bmp big.bin b6.bmp\n' > jobs
+printf 'd b4.bmp b4.out\nd b5.bmp b5.out\nd b6.bmp b6.out\n' >> jobs
+for aio in "" "--aio threads"; do
+    "$A" -b jobs --depth 2 -j 1 $aio > log && [ "$(grep -c '"status":"ok"' log)" -eq 6 ] &&
+        cmp -s b4.out big.bin && cmp -s b5.out noise.bin && cmp -s b6.out big.bin ||
+        { fail "batch overlapped encodes $aio"; cat log; }
+    rm -f b4.out b5.out b6.out
+done
+
+# Inspect: the header fields of a stego image; a plain carrier is no stego
+"$A" -e c24.bmp noise.bin s.bmp --depth 2 --quiet > log
+"$A" -i s.bmp | grep -q '"stego":true,.*"depth":2,.*"extension":".bin",.*"payload_bytes":20000,' ||
+    fail "inspect"
+"$A" -i c24.bmp | grep -q '"stego":false' || fail "inspect a plain carrier"
+
+# Scan: a stego image is tagged, a plain carrier is not, over a directory too
+"$A" -s s.bmp | grep -q '"tagged":true' || fail "scan"
+"$A" -s c24.bmp | grep -q '"tagged":false' || fail "scan a plain carrier"
+mkdir scan && cp s.bmp c24.bmp scan/
+"$A" -s scan -j 2 | grep -q '"summary":{"files":2,.*"tagged":1,"errors":0,' || fail "scan a directory"
+
+if [ $failures -ne 0 ]; then
+    echo "FAILED: $failures failures"
+    exit 1
+fi
+echo "passed"
@@ -1,7 +1,71 @@
 #ifndef COMMON_H
 #define COMMON_H
 
-/* Magic string to identify whether stegged or not */
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/* Magic string to identify whether stegged or not (v1: 32-bit sizes) */
 #define MAGIC_STRING "#*"
 
-#endif
\ No newline at end of file
+/* Magic string of the v2 header: 32-bit flags and a 64-bit secret size */
+#define MAGIC_STRING_V2 "#@"
+
+/* Header versions */
+#define STEGO_V1 1
+#define STEGO_V2 2
+
+/* v2 header flags; a decoder rejects any bit it does not know */
+#define STEGO_FLAG_DEPTH_MASK   0x3u    /* payload bits per carrier byte, minus one */
+#define STEGO_FLAG_LZ           0x4u    /* secret stored as LZ frames (lz.h); size stays the raw size */
+#define STEGO_FLAG_ARCHIVE      0x8u    /* secret is a TOC plus member files (archive.h) */
+#define STEGO_FLAG_CRC          0x10u   /* CRC32C of the secret follows the data (crc32c.h) */
+#define STEGO_FLAG_SCATTER      0x20u   /* data groups placed by a key (scatter.h) */
+#define STEGO_FLAGS_KNOWN       (STEGO_FLAG_DEPTH_MASK | STEGO_FLAG_LZ | STEGO_FLAG_ARCHIVE | STEGO_FLAG_CRC | \
+                                 STEGO_FLAG_SCATTER)
+
+/* Exit status of a decode whose secret failed its checksum */
+#define STEGO_EXIT_CHECKSUM 3
+
+/* Progress chatter, suppressed for quiet jobs (errors are always printed) */
+#define PROGRESS(quiet, ...) do { if (!(quiet)) printf(__VA_ARGS__); } while (0)
+
+/*
+ * Header layout, one bit per carrier byte:
+ *   v1: magic | extn size (32) | extn | secret size (32)
+ *   v2: magic | flags (32) | extn size (32) | extn | secret size (64)
+ * The secret data that follows uses the flags' depth (v1: always 1 bit).
+ * With STEGO_FLAG_CRC the data is followed, in the same depth stream, by
+ * the CRC32C of the (uncompressed) secret: 4 more payload bytes.
+ * With STEGO_FLAG_SCATTER the data's depth groups are spread over the
+ * rest of the carrier by a key instead of following the header.
+ */
+static inline uint64_t stego_header_bytes(int version, size_t extn_len)
+{
+    uint64_t bits = 8 * 2 + 32 + 8 * (uint64_t)extn_len;
+
+    return version == STEGO_V1 ? bits + 32 : bits + 32 + 64;
+}
+
+/* Header integers are stored MSB first */
+static inline void stego_put_be(unsigned char *out, uint64_t value, int bytes)
+{
+    for (int i = bytes - 1; i >= 0; i--, value >>= 8)
+        out[i] = (unsigned char)value;
+}
+
+static inline uint64_t stego_get_be(const unsigned char *in, int bytes)
+{
+    uint64_t value = 0;
+    for (int i = 0; i < bytes; i++)
+        value = (value << 8) | in[i];
+    return value;
+}
+
+/* Split a payload into chunks that start on a depth group boundary */
+static inline uint64_t stego_chunk_size(uint64_t chunk, int depth)
+{
+    return chunk / depth * depth;
+}
+
+#endif
@@ -0,0 +1,130 @@
+#include <string.h>
+#include "crc32c.h"
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#define CRC32C_X86 1
+#endif
+
+/* Reflected Castagnoli polynomial */
+#define CRC32C_POLY 0x82F63B78u
+
+static uint32_t crc32c_bitwise(uint32_t crc, const unsigned char *buf, size_t n);
+
+crc32c_fn crc32c_update = crc32c_bitwise;
+
+static const char *kernel_name = "bitwise";
+static uint32_t table[8][256];
+
+/* One bit at a time; only used before crc32c_init() */
+static uint32_t crc32c_bitwise(uint32_t crc, const unsigned char *buf, size_t n)
+{
+    crc = ~crc;
+    while (n--)
+    {
+        crc ^= *buf++;
+        for (int k = 0; k < 8; k++)
+            crc = crc & 1 ? (crc >> 1) ^ CRC32C_POLY : crc >> 1;
+    }
+    return ~crc;
+}
+
+/* Eight bytes per step through the slicing tables */
+static uint32_t crc32c_slice8(uint32_t crc, const unsigned char *buf, size_t n)
+{
+    crc = ~crc;
+    while (n >= 8)
+    {
+        uint32_t lo = crc ^ ((uint32_t)buf[0] | (uint32_t)buf[1] << 8 | (uint32_t)buf[2] << 16 |
+                             (uint32_t)buf[3] << 24);
+
+        crc = table[7][lo & 0xff] ^ table[6][(lo >> 8) & 0xff] ^ table[5][(lo >> 16) & 0xff] ^
+              table[4][lo >> 24] ^ table[3][buf[4]] ^ table[2][buf[5]] ^ table[1][buf[6]] ^ table[0][buf[7]];
+        buf += 8;
+        n -= 8;
+    }
+    while (n--)
+        crc = (crc >> 8) ^ table[0][(crc ^ *buf++) & 0xff];
+    return ~crc;
+}
+
+#ifdef CRC32C_X86
+/* crc32q retires 8 bytes every cycle, well ahead of the extract kernels */
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_sse42(uint32_t crc, const unsigned char *buf, size_t n)
+{
+    uint64_t c = ~crc;
+
+    while (n >= 8)
+    {
+        uint64_t word;
+
+        memcpy(&word, buf, 8);
+        c = __builtin_ia32_crc32di(c, word);
+        buf += 8;
+        n -= 8;
+    }
+    while (n--)
+        c = __builtin_ia32_crc32qi((uint32_t)c, *buf++);
+    return ~(uint32_t)c;
+}
+#endif
+
+void crc32c_init(void)
+{
+#ifdef CRC32C_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse4.2"))
+    {
+        crc32c_update = crc32c_sse42;
+        kernel_name = "sse4.2";
+        return;
+    }
+#endif
+    for (uint32_t i = 0; i < 256; i++)
+    {
+        uint32_t crc = i;
+        for (int k = 0; k < 8; k++)
+            crc = crc & 1 ? (crc >> 1) ^ CRC32C_POLY : crc >> 1;
+        table[0][i] = crc;
+    }
+    for (uint32_t i = 0; i < 256; i++)
+        for (int t = 1; t < 8; t++)
+            table[t][i] = (table[t - 1][i] >> 8) ^ table[0][table[t - 1][i] & 0xff];
+
+    crc32c_update = crc32c_slice8;
+    kernel_name = "slice8";
+}
+
+const char *crc32c_name(void)
+{
+    return kernel_name;
+}
+
+/* a * b modulo the polynomial, bit-reflected (x^0 is the top bit) */
+static uint32_t multmodp(uint32_t a, uint32_t b)
+{
+    uint32_t p = 0;
+
+    for (uint32_t m = 1u << 31; m != 0; m >>= 1)
+    {
+        if (a & m)
+            p ^= b;
+        b = b & 1 ? (b >> 1) ^ CRC32C_POLY : b >> 1;
+    }
+    return p;
+}
+
+uint32_t crc32c_combine(uint32_t crc_a, uint32_t crc_b, uint64_t len_b)
+{
+    uint32_t shift = 1u << 31;      /* x^0 */
+    uint32_t square = 1u << 23;     /* x^8: one byte */
+
+    /* x^(8 * len_b) by squaring, then shift crc_a past B */
+    for (; len_b > 0; len_b >>= 1)
+    {
+        if (len_b & 1)
+            shift = multmodp(square, shift);
+        square = multmodp(square, square);
+    }
+    return multmodp(shift, crc_a) ^ crc_b;
+}
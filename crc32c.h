@@ -0,0 +1,30 @@
+#ifndef CRC32C_H
+#define CRC32C_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * CRC32C (Castagnoli) of the secret, stored after the payload when the
+ * v2 flag STEGO_FLAG_CRC is set. Chained like zlib's crc32(): start from
+ * 0 and pass the previous result back in. The SSE4.2 crc32 instruction
+ * is picked by crc32c_init() when present; otherwise slicing-by-8 tables.
+ */
+
+#define CRC32C_BYTES 4
+
+typedef uint32_t (*crc32c_fn)(uint32_t crc, const unsigned char *buf, size_t n);
+
+/* Active kernel (bitwise until crc32c_init() is called) */
+extern crc32c_fn crc32c_update;
+
+/* Detect SSE4.2 or build the software tables; called by lsb_kernel_init() */
+void crc32c_init(void);
+
+/* Name of the selected kernel ("sse4.2", "slice8" or "bitwise") */
+const char *crc32c_name(void);
+
+/* CRC of A followed by B, given the CRCs of both and B's length */
+uint32_t crc32c_combine(uint32_t crc_a, uint32_t crc_b, uint64_t len_b);
+
+#endif
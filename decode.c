@@ -1,24 +1,38 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <errno.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
 #include "types.h"
 #include "decode.h"
 #include "common.h"
+#include "lsb_kernel.h"
+#include "parallel.h"
+#include "pipe_io.h"
+#include "lz.h"
+#include "archive.h"
+#include "crc32c.h"
+#include "diag.h"
+
+/* Header field errors; a probe reports its own verdict instead */
+#define HEADER_ERROR(decInfo, ...) do { if (!(decInfo)->probe) diag_error(__VA_ARGS__); } while (0)
 
 /* Validate decode arguments */
 Status read_and_validate_decode_args(char *argv[], DecodeInfo *decInfo)
 {
     char *pt = strrchr(argv[2], '.');
-    if (pt == NULL || strcmp(pt, ".bmp") != 0)
+    if (!pipe_is_std(argv[2]) && (pt == NULL || strcmp(pt, ".bmp") != 0))
     {
-        printf("Error! File must end with .bmp\n");
+        diag_error("Error! File must end with .bmp\n");
         return e_failure;
     }
     decInfo->stego_image_fname = argv[2];
 
     if (argv[3] == NULL)
     {
-        printf("Error! Output file not provided.\n");
+        diag_error("Error! Output file not provided.\n");
         return e_failure;
     }
     decInfo->secret_fname = argv[3];
@@ -29,92 +43,426 @@ Status read_and_validate_decode_args(char *argv[], DecodeInfo *decInfo)
 /* Open files required for decoding */
 Status open_decode_files(DecodeInfo *decInfo)
 {
-    decInfo->fptr_stego_image = fopen(decInfo->stego_image_fname, "rb");
+    int piped = pipe_is_std(decInfo->stego_image_fname);
+
+    decInfo->stream = piped || pipe_is_std(decInfo->secret_fname);
+    decInfo->fptr_stego_image = piped ? pipe_stdin() : fopen(decInfo->stego_image_fname, "rb");
     if (decInfo->fptr_stego_image == NULL)
     {
         perror("fopen");
-        printf("Error! Unable to open stego image file: %s\n", decInfo->stego_image_fname);
+        diag_error("Error! Unable to open stego image file: %s\n", decInfo->stego_image_fname);
         return e_failure;
     }
 
-    /* Skip BMP header */
-    if (fseek(decInfo->fptr_stego_image, 54, SEEK_SET) != 0)
+    /* Parse the header and leave the stream at the pixel array */
+    unsigned char hdr[BMP_STREAM_HEADER_MAX];
+    Status parsed = piped ? bmp_read_stream_header(decInfo->fptr_stego_image, &decInfo->bmp, hdr, sizeof(hdr))
+                          : bmp_read_header(decInfo->fptr_stego_image, &decInfo->bmp);
+    if (parsed == e_failure || bmp_select_channels(&decInfo->bmp, decInfo->channels) == e_failure)
     {
-        printf("Error! Failed to seek stego image.\n");
+        diag_error("Error! %s: %s\n", decInfo->stego_image_fname, decInfo->bmp.error);
         fclose(decInfo->fptr_stego_image);
+        decInfo->fptr_stego_image = NULL;
         return e_failure;
     }
 
-    decInfo->fptr_secret = fopen(decInfo->secret_fname, "wb");
-    if (decInfo->fptr_secret == NULL)
+    /* Output files are created once the header is known; stdout is claimed now */
+    if (pipe_is_std(decInfo->secret_fname) && (decInfo->fptr_secret = pipe_stdout()) == NULL)
     {
-        perror("fopen");
-        printf("Error! Unable to create output secret file: %s\n", decInfo->secret_fname);
+        perror("fdopen");
         fclose(decInfo->fptr_stego_image);
+        decInfo->fptr_stego_image = NULL;
+        return e_failure;
+    }
+
+    if (decInfo->buf_size == 0)
+        decInfo->buf_size = DECODE_BUF_DEFAULT;
+
+    /* A caller-provided slice (batch workers) is reused as is */
+    decInfo->buf_owned = decInfo->img_buf == NULL;
+    if (decInfo->buf_owned)
+        decInfo->img_buf = malloc(decInfo->buf_size);
+    if (decInfo->img_buf == NULL)
+    {
+        diag_error("Error! Unable to allocate %zu byte decode buffer.\n", decInfo->buf_size);
+        close_decode_files(decInfo);
         return e_failure;
     }
+    decInfo->buf_len = 0;
+    decInfo->buf_pos = 0;
+    decInfo->carrier_pos = 0;
+    decInfo->raw_left = decInfo->bmp.pixel_bytes;
 
     return e_success;
 }
 
-/* Decode one byte from LSBs of 8 bytes */
-unsigned char decode_byte_from_lsb(const unsigned char *buffer)
+/* Restart carrier reads from the first pixel (after a channel mode switch) */
+static Status rewind_carrier(DecodeInfo *decInfo)
 {
-    unsigned char byte = 0;
-    for (int i = 0; i < 8; i++)
+    if (fseeko(decInfo->fptr_stego_image, decInfo->bmp.data_offset, SEEK_SET) != 0)
+        return e_failure;
+
+    decInfo->buf_len = 0;
+    decInfo->buf_pos = 0;
+    decInfo->carrier_pos = 0;
+    decInfo->raw_left = decInfo->bmp.pixel_bytes;
+    return e_success;
+}
+
+/* Close files and release the decode buffer; safe to call twice */
+void close_decode_files(DecodeInfo *decInfo)
+{
+    if (decInfo->fptr_stego_image != NULL && pipe_is_std(decInfo->stego_image_fname))
     {
-        byte = (byte << 1) | (buffer[i] & 1);
+        /* Drain the rest of a piped image so the producer does not hit EPIPE */
+        while (fread(decInfo->img_buf, 1, decInfo->buf_size, decInfo->fptr_stego_image) > 0)
+            ;
     }
-    return byte;
+    if (decInfo->fptr_stego_image != NULL)
+        fclose(decInfo->fptr_stego_image);
+    if (decInfo->fptr_secret != NULL)
+        fclose(decInfo->fptr_secret);
+    free(decInfo->lz);
+    decInfo->lz = NULL;
+    if (decInfo->buf_owned)
+    {
+        free(decInfo->img_buf);
+        decInfo->img_buf = NULL;
+        decInfo->buf_owned = 0;
+    }
+
+    decInfo->fptr_stego_image = NULL;
+    decInfo->fptr_secret = NULL;
 }
 
-/* Decode 32-bit unsigned size from 32 bytes */
-unsigned int decode_size_from_lsb(const unsigned char *buffer)
+/*
+ * Return a pointer to the next n carrier bytes, refilling the slice with
+ * one large fread when it runs dry. Strided carriers (alpha-only) and
+ * padded rows are compacted in place so callers always see contiguous
+ * carrier bytes. Reads stop at the end of the pixel array. NULL on short
+ * read.
+ */
+const unsigned char *read_stego_bytes(DecodeInfo *decInfo, size_t n)
+{
+    if (decInfo->buf_len - decInfo->buf_pos < n)
+    {
+        const BmpInfo *bmp = &decInfo->bmp;
+        size_t left = decInfo->buf_len - decInfo->buf_pos;
+
+        /* Raw pixels are read into the free space before compaction */
+        if (n > bmp_carrier_window(bmp, decInfo->buf_size))
+            return NULL;
+
+        memmove(decInfo->img_buf, decInfo->img_buf + decInfo->buf_pos, left);
+        decInfo->buf_pos = 0;
+        decInfo->buf_len = left;
+
+        /* Short reads (pipes, slow devices) are retried until n fit */
+        while (decInfo->buf_len < n)
+        {
+            unsigned char *dst = decInfo->img_buf + decInfo->buf_len;
+            uint64_t next = decInfo->carrier_pos + decInfo->buf_len;
+            size_t room = decInfo->buf_size - decInfo->buf_len;
+            if (room > decInfo->raw_left)
+                room = (size_t)decInfo->raw_left;
+
+            /* Whole carrier bytes only: a read ends where the next one's pixel starts */
+            size_t want = (size_t)bmp_raw_span(bmp, next, bmp_carrier_fit(bmp, next, room));
+            size_t got = want > 0 ? stats_fread(decInfo->stats, dst, want, decInfo->fptr_stego_image) : 0;
+            size_t count = (size_t)bmp_carrier_fit(bmp, next, got);
+            if (count == 0)
+                return NULL;
+
+            decInfo->raw_left -= got;
+            if (!bmp_contiguous(bmp))
+                bmp_gather(bmp, dst, next, count, dst);
+            decInfo->buf_len += count;
+        }
+    }
+
+    const unsigned char *p = decInfo->img_buf + decInfo->buf_pos;
+    decInfo->buf_pos += n;
+    decInfo->carrier_pos += n;
+    return p;
+}
+
+/*
+ * Move the read position to carrier byte target. Seekable images jump
+ * straight to the pixel; pipes read and drop the gap.
+ */
+static Status seek_carrier(DecodeInfo *decInfo, uint64_t target)
+{
+    uint64_t window = bmp_carrier_window(&decInfo->bmp, decInfo->buf_size);
+    int piped = pipe_is_std(decInfo->stego_image_fname);
+
+    if (target > decInfo->bmp.carrier_bytes || (target < decInfo->carrier_pos && piped))
+        return e_failure;
+
+    /* Already in the slice (or the stream cannot seek): consume up to it */
+    if ((target >= decInfo->carrier_pos && target - decInfo->carrier_pos <= decInfo->buf_len - decInfo->buf_pos) ||
+        piped)
+    {
+        while (decInfo->carrier_pos < target)
+        {
+            uint64_t gap = target - decInfo->carrier_pos;
+            size_t n = gap < window ? (size_t)gap : (size_t)window;
+            if (read_stego_bytes(decInfo, n) == NULL)
+                return e_failure;
+        }
+        return e_success;
+    }
+
+    if (fseeko(decInfo->fptr_stego_image, (off_t)bmp_pixel_offset(&decInfo->bmp, target), SEEK_SET) != 0)
+        return e_failure;
+
+    decInfo->buf_len = 0;
+    decInfo->buf_pos = 0;
+    decInfo->carrier_pos = target;
+    decInfo->raw_left = decInfo->bmp.pixel_bytes - bmp_raw_pos(&decInfo->bmp, target);
+    return e_success;
+}
+
+/* Carrier byte holding the first bit of payload group g */
+static uint64_t group_pos(const DecodeInfo *decInfo, uint64_t g)
+{
+    if (decInfo->header_flags & STEGO_FLAG_SCATTER)
+        return scatter_pos(&decInfo->scatter, g);
+    return decInfo->data_start + g * 8;
+}
+
+/* Payload bytes the carrier holds from group g on */
+static uint64_t payload_room(const DecodeInfo *decInfo, uint64_t g)
+{
+    if (decInfo->header_flags & STEGO_FLAG_SCATTER)
+        return g < decInfo->scatter.groups ? (decInfo->scatter.groups - g) * decInfo->depth : 0;
+    if (decInfo->data_start + g * 8 > decInfo->bmp.carrier_bytes)
+        return 0;
+    return (decInfo->bmp.carrier_bytes - decInfo->data_start - g * 8) * decInfo->depth / 8;
+}
+
+/*
+ * Move the read position to the depth group holding payload byte offset
+ * and return how many payload bytes of that group precede it.
+ */
+static Status seek_payload(DecodeInfo *decInfo, uint64_t offset, size_t *skip)
+{
+    uint64_t g = offset / decInfo->depth;
+
+    *skip = offset % decInfo->depth;
+    if (payload_room(decInfo, g) == 0)
+        return e_failure;
+    return seek_carrier(decInfo, group_pos(decInfo, g));
+}
+
+/*
+ * Extract n payload bytes (at most payload_room()) starting at group g.
+ * Keyed groups are read in order, a slice-sized window at a time, and
+ * the carrier bytes between them are skipped.
+ */
+static Status read_payload(DecodeInfo *decInfo, uint64_t g, size_t n, unsigned char *out)
 {
-    unsigned int size = 0;
-    for (int i = 0; i < 32; i++)
+    const ScatterMap *map = &decInfo->scatter;
+    unsigned char packed[8 * 256];
+    int depth = decInfo->depth;
+
+    if (seek_carrier(decInfo, group_pos(decInfo, g)) == e_failure)
+        return e_failure;
+
+    if (!(decInfo->header_flags & STEGO_FLAG_SCATTER))
     {
-        size = (size << 1) | (buffer[i] & 1);
+        const unsigned char *buffer = read_stego_bytes(decInfo, (size_t)lsb_carrier_bytes(n, depth));
+        if (buffer == NULL)
+            return e_failure;
+        lsb_extract_depth(buffer, n, out, depth);
+        return e_success;
     }
+
+    while (n > 0)
+    {
+        uint64_t base = decInfo->carrier_pos;
+        uint64_t left = scatter_groups(n, depth);
+        uint64_t limit;
+
+        if (left > sizeof(packed) / 8)
+            left = sizeof(packed) / 8;
+
+        size_t count = scatter_window(map, g, left, base, scatter_pos(map, g + left - 1) + 8,
+                                      bmp_carrier_window(&decInfo->bmp, decInfo->buf_size), &limit);
+        size_t take = count * depth < n ? count * depth : n;
+        const unsigned char *buffer = read_stego_bytes(decInfo, (size_t)(limit - base));
+
+        if (count == 0 || buffer == NULL)
+            return e_failure;
+        for (size_t i = 0; i < count; i++)
+            memcpy(packed + 8 * i, buffer + (scatter_pos(map, g + i) - base), 8);
+        lsb_extract_depth(packed, take, out, depth);
+
+        g += count;
+        out += take;
+        n -= take;
+        if (n > 0 && seek_carrier(decInfo, scatter_pos(map, g)) == e_failure)
+            return e_failure;
+    }
+    return e_success;
+}
+
+/* Decode one byte from LSBs of 8 bytes */
+unsigned char decode_byte_from_lsb(const unsigned char *buffer)
+{
+    unsigned char byte;
+    lsb_extract_scalar(buffer, 1, &byte);
+    return byte;
+}
+
+/* Decode 32-bit unsigned size from 32 bytes (MSB first) */
+unsigned int decode_size_from_lsb(const unsigned char *buffer)
+{
+    unsigned char bytes[4];
+    lsb_extract_block(buffer, 4, bytes);
+    return ((unsigned int)bytes[0] << 24) | ((unsigned int)bytes[1] << 16) |
+           ((unsigned int)bytes[2] << 8) | bytes[3];
+}
+
+/* Decode 64-bit unsigned size from 64 bytes (MSB first) */
+uint64_t decode_size64_from_lsb(const unsigned char *buffer)
+{
+    unsigned char bytes[8];
+    uint64_t size = 0;
+
+    lsb_extract_block(buffer, 8, bytes);
+    for (int i = 0; i < 8; i++)
+        size = (size << 8) | bytes[i];
     return size;
 }
 
-/* Decode magic string "#*" */
-Status decode_magic_string(DecodeInfo *decInfo)
+/*
+ * v1 images use the original layout (bmp_select_v1_layout). Only the magic
+ * has been read, so the stream goes on from there when that is where the
+ * v1 fields start; a seekable image jumps to them otherwise.
+ */
+static Status select_v1_layout(DecodeInfo *decInfo)
 {
-    unsigned char buffer[8];
-    char decoded_magic[3] = {0};
+    BmpInfo *bmp = &decInfo->bmp;
+    uint64_t next = bmp_pixel_offset(bmp, decInfo->carrier_pos);
+
+    bmp_select_v1_layout(bmp);
+    decInfo->raw_left = bmp->pixel_bytes - bmp_raw_pos(bmp, decInfo->carrier_pos);
+    if (bmp_pixel_offset(bmp, decInfo->carrier_pos) == next)
+        return e_success;
+    if (pipe_is_std(decInfo->stego_image_fname) ||
+        fseeko(decInfo->fptr_stego_image, (off_t)bmp_pixel_offset(bmp, decInfo->carrier_pos), SEEK_SET) != 0)
+        return e_failure;
+    return e_success;
+}
 
+/*
+ * Decode magic string: "#*" (v1) or "#@" (v2). A seekable image whose v1
+ * layout puts the magic elsewhere (narrow rows, a longer DIB header) is
+ * retried in that layout, and a 32bpp image in alpha-only mode.
+ */
+Status decode_magic_string(DecodeInfo *decInfo)
+{
     const size_t magic_len = strlen(MAGIC_STRING);
+    char decoded_magic[sizeof(MAGIC_STRING)] = {0};
+    const BmpInfo parsed = decInfo->bmp;
+    int piped = pipe_is_std(decInfo->stego_image_fname);
+    int v1_layout = 0;
 
-    for (size_t i = 0; i < magic_len; i++)
+    for (;;)
     {
-        if (fread(buffer, 1, 8, decInfo->fptr_stego_image) != 8)
+        /* Read the magic alone, so a v1 image can go on in its own layout */
+        uint64_t span = bmp_raw_span(&decInfo->bmp, 0, 8 * magic_len);
+        uint64_t rest = decInfo->raw_left > span ? decInfo->raw_left - span : 0;
+
+        decInfo->raw_left -= rest;
+        const unsigned char *buffer = read_stego_bytes(decInfo, 8 * magic_len);
+        decInfo->raw_left += rest;
+        if (buffer == NULL)
+        {
+            HEADER_ERROR(decInfo, "Error! Failed to read image buffer while decoding magic string.\n");
+            return e_failure;
+        }
+
+        lsb_extract_block(buffer, magic_len, (unsigned char *)decoded_magic);
+
+        if (strcmp(decoded_magic, MAGIC_STRING) == 0)
+        {
+            decInfo->header_version = STEGO_V1;
+            if (!v1_layout && decInfo->bmp.channels == e_channels_all && select_v1_layout(decInfo) == e_failure)
+            {
+                HEADER_ERROR(decInfo,
+                             "Error! Unable to reach the v1 header fields (a piped image must be seekable).\n");
+                return e_failure;
+            }
+        }
+        else if (strcmp(decoded_magic, MAGIC_STRING_V2) == 0 && !v1_layout)
+            decInfo->header_version = STEGO_V2;
+        else if (!v1_layout && !piped && decInfo->bmp.channels == e_channels_all &&
+                 (decInfo->bmp.data_offset != BMP_V1_DATA_OFFSET || span != 8 * magic_len))
         {
-            printf("Error! Failed to read image buffer while decoding magic string.\n");
+            bmp_select_v1_layout(&decInfo->bmp);
+            v1_layout = 1;
+            if (rewind_carrier(decInfo) == e_failure)
+                return e_failure;
+            continue;
+        }
+        else if (parsed.bpp == 32 && decInfo->bmp.channels == e_channels_all && piped)
+        {
+            HEADER_ERROR(decInfo, "Error! Magic string mismatch (a piped alpha-only image needs --alpha).\n");
+            return e_failure;
+        }
+        else if (parsed.bpp == 32 && decInfo->bmp.channels == e_channels_all)
+        {
+            decInfo->bmp = parsed;
+            v1_layout = 0;
+            if (bmp_select_channels(&decInfo->bmp, e_channels_alpha) == e_failure ||
+                rewind_carrier(decInfo) == e_failure)
+                return e_failure;
+            continue;
+        }
+        else
+        {
+            HEADER_ERROR(decInfo, "Error! Magic string mismatch.\n");
             return e_failure;
         }
 
-        decoded_magic[i] = (char)decode_byte_from_lsb(buffer);
+        return e_success;
     }
+}
+
+/* Decode v2 header flags (32 bits); v1 images have none */
+Status decode_header_flags(DecodeInfo *decInfo)
+{
+    decInfo->header_flags = 0;
+    decInfo->depth = 1;
+    if (decInfo->header_version == STEGO_V1)
+        return e_success;
 
-    if (strcmp(decoded_magic, MAGIC_STRING) != 0)
+    const unsigned char *buffer = read_stego_bytes(decInfo, 32);
+    if (buffer == NULL)
     {
-        printf("Error! Magic string mismatch.\n");
+        HEADER_ERROR(decInfo, "Error! Failed to read data while decoding header flags.\n");
         return e_failure;
     }
 
+    decInfo->header_flags = decode_size_from_lsb(buffer);
+    if (decInfo->header_flags & ~STEGO_FLAGS_KNOWN)
+    {
+        HEADER_ERROR(decInfo, "Error! Unsupported header flags: 0x%x\n", decInfo->header_flags);
+        return e_failure;
+    }
+    decInfo->depth = (int)(decInfo->header_flags & STEGO_FLAG_DEPTH_MASK) + 1;
+
     return e_success;
 }
 
 /* Decode extension size (32 bits) */
 Status decode_secret_file_extn_size(DecodeInfo *decInfo)
 {
-    unsigned char buffer[32];
-
-    if (fread(buffer, 1, 32, decInfo->fptr_stego_image) != 32)
+    const unsigned char *buffer = read_stego_bytes(decInfo, 32);
+    if (buffer == NULL)
     {
-        printf("Error! Failed to read data while decoding extension size.\n");
+        HEADER_ERROR(decInfo, "Error! Failed to read data while decoding extension size.\n");
         return e_failure;
     }
 
@@ -124,7 +472,7 @@ Status decode_secret_file_extn_size(DecodeInfo *decInfo)
     
     if (decInfo->extn_size <= 0 || decInfo->extn_size > (int)sizeof(decInfo->extn_secret_file) - 1)
     {
-        printf("Error! Decoded extension size is invalid: %d\n", decInfo->extn_size);
+        HEADER_ERROR(decInfo, "Error! Decoded extension size is invalid: %d\n", decInfo->extn_size);
         return e_failure;
     }
 
@@ -134,126 +482,870 @@ Status decode_secret_file_extn_size(DecodeInfo *decInfo)
 /* Decode extension string into decInfo->extn_secret_file (assumes buffer in header) */
 Status decode_secret_file_extn(DecodeInfo *decInfo)
 {
-    unsigned char buffer[8];
+    const unsigned char *buffer = read_stego_bytes(decInfo, 8 * (size_t)decInfo->extn_size);
+    if (buffer == NULL)
+    {
+        HEADER_ERROR(decInfo, "Error! Failed to read extension data.\n");
+        return e_failure;
+    }
+
+    lsb_extract_block(buffer, decInfo->extn_size, (unsigned char *)decInfo->extn_secret_file);
+
+    decInfo->extn_secret_file[decInfo->extn_size] = '\0';
+
+    return e_success;
+}
+
+/* Decode secret file size (32 bits in v1, 64 bits in v2) */
+Status decode_secret_file_size(DecodeInfo *decInfo)
+{
+    size_t len = decInfo->header_version == STEGO_V1 ? 32 : 64;
+
+    const unsigned char *buffer = read_stego_bytes(decInfo, len);
+    if (buffer == NULL)
+    {
+        HEADER_ERROR(decInfo, "Error! Failed to read image buffer.\n");
+        return e_failure;
+    }
+
+    if (len == 32)
+        decInfo->size_secret_file = decode_size_from_lsb(buffer);
+    else
+        decInfo->size_secret_file = decode_size64_from_lsb(buffer);
+
+    PROGRESS(decInfo->quiet, "Decoded secret size = %llu\n", (unsigned long long)decInfo->size_secret_file);
+    return e_success;
+}
+
+/* Positional state shared by the data-extraction workers */
+typedef struct
+{
+    int stego_fd;
+    int secret_fd;
+    const BmpInfo *bmp;
+    uint64_t carrier_start;     /* carrier byte holding payload byte 0 */
+    uint64_t payload_start;     /* payload byte written at output offset 0 */
+    int depth;
+    Stats *stats;
+    uint64_t chunk;
+    uint32_t *crcs;             /* CRC32C per chunk, or NULL */
+    const ScatterMap *scatter;  /* keyed layout, or NULL */
+} ExtractJob;
+
+/* Raw bytes a keyed worker reads per positional read */
+#define SCATTER_WINDOW (1024 * 1024)
+
+/* Keyed layout: extract n payload bytes from group g on, sweeping the carrier a window at a time */
+static Status extract_scattered(ExtractJob *job, uint64_t g, size_t n, unsigned char *out)
+{
+    const ScatterMap *map = job->scatter;
+    const BmpInfo *bmp = job->bmp;
+    uint64_t left = scatter_groups(n, job->depth);
+    uint64_t w = scatter_pos(map, g);
+    uint64_t end = scatter_pos(map, g + left - 1) + 8;
+    unsigned char *raw = malloc(2 * SCATTER_WINDOW);
+    unsigned char *packed = raw + SCATTER_WINDOW;
+    Status ret = e_success;
+
+    if (raw == NULL)
+        return e_failure;
 
-    for (int i = 0; i < decInfo->extn_size; i++)
+    while (w < end)
     {
-        if (fread(buffer, 1, 8, decInfo->fptr_stego_image) != 8)
+        uint64_t limit;
+        size_t count = scatter_window(map, g, left, w, end, bmp_carrier_window(bmp, SCATTER_WINDOW), &limit);
+        size_t raw_len = (size_t)bmp_raw_span(bmp, w, limit - w);
+        size_t take = count * job->depth < n ? count * job->depth : n;
+
+        /* A window that cannot be read ends the chunk; nothing is extracted from it */
+        if (pread_full(job->stego_fd, raw, raw_len, (off_t)bmp_pixel_offset(bmp, w)) == e_failure)
         {
-            printf("Error! Failed to read extension data.\n");
-            return e_failure;
+            ret = e_failure;
+            break;
         }
+        stats_add_read(job->stats, raw_len);
+        scatter_gather(map, bmp, raw, w, g, count, packed);
+        lsb_extract_depth(packed, take, out, job->depth);
 
-        decInfo->extn_secret_file[i] = (char)decode_byte_from_lsb(buffer);
+        /* The next window starts at the next group, past the gap */
+        g += count;
+        left -= count;
+        out += take;
+        n -= take;
+        w = left > 0 ? scatter_pos(map, g) : end;
     }
 
-    decInfo->extn_secret_file[decInfo->extn_size] = '\0';
+    free(raw);
+    return ret;
+}
 
-    return e_success;
+/* Extract output bytes [start, start + len) with positional reads/writes */
+static Status extract_chunk(void *ctx, int worker, uint64_t start, uint64_t len)
+{
+    ExtractJob *job = ctx;
+    const BmpInfo *bmp = job->bmp;
+    uint64_t pos = job->payload_start + start;
+    size_t skip = pos % job->depth;
+    size_t carrier_len = (size_t)lsb_carrier_bytes(skip + len, job->depth);
+    uint64_t first = job->carrier_start + pos / job->depth * 8;
+    size_t raw_len = (size_t)bmp_raw_span(bmp, first, carrier_len);
+    unsigned char *carrier = malloc(raw_len + skip + len);
+    unsigned char *decoded = carrier + raw_len;
+    off_t off = (off_t)bmp_pixel_offset(bmp, first);
+    Status ret = e_failure;
+
+    (void)worker;
+    if (carrier == NULL)
+        return e_failure;
+
+    if (job->scatter != NULL)
+    {
+        ret = extract_scattered(job, pos / job->depth, skip + len, decoded);
+        if (ret == e_success)
+        {
+            if (job->crcs != NULL)
+                job->crcs[start / job->chunk] = crc32c_update(0, decoded + skip, len);
+            ret = pwrite_full(job->secret_fd, decoded + skip, len, (off_t)start);
+            stats_add_write(job->stats, len);
+        }
+    }
+    else if (pread_full(job->stego_fd, carrier, raw_len, off) == e_success)
+    {
+        stats_add_read(job->stats, raw_len);
+        if (!bmp_contiguous(bmp))
+            bmp_gather(bmp, carrier, first, carrier_len, carrier);
+        lsb_extract_depth(carrier, skip + len, decoded, job->depth);
+        if (job->crcs != NULL)
+            job->crcs[start / job->chunk] = crc32c_update(0, decoded + skip, len);
+        ret = pwrite_full(job->secret_fd, decoded + skip, len, (off_t)start);
+        stats_add_write(job->stats, len);
+    }
+
+    free(carrier);
+    return ret;
 }
 
-/* Decode secret file size (32 bits) */
-Status decode_secret_file_size(DecodeInfo *decInfo)
+/* Secret bytes [offset, offset + n) were extracted; extend the running CRC32C if they follow on */
+static void checksum_add(DecodeInfo *decInfo, uint64_t offset, const unsigned char *bytes, size_t n)
 {
-    unsigned char buffer[32];
+    if ((decInfo->header_flags & STEGO_FLAG_CRC) && offset == decInfo->crc_pos &&
+        n <= decInfo->size_secret_file - offset)
+    {
+        decInfo->crc = crc32c_update(decInfo->crc, bytes, n);
+        decInfo->crc_pos += n;
+    }
+}
 
-    if (fread(buffer, 1, 32, decInfo->fptr_stego_image) != 32)
+/* Decode payload bytes [offset, offset + len) from decInfo->threads workers */
+static Status decode_payload_parallel(DecodeInfo *decInfo, uint64_t offset, uint64_t len)
+{
+    ExtractJob job;
+    int checksum = (decInfo->header_flags & STEGO_FLAG_CRC) && offset == decInfo->crc_pos;
+
+    job.stego_fd = fileno(decInfo->fptr_stego_image);
+    job.secret_fd = fileno(decInfo->fptr_secret);
+    job.bmp = &decInfo->bmp;
+    job.carrier_start = decInfo->data_start;
+    job.payload_start = offset;
+    job.depth = decInfo->depth;
+    job.stats = decInfo->stats;
+    job.chunk = stego_chunk_size(PARALLEL_CHUNK, job.depth);
+    job.scatter = decInfo->header_flags & STEGO_FLAG_SCATTER ? &decInfo->scatter : NULL;
+    job.crcs = checksum ? malloc((len / job.chunk + 1) * sizeof(*job.crcs)) : NULL;
+    if (checksum && job.crcs == NULL)
     {
-        printf("Error! Failed to read image buffer.\n");
+        diag_error("Error! Unable to allocate checksum table.\n");
         return e_failure;
     }
 
-    unsigned int size = decode_size_from_lsb(buffer);
-    decInfo->size_secret_file = (int)size;
+    Status ret = parallel_for_chunks(decInfo->threads, len, job.chunk, extract_chunk, &job);
+    if (ret == e_failure)
+        diag_error("Error! Failed to decode secret file data in parallel.\n");
 
-    
-    if (decInfo->size_secret_file < 0)
+    /* Chunk CRCs fold into the running one in order */
+    for (uint64_t start = 0; checksum && ret == e_success && start < len; start += job.chunk)
     {
-        printf("Error! Invalid secret file size decoded: %d\n", decInfo->size_secret_file);
+        uint64_t n = len - start < job.chunk ? len - start : job.chunk;
+
+        decInfo->crc = crc32c_combine(decInfo->crc, job.crcs[start / job.chunk], n);
+        decInfo->crc_pos += n;
+    }
+
+    free(job.crcs);
+    return ret;
+}
+
+/* Decoded secret bytes [offset, offset + n) go to the output file, or to out_mem while set */
+static Status write_output(DecodeInfo *decInfo, uint64_t offset, const unsigned char *bytes, size_t n)
+{
+    checksum_add(decInfo, offset, bytes, n);
+
+    if (decInfo->out_mem != NULL)
+    {
+        memcpy(decInfo->out_mem + decInfo->out_mem_len, bytes, n);
+        decInfo->out_mem_len += n;
+        return e_success;
+    }
+
+    if (stats_fwrite(decInfo->stats, bytes, n, decInfo->fptr_secret) != n)
+    {
+        diag_error("Error! Failed to write output to secret file.\n");
         return e_failure;
     }
+    return e_success;
+}
+
+/* Extracted payload bytes, refilled a whole number of depth groups at a time */
+typedef struct
+{
+    DecodeInfo *decInfo;
+    unsigned char buf[1024];
+    size_t pos;
+    size_t len;
+    uint64_t next;              /* payload offset of the byte after buf */
+} PayloadReader;
+
+/* Copy the next n payload bytes out of the image; fails past the carrier end */
+static Status payload_read(PayloadReader *r, unsigned char *dst, size_t n)
+{
+    DecodeInfo *decInfo = r->decInfo;
 
-    printf("Decoded secret size = %d\n", decInfo->size_secret_file);
+    while (n > 0)
+    {
+        if (r->pos == r->len)
+        {
+            uint64_t g = r->next / decInfo->depth;
+            uint64_t room = payload_room(decInfo, g);
+            size_t chunk = stego_chunk_size(sizeof(r->buf), decInfo->depth);
+
+            if (chunk > room)
+                chunk = (size_t)room;
+            if (chunk == 0 || read_payload(decInfo, g, chunk, r->buf) == e_failure)
+                return e_failure;
+
+            r->pos = 0;
+            r->len = chunk;
+            r->next += chunk;
+        }
+
+        size_t take = r->len - r->pos < n ? r->len - r->pos : n;
+        memcpy(dst, r->buf + r->pos, take);
+        r->pos += take;
+        dst += take;
+        n -= take;
+    }
     return e_success;
 }
 
-/* Decode secret file data and write to output */
-Status decode_secret_file_data(DecodeInfo *decInfo)
+/* Move the reader to payload byte target, seeking past what is not buffered */
+static Status payload_seek(PayloadReader *r, uint64_t target)
+{
+    unsigned char group[LSB_MAX_DEPTH];
+    size_t skip;
+
+    if (target <= r->next && target >= r->next - r->len)
+    {
+        r->pos = (size_t)(target - (r->next - r->len));
+        return e_success;
+    }
+
+    if (seek_payload(r->decInfo, target, &skip) == e_failure)
+        return e_failure;
+
+    r->pos = 0;
+    r->len = 0;
+    r->next = target - skip;
+    return payload_read(r, group, skip);
+}
+
+/*
+ * Frame cursor over a compressed secret. The last decoded frame is kept,
+ * so consecutive ranges (an archive TOC, then a member) continue where
+ * the previous one stopped instead of walking the frames again.
+ */
+struct LzCursor
 {
-    unsigned char buffer[8];
-    unsigned char decoded_byte;
+    PayloadReader r;
+    uint64_t frame_start;       /* secret offset of the frame in raw */
+    size_t frame_len;           /* raw bytes in it; 0 = none decoded */
+    unsigned char raw[LZ_BLOCK];
+    unsigned char body[LZ_BLOCK];
+};
 
-    for (int i = 0; i < decInfo->size_secret_file; i++)
+/*
+ * Decode secret bytes [offset, offset + len) of a compressed secret: one
+ * LZ frame per LZ_BLOCK of output. Frames before the range are skipped by
+ * their length word, so only the frames that overlap it are read.
+ */
+static LzCursor *lz_cursor(DecodeInfo *decInfo)
+{
+    if (decInfo->lz == NULL)
     {
-        if (fread(buffer, 1, 8, decInfo->fptr_stego_image) != 8)
+        decInfo->lz = calloc(1, sizeof(*decInfo->lz));
+        if (decInfo->lz == NULL)
         {
-            printf("Error! Failed to read image data while decoding secret file data.\n");
+            diag_error("Error! Unable to allocate decompression buffers.\n");
+            return NULL;
+        }
+        decInfo->lz->r.decInfo = decInfo;
+    }
+    return decInfo->lz;
+}
+
+static Status decode_payload_lz(DecodeInfo *decInfo, uint64_t offset, uint64_t len)
+{
+    LzCursor *c = lz_cursor(decInfo);
+
+    if (c == NULL)
+        return e_failure;
+
+    /* A range behind the cursor starts over from the first frame */
+    if (offset < c->frame_start)
+    {
+        if (payload_seek(&c->r, 0) == e_failure)
+        {
+            diag_error("Error! Cannot go back to an earlier part of a piped compressed secret.\n");
             return e_failure;
         }
+        c->frame_start = 0;
+        c->frame_len = 0;
+    }
+
+    while (len > 0)
+    {
+        if (offset < c->frame_start + c->frame_len)
+        {
+            size_t from = (size_t)(offset - c->frame_start);
+            size_t count = c->frame_len - from < len ? c->frame_len - from : (size_t)len;
+
+            if (write_output(decInfo, offset, c->raw + from, count) == e_failure)
+                return e_failure;
+            offset += count;
+            len -= count;
+            continue;
+        }
 
-        decoded_byte = decode_byte_from_lsb(buffer);
+        uint64_t done = c->frame_start + c->frame_len;
+        uint64_t left = decInfo->size_secret_file - done;
+        size_t n = left < LZ_BLOCK ? (size_t)left : LZ_BLOCK;
+        unsigned char hdr[LZ_FRAME_HEADER];
+        size_t body_len;
+        int stored;
 
-        if (fwrite(&decoded_byte, 1, 1, decInfo->fptr_secret) != 1)
+        c->frame_start = done;
+        c->frame_len = 0;
+        if (n == 0 ||
+            payload_read(&c->r, hdr, sizeof(hdr)) == e_failure ||
+            lz_frame_header(hdr, n, &body_len, &stored) == e_failure)
         {
-            printf("Error! Failed to write output to secret file.\n");
+            diag_error("Error! Corrupt or truncated compressed secret.\n");
+            return e_failure;
+        }
+
+        if (done + n <= offset)
+        {
+            if (payload_seek(&c->r, c->r.next - (c->r.len - c->r.pos) + body_len) == e_failure)
+            {
+                diag_error("Error! Corrupt or truncated compressed secret.\n");
+                return e_failure;
+            }
+            c->frame_start = done + n;
+            continue;
+        }
+
+        if (payload_read(&c->r, stored ? c->raw : c->body, body_len) == e_failure ||
+            (!stored && lz_decompress(c->body, body_len, c->raw, n) == e_failure))
+        {
+            diag_error("Error! Corrupt or truncated compressed secret.\n");
+            return e_failure;
+        }
+        c->frame_len = n;
+    }
+    return e_success;
+}
+
+/*
+ * Decode payload bytes [offset, offset + len): each pass extracts
+ * everything left in the pixel slice and writes it with a single fwrite.
+ */
+static Status decode_payload(DecodeInfo *decInfo, uint64_t offset, uint64_t len)
+{
+    size_t skip;
+    int depth = decInfo->depth;
+
+    if (decInfo->header_flags & STEGO_FLAG_LZ)
+        return decode_payload_lz(decInfo, offset, len);
+
+    /* The group the previous range ended in is consumed; serve it from its copy */
+    if (len > 0 && offset >= decInfo->tail_offset && offset < decInfo->tail_offset + decInfo->tail_len)
+    {
+        size_t from = (size_t)(offset - decInfo->tail_offset);
+        size_t take = decInfo->tail_len - from < len ? decInfo->tail_len - from : (size_t)len;
+
+        if (write_output(decInfo, offset, decInfo->tail + from, take) == e_failure)
             return e_failure;
+        offset += take;
+        len -= take;
+    }
+    if (len == 0)
+        return e_success;
+
+    if (decInfo->threads > 1 && len >= PARALLEL_MIN_PAYLOAD && !decInfo->stream && decInfo->out_mem == NULL)
+        return decode_payload_parallel(decInfo, offset, len);
+
+    /* Jump to the first group of the range; skip counts its bytes before offset */
+    if (seek_payload(decInfo, offset, &skip) == e_failure)
+    {
+        diag_error("Error! Failed to seek to the requested range.\n");
+        return e_failure;
+    }
+
+    size_t out_size = (size_t)(bmp_carrier_window(&decInfo->bmp, decInfo->buf_size) / 8 * decInfo->depth);
+    unsigned char *decoded = malloc(out_size);
+    Status ret = e_success;
+
+    if (decoded == NULL)
+    {
+        diag_error("Error! Unable to allocate output block.\n");
+        return e_failure;
+    }
+
+    while (len > 0)
+    {
+        /* Whole depth groups (8 carrier bytes each) left in the slice */
+        size_t avail = (decInfo->buf_len - decInfo->buf_pos) / 8 * depth;
+        size_t n = skip + len < out_size ? (size_t)(skip + len) : out_size;
+        uint64_t base = offset - skip;
+
+        if (avail > 0 && avail < n && !(decInfo->header_flags & STEGO_FLAG_SCATTER))
+            n = avail;
+
+        /*
+         * Extract up to the end of the last group (never past the carrier),
+         * so the carrier position stays group aligned for the next range.
+         */
+        size_t whole = (n + depth - 1) / depth * depth;
+        uint64_t room = payload_room(decInfo, base / depth);
+        if (whole > room)
+            whole = (size_t)room;
+
+        if (whole < n || read_payload(decInfo, base / depth, whole, decoded) == e_failure)
+        {
+            diag_error("Error! Failed to read image data while decoding secret file data.\n");
+            ret = e_failure;
+            break;
         }
+
+        if (write_output(decInfo, offset, decoded + skip, n - skip) == e_failure)
+        {
+            ret = e_failure;
+            break;
+        }
+
+        size_t last = (whole - 1) / depth * depth;
+        decInfo->tail_offset = base + last;
+        decInfo->tail_len = whole - last;
+        memcpy(decInfo->tail, decoded + last, decInfo->tail_len);
+
+        offset += n - skip;
+        len -= n - skip;
+        skip = 0;
     }
 
-    /* Close files */
-    fclose(decInfo->fptr_stego_image);
-    fclose(decInfo->fptr_secret);
+    free(decoded);
+    return ret;
+}
+
+/* Create the output file; a piped output was already opened with the image */
+static Status open_output(DecodeInfo *decInfo, const char *fname)
+{
+    if (decInfo->fptr_secret != NULL)
+        return e_success;
 
+    decInfo->fptr_secret = fopen(fname, "wb");
+    if (decInfo->fptr_secret == NULL)
+    {
+        perror("fopen");
+        diag_error("Error! Unable to create output secret file: %s\n", fname);
+        return e_failure;
+    }
     return e_success;
 }
 
-/*decoding steps */
-Status do_decoding(DecodeInfo *decInfo)
+/* Clip the --range to [0, size); fails if it starts past the end */
+static Status resolve_range(DecodeInfo *decInfo, uint64_t size, uint64_t *offset, uint64_t *len)
 {
-    printf("\n-----DECODING-----\n\n");
+    *offset = 0;
+    *len = size;
+    if (!decInfo->range_given)
+        return e_success;
 
-    if (open_decode_files(decInfo) == e_failure)
+    if (decInfo->range_offset > size)
     {
-        printf("Failed to open files.\n");
+        diag_error("Error! Range offset %llu is past the end of the %llu byte secret.\n",
+               (unsigned long long)decInfo->range_offset, (unsigned long long)size);
         return e_failure;
     }
-    printf("Opened files successfully.\n");
 
+    /* A range running past the end is cut at the end of the secret */
+    *offset = decInfo->range_offset;
+    *len = size - *offset < decInfo->range_len ? size - *offset : decInfo->range_len;
+    return e_success;
+}
+
+/* Read and check an archive's TOC into a malloc'd entry array */
+static ArchiveEntry *read_archive_toc(DecodeInfo *decInfo, uint32_t *count)
+{
+    unsigned char head[ARCHIVE_TOC_FIXED];
+    uint32_t toc_len;
+    ArchiveEntry *entries = NULL;
+    unsigned char *toc = NULL;
+
+    decInfo->out_mem = head;
+    decInfo->out_mem_len = 0;
+    if (decInfo->size_secret_file >= sizeof(head) && decode_payload(decInfo, 0, sizeof(head)) == e_success &&
+        archive_toc_header(head, decInfo->size_secret_file, count, &toc_len) == e_success &&
+        (toc = malloc(toc_len)) != NULL)
+    {
+        memcpy(toc, head, sizeof(head));
+        decInfo->out_mem = toc;
+        decInfo->out_mem_len = sizeof(head);
+        entries = malloc((*count ? *count : 1) * sizeof(*entries));
+
+        if (entries == NULL || decode_payload(decInfo, sizeof(head), toc_len - sizeof(head)) == e_failure ||
+            archive_parse_toc(toc, toc_len, decInfo->size_secret_file, entries, *count) == e_failure)
+        {
+            free(entries);
+            entries = NULL;
+        }
+    }
+
+    decInfo->out_mem = NULL;
+    free(toc);
+    if (entries == NULL)
+        diag_error("Error! Corrupt archive table of contents.\n");
+    return entries;
+}
+
+/* dir/name in a malloc'd string */
+static char *join_path(const char *dir, const char *name)
+{
+    size_t len = strlen(dir) + strlen(name) + 2;
+    char *path = malloc(len);
+
+    if (path != NULL)
+        snprintf(path, len, "%s/%s", dir, name);
+    return path;
+}
+
+/* New directory next to the output ("<out>.part<pid>.<n>"), malloc'd */
+static char *make_archive_dir(const char *out)
+{
+    size_t out_len = strlen(out);
+    size_t len = out_len + 48;
+    char *dir = malloc(len);
+
+    /* "adir/" names the same directory as "adir" */
+    while (out_len > 1 && out[out_len - 1] == '/')
+        out_len--;
+    for (int n = 0; dir != NULL; n++)
+    {
+        snprintf(dir, len, "%.*s.part%ld.%d", (int)out_len, out, (long)getpid(), n);
+        if (mkdir(dir, 0777) == 0)
+            return dir;
+        if (errno != EEXIST)
+        {
+            perror("mkdir");
+            break;
+        }
+    }
+    free(dir);
+    return NULL;
+}
+
+/*
+ * Put a whole archive extracted into decInfo->archive_dir in place: a new
+ * output directory is that directory renamed, an existing one gets the
+ * members moved in. After a failure (a checksum mismatch included) the
+ * members are unlinked instead, so none is left behind.
+ */
+static Status finish_archive_dir(DecodeInfo *decInfo, Status ret)
+{
+    char *dir = decInfo->archive_dir;
+    DIR *d;
+    struct dirent *ent;
+
+    decInfo->archive_dir = NULL;
+    if (ret == e_success && rename(dir, decInfo->secret_fname) == 0)
+    {
+        free(dir);
+        return e_success;
+    }
+    if (ret == e_success && errno != EEXIST && errno != ENOTEMPTY)
+    {
+        perror("rename");
+        diag_error("Error! Unable to create output directory %s\n", decInfo->secret_fname);
+        ret = e_failure;
+    }
+
+    if ((d = opendir(dir)) != NULL)
+    {
+        while ((ent = readdir(d)) != NULL)
+        {
+            if (strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0)
+                continue;
+
+            char *from = join_path(dir, ent->d_name);
+            char *to = join_path(decInfo->secret_fname, ent->d_name);
+
+            if (ret == e_success && (from == NULL || to == NULL || rename(from, to) != 0))
+            {
+                perror("rename");
+                diag_error("Error! Unable to move %s into %s\n", ent->d_name, decInfo->secret_fname);
+                ret = e_failure;
+            }
+            if (ret == e_failure && from != NULL)
+                unlink(from);
+            free(from);
+            free(to);
+        }
+        closedir(d);
+    }
+    if (rmdir(dir) != 0)
+        perror("rmdir");
+    free(dir);
+    return ret;
+}
+
+/*
+ * Archive payload: --file NAME writes one member (or a --range of it) to
+ * the output; otherwise every member is extracted into a temporary
+ * directory that finish_archive_dir() puts in place once the checksum
+ * (if any) matched. Members are stored in TOC order, so reads only move
+ * forward.
+ */
+static Status decode_archive(DecodeInfo *decInfo)
+{
+    uint32_t count;
+    ArchiveEntry *entries = read_archive_toc(decInfo, &count);
+    Status ret = e_success;
+    uint64_t offset, len;
+
+    if (entries == NULL)
+        return e_failure;
+
+    if (decInfo->archive_entry != NULL)
+    {
+        const ArchiveEntry *e = archive_find(entries, count, decInfo->archive_entry);
+
+        if (e == NULL)
+        {
+            diag_error("Error! No file named %s in the archive.\n", decInfo->archive_entry);
+            ret = e_failure;
+        }
+        else if (resolve_range(decInfo, e->size, &offset, &len) == e_failure ||
+                 open_output(decInfo, decInfo->secret_fname) == e_failure ||
+                 decode_payload(decInfo, e->offset + offset, len) == e_failure)
+            ret = e_failure;
+        else
+            PROGRESS(decInfo->quiet, "Extracted %s (%llu bytes)\n", e->name, (unsigned long long)len);
+    }
+    else if (decInfo->fptr_secret != NULL || decInfo->range_given)
+    {
+        diag_error("Error! The image holds an archive of %u files; pick one with --file NAME.\n", count);
+        ret = e_failure;
+    }
+    else if ((decInfo->archive_dir = make_archive_dir(decInfo->secret_fname)) == NULL)
+    {
+        diag_error("Error! Unable to create output directory %s\n", decInfo->secret_fname);
+        ret = e_failure;
+    }
+    else
+    {
+        for (uint32_t i = 0; i < count && ret == e_success; i++)
+        {
+            char *path = join_path(decInfo->archive_dir, entries[i].name);
+
+            if (path == NULL)
+            {
+                diag_error("Error! Unable to allocate an output path.\n");
+                ret = e_failure;
+                break;
+            }
+
+            ret = open_output(decInfo, path);
+            if (ret == e_success)
+            {
+                ret = decode_payload(decInfo, entries[i].offset, entries[i].size);
+                if (fclose(decInfo->fptr_secret) != 0 && ret == e_success)
+                {
+                    diag_error("Error! Failed to write output to secret file.\n");
+                    ret = e_failure;
+                }
+                decInfo->fptr_secret = NULL;
+            }
+            if (ret == e_success)
+                PROGRESS(decInfo->quiet, "Extracted %s/%s (%llu bytes)\n", decInfo->secret_fname, entries[i].name,
+                         (unsigned long long)entries[i].size);
+            free(path);
+        }
+    }
+
+    free(entries);
+    return ret;
+}
+
+/*
+ * Compare the CRC32C accumulated while the secret was written out with the
+ * one stored after it. A mismatch marks decInfo->checksum_failed.
+ */
+static Status verify_checksum(DecodeInfo *decInfo)
+{
+    unsigned char stored[CRC32C_BYTES];
+    uint32_t crc = decInfo->crc;
+    int covered = decInfo->crc_pos == decInfo->size_secret_file;
+    Status read;
+
+    /* The trailer follows the last frame, or the secret's last byte */
+    if (decInfo->header_flags & STEGO_FLAG_LZ)
+        read = lz_cursor(decInfo) != NULL ? payload_read(&decInfo->lz->r, stored, sizeof(stored)) : e_failure;
+    else
+    {
+        decInfo->out_mem = stored;
+        decInfo->out_mem_len = 0;
+        read = decode_payload(decInfo, decInfo->size_secret_file, sizeof(stored));
+        decInfo->out_mem = NULL;
+    }
+
+    if (read == e_failure || !covered || (uint32_t)stego_get_be(stored, CRC32C_BYTES) != crc)
+    {
+        diag_error("Error! Checksum mismatch: the decoded secret is corrupt.\n");
+        decInfo->checksum_failed = 1;
+        return e_failure;
+    }
+    PROGRESS(decInfo->quiet, "Checksum verified (CRC32C %08x).\n", crc);
+    return e_success;
+}
+
+/* Decode the secret (or its --range / --file selection) and close the files */
+Status decode_secret_file_data(DecodeInfo *decInfo)
+{
+    uint64_t offset, len;
+    uint64_t trailer = decInfo->header_flags & STEGO_FLAG_CRC ? CRC32C_BYTES : 0;
+    Status ret = e_failure;
+
+    decInfo->data_start = decInfo->carrier_pos;
+
+    /* Keyed images place the payload from the key; the layout is only valid with it */
+    if ((decInfo->header_flags & STEGO_FLAG_SCATTER) && decInfo->key == NULL)
+        diag_error("Error! The image was embedded with a key; pass it with --key.\n");
+    else if (!(decInfo->header_flags & STEGO_FLAG_SCATTER) && decInfo->key != NULL)
+        diag_error("Error! The image was not embedded with a key.\n");
+    else if ((decInfo->header_flags & STEGO_FLAG_SCATTER) &&
+             scatter_init(&decInfo->scatter, scatter_seed(decInfo->key), decInfo->data_start,
+                          decInfo->bmp.carrier_bytes, decInfo->size_secret_file,
+                          (decInfo->header_flags & STEGO_FLAG_LZ) != 0, trailer != 0, decInfo->depth) == e_failure)
+        diag_error("Error! Decoded secret size exceeds the image capacity.\n");
+    /* A compressed secret's frames are checked as they are read instead */
+    else if (!(decInfo->header_flags & STEGO_FLAG_LZ) &&
+             payload_room(decInfo, 0) < decInfo->size_secret_file + trailer)
+        diag_error("Error! Decoded secret size exceeds the image capacity.\n");
+    else if (decInfo->header_flags & STEGO_FLAG_ARCHIVE)
+        ret = decode_archive(decInfo);
+    else if (decInfo->archive_entry != NULL)
+        diag_error("Error! --file needs an image that holds an archive.\n");
+    else if (resolve_range(decInfo, decInfo->size_secret_file, &offset, &len) == e_success &&
+             open_output(decInfo, decInfo->secret_fname) == e_success)
+        ret = decode_payload(decInfo, offset, len);
+
+    /* Only a whole secret can be checked */
+    if (ret == e_success && trailer && !decInfo->range_given && decInfo->archive_entry == NULL)
+        ret = verify_checksum(decInfo);
+
+    close_decode_files(decInfo);
+
+    /* A corrupt secret is not left behind looking like a good one */
+    if (decInfo->archive_dir != NULL)
+        ret = finish_archive_dir(decInfo, ret);
+    else if (decInfo->checksum_failed && !pipe_is_std(decInfo->secret_fname) && remove(decInfo->secret_fname) != 0)
+        perror("remove");
+    return ret;
+}
+
+/* Decoding stages run on the opened files */
+static Status decode_stages(DecodeInfo *decInfo)
+{
+    stats_begin(decInfo->stats, e_stage_magic);
     if (decode_magic_string(decInfo) == e_failure)
     {
-        printf("Failed to decode magic string.\n");
+        diag_error("Failed to decode magic string.\n");
+        return e_failure;
+    }
+    PROGRESS(decInfo->quiet, "Decoded magic string successfully.\n");
+
+    if (decode_header_flags(decInfo) == e_failure)
+    {
+        diag_error("Failed to decode header flags.\n");
         return e_failure;
     }
-    printf("Decoded magic string successfully.\n");
+
+    stats_begin(decInfo->stats, e_stage_extn);
 
     if (decode_secret_file_extn_size(decInfo) == e_failure)
     {
-        printf("Failed to decode secret file extension size.\n");
+        diag_error("Failed to decode secret file extension size.\n");
         return e_failure;
     }
-    printf("Decoded secret file extension size successfully.\n");
+    PROGRESS(decInfo->quiet, "Decoded secret file extension size successfully.\n");
 
     if (decode_secret_file_extn(decInfo) == e_failure)
     {
-        printf("Failed to decode secret file extension.\n");
+        diag_error("Failed to decode secret file extension.\n");
         return e_failure;
     }
-    printf("Decoded secret file extension successfully.\n");
+    PROGRESS(decInfo->quiet, "Decoded secret file extension successfully.\n");
+
+    stats_begin(decInfo->stats, e_stage_size);
 
     if (decode_secret_file_size(decInfo) == e_failure)
     {
-        printf("Failed to decode secret file size.\n");
+        diag_error("Failed to decode secret file size.\n");
         return e_failure;
     }
-    printf("Decoded secret file size successfully.\n");
+    PROGRESS(decInfo->quiet, "Decoded secret file size successfully.\n");
+
+    stats_begin(decInfo->stats, e_stage_data);
 
     if (decode_secret_file_data(decInfo) == e_failure)
     {
-        printf("Failed to decode secret file data.\n");
+        diag_error("Failed to decode secret file data.\n");
         return e_failure;
     }
-    printf("Decoded secret file data successfully.\n");
+    PROGRESS(decInfo->quiet, "Decoded secret file data successfully.\n");
 
-    printf("\n ✅ DECODING COMPLETED SUCCESSFULLY!\n");
+    stats_end(decInfo->stats);
     return e_success;
+}
+
+/*decoding steps */
+Status do_decoding(DecodeInfo *decInfo)
+{
+    PROGRESS(decInfo->quiet, "\n-----DECODING-----\n\n");
+
+    stats_begin(decInfo->stats, e_stage_open);
+    if (open_decode_files(decInfo) == e_failure)
+    {
+        diag_error("Failed to open files.\n");
+        stats_end(decInfo->stats);
+        return e_failure;
+    }
+    PROGRESS(decInfo->quiet, "Opened files successfully.\n");
+
+    Status ret = decode_stages(decInfo);
+    close_decode_files(decInfo);
+    stats_end(decInfo->stats);
+
+    if (ret == e_success)
+        PROGRESS(decInfo->quiet, "\n ✅ DECODING COMPLETED SUCCESSFULLY!\n");
+    return ret;
 }
\ No newline at end of file
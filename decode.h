@@ -2,10 +2,23 @@
 #define DECODE_H
 
 #include <stdio.h>
+#include <stdint.h>
 #include "types.h"
+#include "bmp.h"
+#include "stats.h"
+#include "lsb_kernel.h"
+#include "scatter.h"
+#include "stego.h"
 
 #define MAGIC_STRING "#*"
 
+/* Pixel data slice size limits for the decode buffer */
+#define DECODE_BUF_MIN     (64 * 1024)
+#define DECODE_BUF_MAX     (4 * 1024 * 1024)
+#define DECODE_BUF_DEFAULT (1024 * 1024)
+
+typedef struct LzCursor LzCursor;
+
 typedef struct _DecodeInfo
 {
     char *stego_image_fname;
@@ -14,10 +27,57 @@ typedef struct _DecodeInfo
     FILE *fptr_stego_image;
     FILE *fptr_secret;
 
+    BmpInfo bmp;                 /* parsed by open_decode_files(); alpha-only is detected */
+    uint64_t carrier_pos;        /* carrier bytes consumed so far */
+    uint64_t raw_left;           /* pixel array bytes not yet read */
+    ChannelMode channels;        /* carrier bytes to start with (--alpha) */
+    int stream;                  /* "-" image or output: no seeks, no workers */
+
+    int header_version;          /* STEGO_V1 ("#*") or STEGO_V2 */
+    uint32_t header_flags;
+    int depth;                   /* payload bits per carrier byte, from the flags */
+
     int extn_size;
-    char extn_secret_file[10];
+    char extn_secret_file[STEGO_EXTN_MAX + 1];
+
+    uint64_t size_secret_file;
+
+    /* --range: extract only payload bytes [range_offset, range_offset + range_len) */
+    int range_given;
+    uint64_t range_offset;
+    uint64_t range_len;
+    uint64_t data_start;         /* carrier byte holding payload byte 0 */
+    const char *archive_entry;   /* --file: archive member to extract */
+    const char *key;             /* --key: passphrase of a keyed (scattered) image */
+    ScatterMap scatter;          /* keyed layout, set up once the size is known */
 
-    int size_secret_file;
+    /* Decoded bytes land here instead of the output while set (archive TOC) */
+    unsigned char *out_mem;
+    size_t out_mem_len;
+    struct LzCursor *lz;         /* compressed-secret frame cursor, owned */
+
+    /* CRC32C of secret bytes [0, crc_pos) written so far (STEGO_FLAG_CRC) */
+    uint32_t crc;
+    uint64_t crc_pos;
+    int checksum_failed;         /* the secret did not match its stored checksum */
+    char *archive_dir;           /* temporary sibling a whole archive is extracted into, owned */
+
+    /* Last depth group decoded, already consumed from the carrier */
+    unsigned char tail[LSB_MAX_DEPTH];
+    uint64_t tail_offset;
+    size_t tail_len;
+
+    /* Slice of stego pixel data; header fields and payload are served from it */
+    unsigned char *img_buf;
+    size_t buf_size;
+    size_t buf_len;
+    size_t buf_pos;
+    int buf_owned;               /* img_buf was allocated by open_decode_files() */
+
+    int threads;                 /* data extraction workers (1 = sequential) */
+    int quiet;                   /* suppress progress lines */
+    int probe;                   /* header-only probe: header errors are not printed */
+    Stats *stats;                /* per-stage counters for --stats, or NULL */
 
 } DecodeInfo;
 
@@ -25,13 +85,18 @@ Status read_and_validate_decode_args(char *argv[], DecodeInfo *decInfo);
 Status open_decode_files(DecodeInfo *decInfo);
 
 Status decode_magic_string(DecodeInfo *decInfo);
+Status decode_header_flags(DecodeInfo *decInfo);
 Status decode_secret_file_extn_size(DecodeInfo *decInfo);
 Status decode_secret_file_extn(DecodeInfo *decInfo);
 Status decode_secret_file_size(DecodeInfo *decInfo);
 Status decode_secret_file_data(DecodeInfo *decInfo);
 
+const unsigned char *read_stego_bytes(DecodeInfo *decInfo, size_t n);
+void close_decode_files(DecodeInfo *decInfo);
+
 unsigned char decode_byte_from_lsb(const unsigned char *buffer);
 unsigned int decode_size_from_lsb(const unsigned char *buffer);
+uint64_t decode_size64_from_lsb(const unsigned char *buffer);
 
 
 Status do_decoding(DecodeInfo *decInfo);
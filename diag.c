@@ -0,0 +1,32 @@
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include "diag.h"
+
+/* Capture buffer of the current thread, or NULL */
+static _Thread_local char *capture_buf;
+static _Thread_local size_t capture_len;
+
+void diag_capture(char *buf, size_t len)
+{
+    capture_buf = len > 0 ? buf : NULL;
+    capture_len = len;
+    if (capture_buf != NULL)
+        capture_buf[0] = '\0';
+}
+
+void diag_error(const char *fmt, ...)
+{
+    va_list ap;
+
+    va_start(ap, fmt);
+    if (capture_buf == NULL)
+        vprintf(fmt, ap);
+    else if (capture_buf[0] == '\0')
+    {
+        /* The first error is the cause; later ones only report the failing stage */
+        vsnprintf(capture_buf, capture_len, fmt, ap);
+        capture_buf[strcspn(capture_buf, "\n")] = '\0';
+    }
+    va_end(ap);
+}
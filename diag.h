@@ -0,0 +1,16 @@
+#ifndef DIAG_H
+#define DIAG_H
+
+#include <stddef.h>
+
+/*
+ * Error lines of the encode/decode paths. They go to stdout like the rest
+ * of the CLI output, unless the calling thread is capturing them for a
+ * batch or daemon job, whose JSON result reports the first one instead.
+ */
+void diag_error(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+
+/* Keep this thread's error lines in buf from now on (buf NULL: print them again) */
+void diag_capture(char *buf, size_t len);
+
+#endif
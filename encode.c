@@ -1,58 +1,88 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/fs.h>
 #include "encode.h"
 #include "types.h"
 #include "common.h"
-
-/* Get image size for 24-bit BMP */
-uint get_image_size_for_bmp(FILE *fptr_image)
+#include "lsb_kernel.h"
+#include "parallel.h"
+#include "bmp.h"
+#include "stats.h"
+#include "pipe_io.h"
+#include "lz.h"
+#include "crc32c.h"
+#include "diag.h"
+
+/* Largest payload block embedded per stdio call */
+#define ENCODE_BLOCK_SIZE 1024
+
+/* Get the pixel array size of a BMP (row padding included) */
+uint64_t get_image_size_for_bmp(FILE *fptr_image)
 {
-    uint width, height;
-
-    fseek(fptr_image, 18, SEEK_SET);
-    fread(&width, sizeof(int), 1, fptr_image);
-    printf("Width = %u\n",width);
+    BmpInfo bmp;
 
-    fread(&height, sizeof(int), 1, fptr_image);
-    printf("Height = %u\n",height);
+    if (bmp_read_header(fptr_image, &bmp) == e_failure)
+        return 0;
 
-    return width * height * 3;
+    return bmp.pixel_bytes;
 }
 
 /* Get file size */
-uint get_file_size(FILE *fptr)
+uint64_t get_file_size(FILE *fptr)
 {
-    fseek(fptr, 0, SEEK_END);
-    long size = ftell(fptr);
+    fseeko(fptr, 0, SEEK_END);
+    off_t size = ftello(fptr);
     rewind(fptr);
-    return size;
+    return size < 0 ? 0 : (uint64_t)size;
 }
 
 /* Validate encode arguments */
 Status read_and_validate_encode_args(char *argv[], EncodeInfo *encInfo)
 {
     char *point1 = strrchr(argv[2], '.');
-    if (point1 == NULL || strcmp(point1, ".bmp") != 0)
+    if (!pipe_is_std(argv[2]) && (point1 == NULL || strcmp(point1, ".bmp") != 0))
     {
-        printf("Error! File must end with .bmp\n");
+        diag_error("Error! File must end with .bmp\n");
         return e_failure;
     }
     encInfo->src_image_fname = argv[2];
 
-    char *point2 = strrchr(argv[3], '.');
-    if (point2 == NULL)
+    if (argv[3] == NULL)
     {
-        printf("Error! Secret file must have an extension\n");
+        diag_error("Error! Secret file not provided.\n");
         return e_failure;
     }
+
+    /* The stored extension comes from the name unless --ext already set it */
+    char *point2 = strrchr(argv[3], '.');
+    if (encInfo->extn_secret_file[0] == '\0')
+    {
+        if (point2 == NULL || strchr(point2, '/') != NULL)
+        {
+            diag_error("Error! Secret file must have an extension\n");
+            return e_failure;
+        }
+        if (strlen(point2) >= sizeof(encInfo->extn_secret_file))
+        {
+            diag_error("Error! Secret file extension is too long\n");
+            return e_failure;
+        }
+        strcpy(encInfo->extn_secret_file, point2);
+    }
     encInfo->secret_fname = argv[3];
 
     if (argv[4] != NULL)
     {
         char *point3 = strrchr(argv[4], '.');
-        if (point3 == NULL || strcmp(point3, ".bmp") != 0)
+        if (!pipe_is_std(argv[4]) && (point3 == NULL || strcmp(point3, ".bmp") != 0))
         {
-            printf("Error! Output file must end with .bmp\n");
+            diag_error("Error! Output file must end with .bmp\n");
             return e_failure;
         }
         encInfo->stego_image_fname = argv[4];
@@ -65,63 +95,222 @@ Status read_and_validate_encode_args(char *argv[], EncodeInfo *encInfo)
     return e_success;
 }
 
+/* Validate archive arguments; members are checked when the TOC is built */
+Status read_and_validate_archive_args(int argc, char *argv[], EncodeInfo *encInfo)
+{
+    char *point1 = strrchr(argv[2], '.');
+    if (!pipe_is_std(argv[2]) && (point1 == NULL || strcmp(point1, ".bmp") != 0))
+    {
+        diag_error("Error! File must end with .bmp\n");
+        return e_failure;
+    }
+    encInfo->src_image_fname = argv[2];
+
+    char *point2 = argc > 3 ? strrchr(argv[3], '.') : NULL;
+    if (argc < 4 || (!pipe_is_std(argv[3]) && (point2 == NULL || strcmp(point2, ".bmp") != 0)))
+    {
+        diag_error("Error! Output file must end with .bmp\n");
+        return e_failure;
+    }
+    encInfo->stego_image_fname = argv[3];
+
+    if (argc < 5)
+    {
+        diag_error("Error! No files to archive.\n");
+        return e_failure;
+    }
+    encInfo->archive_files = argv + 4;
+    encInfo->archive_count = argc - 4;
+    strcpy(encInfo->extn_secret_file, ARCHIVE_EXTN);
+
+    return e_success;
+}
+
 /* Open files */
 Status open_files(EncodeInfo *encInfo)
 {
-    encInfo->fptr_src_image = fopen(encInfo->src_image_fname, "r");
+    encInfo->stream = pipe_is_std(encInfo->src_image_fname) || pipe_is_std(encInfo->stego_image_fname);
+
+    if (pipe_is_std(encInfo->src_image_fname))
+        encInfo->fptr_src_image = pipe_stdin();
+    else
+        encInfo->fptr_src_image = fopen(encInfo->src_image_fname, "r");
     if (encInfo->fptr_src_image == NULL)
     {
         perror("fopen");
-        printf("Error! Unable to open file %s\n", encInfo->src_image_fname);
+        diag_error("Error! Unable to open file %s\n", encInfo->src_image_fname);
         return e_failure;
     }
 
-    encInfo->fptr_secret = fopen(encInfo->secret_fname, "r");
-    if (encInfo->fptr_secret == NULL)
+    if (encInfo->io_buf != NULL)
+        setvbuf(encInfo->fptr_src_image, encInfo->io_buf, _IOFBF, ENCODE_IO_BUF_SIZE);
+
+    /*
+     * Parse the header once; capacity, header copy and offsets all use it.
+     * A piped carrier cannot be rewound, so its header is kept for the copy.
+     */
+    Status parsed;
+    if (pipe_is_std(encInfo->src_image_fname))
+        parsed = bmp_read_stream_header(encInfo->fptr_src_image, &encInfo->bmp,
+                                        encInfo->stream_header, sizeof(encInfo->stream_header));
+    else
+        parsed = bmp_read_header(encInfo->fptr_src_image, &encInfo->bmp);
+
+    if (parsed == e_failure || bmp_select_channels(&encInfo->bmp, encInfo->channels) == e_failure)
+    {
+        diag_error("Error! %s: %s\n", encInfo->src_image_fname, encInfo->bmp.error);
+        return e_failure;
+    }
+
+    /* v1 keeps the original layout: every byte after a 54-byte header, row padding included */
+    if (encInfo->header_version == STEGO_V1 && encInfo->channels == e_channels_all)
+    {
+        if (encInfo->bmp.data_offset != BMP_V1_DATA_OFFSET)
+        {
+            diag_error("Error! %s: the v1 header needs a carrier with a 54-byte BMP header.\n",
+                       encInfo->src_image_fname);
+            return e_failure;
+        }
+        bmp_select_v1_layout(&encInfo->bmp);
+    }
+
+    if (encInfo->archive_count > 0)
+    {
+        if (archive_source_open(&encInfo->archive, encInfo->archive_files, encInfo->archive_count,
+                                encInfo->stats) == e_failure)
+            return e_failure;
+    }
+    else if ((encInfo->fptr_secret = fopen(encInfo->secret_fname, "r")) == NULL)
     {
         perror("fopen");
-        printf("Error! Unable to open file %s\n", encInfo->secret_fname);
+        diag_error("Error! Unable to open file %s\n", encInfo->secret_fname);
         return e_failure;
     }
 
-    encInfo->fptr_stego_image = fopen(encInfo->stego_image_fname, "w");
+    return e_success;
+}
+
+/* Create the stego image; only once the secret is known to fit, so a refused encode keeps an old output */
+static Status open_stego_image(EncodeInfo *encInfo)
+{
+    if (pipe_is_std(encInfo->stego_image_fname))
+        encInfo->fptr_stego_image = pipe_stdout();
+    else
+        encInfo->fptr_stego_image = fopen(encInfo->stego_image_fname, "w");
     if (encInfo->fptr_stego_image == NULL)
     {
         perror("fopen");
-        printf("Error! Unable to open file %s\n", encInfo->stego_image_fname);
+        diag_error("Error! Unable to open file %s\n", encInfo->stego_image_fname);
         return e_failure;
     }
 
+    if (encInfo->io_buf != NULL)
+        setvbuf(encInfo->fptr_stego_image, encInfo->io_buf + ENCODE_IO_BUF_SIZE, _IOFBF, ENCODE_IO_BUF_SIZE);
+
     return e_success;
 }
 
+/* Close whatever open_files() managed to open; fails if the stego image did not flush */
+Status close_files(EncodeInfo *encInfo)
+{
+    Status ret = e_success;
+
+    if (encInfo->fptr_src_image != NULL)
+        fclose(encInfo->fptr_src_image);
+    if (encInfo->fptr_secret != NULL)
+        fclose(encInfo->fptr_secret);
+    if (encInfo->archive_count > 0)
+        archive_source_close(&encInfo->archive);
+    if (encInfo->fptr_stego_image != NULL && fclose(encInfo->fptr_stego_image) != 0)
+        ret = e_failure;
+
+    if (!encInfo->aio_shared)
+        aio_destroy(encInfo->aio_queue);
+
+    encInfo->fptr_src_image = NULL;
+    encInfo->fptr_secret = NULL;
+    encInfo->fptr_stego_image = NULL;
+    encInfo->aio_queue = NULL;
+    return ret;
+}
+
 /* Check image capacity */
 Status check_capacity(EncodeInfo *encInfo)
 {
-    long image_capacity = get_image_size_for_bmp(encInfo->fptr_src_image);
-    long file_size = get_file_size(encInfo->fptr_secret);
-    long total_bytes = 16 + 32 + 32 + 32 + (8 * file_size);
+    uint64_t file_size = encInfo->size_secret_file;
+    uint64_t total_bytes = stego_header_bytes(encInfo->header_version, strlen(encInfo->extn_secret_file));
+
+    uint64_t payload = file_size + (encInfo->checksum ? CRC32C_BYTES : 0);
+
+    /* A compressed secret's size is only known once embedded; the data stage checks it */
+    if (!encInfo->compress)
+        total_bytes += encInfo->key != NULL ? 8 * scatter_groups(payload, encInfo->depth)
+                                            : lsb_carrier_bytes(payload, encInfo->depth);
+
+    encInfo->image_capacity = encInfo->bmp.carrier_bytes;
+
+    if (encInfo->header_version == STEGO_V1 && file_size > UINT32_MAX)
+    {
+        diag_error("Error! Secret file too large for the v1 header.\n");
+        return e_failure;
+    }
+
+    if (encInfo->header_version == STEGO_V1 && encInfo->compress)
+    {
+        diag_error("Error! The v1 header does not support compression.\n");
+        return e_failure;
+    }
+
+    if (encInfo->header_version == STEGO_V1 && encInfo->checksum)
+    {
+        diag_error("Error! The v1 header does not support checksums.\n");
+        return e_failure;
+    }
+
+    if (encInfo->header_version == STEGO_V1 && encInfo->key != NULL)
+    {
+        diag_error("Error! The v1 header does not support keyed embedding.\n");
+        return e_failure;
+    }
+
+    if (encInfo->header_version == STEGO_V1 && encInfo->archive_count > 0)
+    {
+        diag_error("Error! The v1 header does not support archives.\n");
+        return e_failure;
+    }
 
-    if (image_capacity > total_bytes)
+    if (encInfo->header_version == STEGO_V1 && encInfo->depth != 1)
+    {
+        diag_error("Error! The v1 header only supports 1-bit embedding.\n");
+        return e_failure;
+    }
+
+    if (encInfo->image_capacity >= total_bytes)
         return e_success;
     else
         return e_failure;
 }
 
-/* Copy BMP header */
-Status copy_bmp_header(FILE *fptr_src_image, FILE *fptr_dest_image)
+/* Copy BMP header (everything before the pixel array) */
+Status copy_bmp_header(FILE *fptr_src_image, FILE *fptr_dest_image, uint32_t header_size, Stats *stats)
 {
-    unsigned char image_buffer[54];
+    unsigned char image_buffer[1024];
     rewind(fptr_src_image);
 
-    if (fread(image_buffer, 1, 54, fptr_src_image) != 54)
+    while (header_size > 0)
     {
-        return e_failure;
-    }
+        size_t n = header_size < sizeof(image_buffer) ? header_size : sizeof(image_buffer);
 
-    if (fwrite(image_buffer, 1, 54, fptr_dest_image) != 54)
-    {
-        return e_failure;
+        if (stats_fread(stats, image_buffer, n, fptr_src_image) != n)
+        {
+            return e_failure;
+        }
+
+        if (stats_fwrite(stats, image_buffer, n, fptr_dest_image) != n)
+        {
+            return e_failure;
+        }
+        header_size -= n;
     }
 
     return e_success;
@@ -130,211 +319,971 @@ Status copy_bmp_header(FILE *fptr_src_image, FILE *fptr_dest_image)
 /* Encode byte into LSBs */
 Status encode_byte_to_lsb(char data, unsigned char *image_buffer)
 {
-    for (int i = 0; i < 8; i++)
-    {
-        int bit = (data >> (7 - i)) & 1;
-        image_buffer[i] = (image_buffer[i] & 0xFE) | bit;
-    }
+    lsb_embed_scalar((const unsigned char *)&data, 1, image_buffer);
     return e_success;
 }
 
-/* Encode 32-bit size */
+/* Encode 32-bit size (MSB first) */
 Status encode_size_to_lsb(unsigned int size, unsigned char *imageBuffer)
 {
-    for (int i = 0; i < 32; i++)
+    unsigned char bytes[4] = {
+        (unsigned char)(size >> 24), (unsigned char)(size >> 16),
+        (unsigned char)(size >> 8), (unsigned char)size
+    };
+
+    lsb_embed_block(bytes, 4, imageBuffer);
+    return e_success;
+}
+
+/* Encode 64-bit size (MSB first) */
+Status encode_size64_to_lsb(uint64_t size, unsigned char *imageBuffer)
+{
+    unsigned char bytes[8];
+
+    for (int i = 7; i >= 0; i--, size >>= 8)
+        bytes[i] = (unsigned char)size;
+
+    lsb_embed_block(bytes, 8, imageBuffer);
+    return e_success;
+}
+
+/*
+ * Embed up to ENCODE_BLOCK_SIZE payload bytes at the given depth into the
+ * next carrier bytes: read the pixels that hold them, embed, write back.
+ */
+static Status embed_stream(EncodeInfo *encInfo, const unsigned char *bytes, size_t len, int depth)
+{
+    unsigned char raw[4 * 8 * ENCODE_BLOCK_SIZE];
+    unsigned char packed[8 * ENCODE_BLOCK_SIZE];
+    const BmpInfo *bmp = &encInfo->bmp;
+    size_t carrier_len = (size_t)lsb_carrier_bytes(len, depth);
+
+    if (len > ENCODE_BLOCK_SIZE || encInfo->carrier_pos + carrier_len > bmp->carrier_bytes)
+        return e_failure;
+
+    /* Row padding inside the span is read and written back untouched */
+    size_t raw_len = (size_t)bmp_raw_span(bmp, encInfo->carrier_pos, carrier_len);
+    if (stats_fread(encInfo->stats, raw, raw_len, encInfo->fptr_src_image) != raw_len)
+        return e_failure;
+
+    if (bmp_contiguous(bmp))
+        lsb_embed_depth(bytes, len, raw, depth);
+    else
     {
-        int bit = (size >> (31 - i)) & 1;
-        imageBuffer[i] = (imageBuffer[i] & 0xFE) | bit;
+        bmp_gather(bmp, raw, encInfo->carrier_pos, carrier_len, packed);
+        lsb_embed_depth(bytes, len, packed, depth);
+        bmp_scatter(bmp, packed, encInfo->carrier_pos, carrier_len, raw);
     }
 
+    if (stats_fwrite(encInfo->stats, raw, raw_len, encInfo->fptr_stego_image) != raw_len)
+        return e_failure;
+
+    encInfo->carrier_pos += carrier_len;
     return e_success;
 }
 
-/* Encode magic string */
-Status encode_magic_string(const char *magic_string, EncodeInfo *encInfo)
+/*
+ * Keyed layout: embed up to ENCODE_BLOCK_SIZE payload bytes into their
+ * scattered groups. The carrier is still swept in order, one window at a
+ * time; the bytes between groups are copied through with it.
+ */
+static Status embed_scattered(EncodeInfo *encInfo, const unsigned char *bytes, size_t len)
 {
-    unsigned char image_buffer[8];
+    unsigned char raw[4 * 8 * ENCODE_BLOCK_SIZE];
+    unsigned char packed[8 * ENCODE_BLOCK_SIZE];
+    const ScatterMap *map = &encInfo->scatter;
+    const BmpInfo *bmp = &encInfo->bmp;
+    int depth = encInfo->depth;
+    uint64_t g = encInfo->payload_pos / depth;
+    uint64_t left = scatter_groups(len, depth);
+
+    if (len > ENCODE_BLOCK_SIZE || g + left > map->groups)
+        return e_failure;
 
-    for (int i = 0; i < strlen(magic_string); i++)
+    uint64_t end = left > 0 ? scatter_pos(map, g + left - 1) + 8 : encInfo->carrier_pos;
+    while (encInfo->carrier_pos < end)
     {
-        if (fread(image_buffer, 1, 8, encInfo->fptr_src_image) != 8)
+        uint64_t limit;
+        size_t n = scatter_window(map, g, left, encInfo->carrier_pos, end, bmp_carrier_window(bmp, sizeof(raw)),
+                                  &limit);
+        size_t raw_len = (size_t)bmp_raw_span(bmp, encInfo->carrier_pos, limit - encInfo->carrier_pos);
+        size_t take = n * depth < len ? n * depth : len;
+
+        if (stats_fread(encInfo->stats, raw, raw_len, encInfo->fptr_src_image) != raw_len)
             return e_failure;
 
-        encode_byte_to_lsb(magic_string[i], image_buffer);
+        scatter_gather(map, bmp, raw, encInfo->carrier_pos, g, n, packed);
+        lsb_embed_depth(bytes, take, packed, depth);
+        scatter_put(map, bmp, packed, encInfo->carrier_pos, g, n, raw);
 
-        if (fwrite(image_buffer, 1, 8, encInfo->fptr_stego_image) != 8)
+        if (stats_fwrite(encInfo->stats, raw, raw_len, encInfo->fptr_stego_image) != raw_len)
             return e_failure;
-    }
 
+        encInfo->carrier_pos = limit;
+        g += n;
+        left -= n;
+        bytes += take;
+        len -= take;
+    }
     return e_success;
 }
 
+/* Embed the next payload bytes at the data depth, contiguous or keyed */
+static Status embed_payload(EncodeInfo *encInfo, const unsigned char *bytes, size_t len)
+{
+    Status ret = encInfo->key != NULL ? embed_scattered(encInfo, bytes, len)
+                                      : embed_stream(encInfo, bytes, len, encInfo->depth);
+
+    encInfo->payload_pos += len;
+    return ret;
+}
+
+/* Whether len more payload bytes still fit the carrier */
+static int payload_fits(const EncodeInfo *encInfo, size_t len)
+{
+    if (encInfo->key != NULL)
+        return scatter_groups(encInfo->payload_pos + len, encInfo->depth) <= encInfo->scatter.groups;
+    return encInfo->carrier_pos + lsb_carrier_bytes(len, encInfo->depth) <= encInfo->bmp.carrier_bytes;
+}
+
+/* Embed a short header field (magic / extension / size) in one block */
+static Status encode_bytes(const unsigned char *bytes, size_t len, EncodeInfo *encInfo)
+{
+    return embed_stream(encInfo, bytes, len, 1);
+}
+
+/* Encode magic string */
+Status encode_magic_string(const char *magic_string, EncodeInfo *encInfo)
+{
+    return encode_bytes((const unsigned char *)magic_string, strlen(magic_string), encInfo);
+}
+
+/* Encode v2 header flags */
+Status encode_header_flags(uint32_t flags, EncodeInfo *encInfo)
+{
+    unsigned char bytes[4];
+
+    stego_put_be(bytes, flags, 4);
+    return encode_bytes(bytes, sizeof(bytes), encInfo);
+}
+
 /* Encode secret file extension size */
 Status encode_secret_file_extn_size(int size, EncodeInfo *encInfo)
 {
-    unsigned char image_buffer[32];
+    unsigned char bytes[4];
+
+    stego_put_be(bytes, (uint32_t)size, 4);
+    return encode_bytes(bytes, sizeof(bytes), encInfo);
+}
+
+/* Encode secret file extension */
+Status encode_secret_file_extn(const char *file_extn, EncodeInfo *encInfo)
+{
+    return encode_bytes((const unsigned char *)file_extn, strlen(file_extn), encInfo);
+}
 
-    if (fread(image_buffer, 1, 32, encInfo->fptr_src_image) != 32)
+/* Encode secret file size (32 bits in v1, 64 bits in v2) */
+Status encode_secret_file_size(uint64_t file_size, EncodeInfo *encInfo)
+{
+    unsigned char bytes[8];
+    int len = encInfo->header_version == STEGO_V1 ? 4 : 8;
+
+    stego_put_be(bytes, file_size, len);
+    return encode_bytes(bytes, len, encInfo);
+}
+
+/* Positional state shared by the data-embedding workers */
+typedef struct
+{
+    int src_fd;
+    int secret_fd;
+    int stego_fd;
+    const BmpInfo *bmp;
+    uint64_t carrier_start;     /* carrier byte holding payload byte 0 */
+    int depth;
+    Stats *stats;
+    uint64_t chunk;
+    uint32_t *crcs;             /* CRC32C per chunk, combined in order afterwards, or NULL */
+    const ScatterMap *scatter;  /* keyed layout, or NULL */
+    uint64_t groups;            /* payload groups in all */
+} EmbedJob;
+
+/* Raw bytes a keyed worker moves per positional read/write */
+#define SCATTER_WINDOW (1024 * 1024)
+
+/*
+ * Keyed layout: a chunk owns the carrier bytes from its first group up to
+ * the next chunk's (the first one from the end of the header), gaps
+ * included, and sweeps them a window at a time.
+ */
+static Status embed_chunk_scattered(EmbedJob *job, uint64_t start, uint64_t len, const unsigned char *secret)
+{
+    const ScatterMap *map = job->scatter;
+    const BmpInfo *bmp = job->bmp;
+    uint64_t g = start / job->depth;
+    uint64_t left = scatter_groups(len, job->depth);
+    uint64_t w = g == 0 ? job->carrier_start : scatter_pos(map, g);
+    uint64_t end = g + left < job->groups ? scatter_pos(map, g + left) : scatter_pos(map, g + left - 1) + 8;
+    unsigned char *raw = malloc(2 * SCATTER_WINDOW);
+    unsigned char *packed = raw + SCATTER_WINDOW;
+    Status ret = e_success;
+
+    if (raw == NULL)
         return e_failure;
 
-    encode_size_to_lsb(size, image_buffer);
+    while (w < end && ret == e_success)
+    {
+        uint64_t limit;
+        size_t n = scatter_window(map, g, left, w, end, bmp_carrier_window(bmp, SCATTER_WINDOW), &limit);
+        size_t raw_len = (size_t)bmp_raw_span(bmp, w, limit - w);
+        size_t take = n * job->depth < len ? n * job->depth : (size_t)len;
+        off_t off = (off_t)bmp_pixel_offset(bmp, w);
+
+        ret = pread_full(job->src_fd, raw, raw_len, off);
+        if (ret == e_success)
+        {
+            stats_add_read(job->stats, raw_len);
+            scatter_gather(map, bmp, raw, w, g, n, packed);
+            lsb_embed_depth(secret, take, packed, job->depth);
+            scatter_put(map, bmp, packed, w, g, n, raw);
+            ret = pwrite_full(job->stego_fd, raw, raw_len, off);
+            stats_add_write(job->stats, raw_len);
+        }
 
-    if (fwrite(image_buffer, 1, 32, encInfo->fptr_stego_image) != 32)
+        w = limit;
+        g += n;
+        left -= n;
+        secret += take;
+        len -= take;
+    }
+
+    free(raw);
+    return ret;
+}
+
+/* Embed payload bytes [start, start + len) with positional reads/writes */
+static Status embed_chunk(void *ctx, int worker, uint64_t start, uint64_t len)
+{
+    EmbedJob *job = ctx;
+    const BmpInfo *bmp = job->bmp;
+    size_t carrier_len = (size_t)lsb_carrier_bytes(len, job->depth);
+    uint64_t first = job->carrier_start + lsb_carrier_bytes(start, job->depth);
+    size_t raw_len = (size_t)bmp_raw_span(bmp, first, carrier_len);
+    unsigned char *secret = malloc(len + raw_len + carrier_len);
+    unsigned char *raw = secret + len;
+    unsigned char *packed = raw + raw_len;
+    off_t off = (off_t)bmp_pixel_offset(bmp, first);
+    Status ret = e_failure;
+
+    (void)worker;
+    if (secret == NULL)
         return e_failure;
 
+    if (job->scatter != NULL)
+    {
+        if (pread_full(job->secret_fd, secret, len, (off_t)start) == e_success)
+        {
+            stats_add_read(job->stats, len);
+            if (job->crcs != NULL)
+                job->crcs[start / job->chunk] = crc32c_update(0, secret, len);
+            ret = embed_chunk_scattered(job, start, len, secret);
+        }
+        free(secret);
+        return ret;
+    }
+
+    if (pread_full(job->secret_fd, secret, len, (off_t)start) == e_success &&
+        pread_full(job->src_fd, raw, raw_len, off) == e_success)
+    {
+        stats_add_read(job->stats, len);
+        stats_add_read(job->stats, raw_len);
+        if (job->crcs != NULL)
+            job->crcs[start / job->chunk] = crc32c_update(0, secret, len);
+        bmp_gather(bmp, raw, first, carrier_len, packed);
+        lsb_embed_depth(secret, len, packed, job->depth);
+        bmp_scatter(bmp, packed, first, carrier_len, raw);
+        ret = pwrite_full(job->stego_fd, raw, raw_len, off);
+        stats_add_write(job->stats, raw_len);
+    }
+
+    free(secret);
+    return ret;
+}
+
+/* Embed the CRC32C after the secret; tail holds the secret bytes of its last, partial depth group */
+static Status encode_checksum(EncodeInfo *encInfo, unsigned char *tail, size_t tail_len)
+{
+    stego_put_be(tail + tail_len, encInfo->crc, CRC32C_BYTES);
+    if (embed_payload(encInfo, tail, tail_len + CRC32C_BYTES) == e_failure)
+    {
+        diag_error("Error! Failed to encode the checksum.\n");
+        return e_failure;
+    }
     return e_success;
 }
 
-/* Encode secret file extension */
-Status encode_secret_file_extn(const char *file_extn, EncodeInfo *encInfo)
+/* Encode secret file data from encInfo->threads workers */
+static Status encode_secret_file_data_parallel(EncodeInfo *encInfo)
 {
-    unsigned char image_buffer[8];
+    EmbedJob job;
+    uint64_t size = encInfo->size_secret_file;
+    uint64_t carrier_len = lsb_carrier_bytes(size, encInfo->depth);
+    size_t tail_len = 0;
+    unsigned char tail[LSB_MAX_DEPTH + CRC32C_BYTES];
 
-    for (int i = 0; i < strlen(file_extn); i++)
+    if (fflush(encInfo->fptr_stego_image) != 0)
+        return e_failure;
+
+    job.src_fd = fileno(encInfo->fptr_src_image);
+    job.secret_fd = fileno(encInfo->fptr_secret);
+    job.stego_fd = fileno(encInfo->fptr_stego_image);
+    job.bmp = &encInfo->bmp;
+    job.carrier_start = encInfo->carrier_pos;
+    job.depth = encInfo->depth;
+    job.stats = encInfo->stats;
+    job.chunk = stego_chunk_size(PARALLEL_CHUNK, job.depth);
+    job.scatter = encInfo->key != NULL ? &encInfo->scatter : NULL;
+    job.groups = scatter_groups(size, job.depth);
+    job.crcs = encInfo->checksum ? malloc((size / job.chunk + 1) * sizeof(*job.crcs)) : NULL;
+    if (encInfo->checksum && job.crcs == NULL)
     {
-        if (fread(image_buffer, 1, 8, encInfo->fptr_src_image) != 8)
-            return e_failure;
+        diag_error("Error! Unable to allocate checksum table.\n");
+        return e_failure;
+    }
 
-        encode_byte_to_lsb(file_extn[i], image_buffer);
+    Status ret = parallel_for_chunks(encInfo->threads, size, job.chunk, embed_chunk, &job);
 
-        if (fwrite(image_buffer, 1, 8, encInfo->fptr_stego_image) != 8)
+    /* Chunk CRCs fold into the running one in order */
+    for (uint64_t start = 0; start < size && job.crcs != NULL && ret == e_success; start += job.chunk)
+        encInfo->crc = crc32c_combine(encInfo->crc, job.crcs[start / job.chunk],
+                                      size - start < job.chunk ? size - start : job.chunk);
+    free(job.crcs);
+    if (ret == e_failure)
+        return e_failure;
+
+    /* The checksum is embedded again over the secret's last partial depth group */
+    if (encInfo->checksum)
+    {
+        tail_len = size % encInfo->depth;
+        carrier_len = size / encInfo->depth * 8;
+        if (tail_len > 0 && pread_full(job.secret_fd, tail, tail_len, (off_t)(size - tail_len)) == e_failure)
             return e_failure;
     }
+    encInfo->payload_pos = size - tail_len;
+
+    /* Keyed: carry on from that group, or from the end of the last one */
+    if (job.scatter != NULL && tail_len > 0)
+        carrier_len = scatter_pos(job.scatter, job.groups - 1) - encInfo->carrier_pos;
+    else if (job.scatter != NULL && job.groups > 0)
+        carrier_len = scatter_pos(job.scatter, job.groups - 1) + 8 - encInfo->carrier_pos;
+
+    /* Leave both image streams just past the payload for the tail copy */
+    encInfo->carrier_pos += carrier_len;
+    off_t end = (off_t)bmp_pixel_offset(&encInfo->bmp, encInfo->carrier_pos);
+    if (fseeko(encInfo->fptr_src_image, end, SEEK_SET) != 0 ||
+        fseeko(encInfo->fptr_stego_image, end, SEEK_SET) != 0)
+        return e_failure;
 
-    return e_success;
+    return encInfo->checksum ? encode_checksum(encInfo, tail, tail_len) : e_success;
+}
+
+/* Next n secret bytes: from the secret file, or the archive TOC and members */
+static size_t read_secret(EncodeInfo *encInfo, unsigned char *buf, size_t n)
+{
+    size_t got = encInfo->archive_count > 0 ? archive_source_read(&encInfo->archive, buf, n)
+                                            : stats_fread(encInfo->stats, buf, n, encInfo->fptr_secret);
+
+    /* Checksummed while the block is hot, on its way to the embed kernel */
+    if (encInfo->checksum)
+        encInfo->crc = crc32c_update(encInfo->crc, buf, got);
+    return got;
+}
+
+/*
+ * Queue for the overlapped data and tail stages, or NULL when they run on
+ * stdio: --aio off, or an image that is a pipe. Both image streams are
+ * flushed so positional I/O can take over from the current offset.
+ */
+static AioQueue *overlap_queue(EncodeInfo *encInfo)
+{
+    if (encInfo->aio == e_aio_off || encInfo->stream || !pipe_is_seekable(encInfo->fptr_src_image) ||
+        !pipe_is_seekable(encInfo->fptr_stego_image) || fflush(encInfo->fptr_stego_image) != 0)
+        return NULL;
+
+    if (encInfo->aio_queue == NULL)
+    {
+        encInfo->aio_queue = aio_create(encInfo->aio, 2 * AIO_DEPTH);
+        if (encInfo->aio_queue == NULL)
+        {
+            if (encInfo->aio == e_aio_uring)
+                diag_error("Error! io_uring is not available here; continuing with stdio.\n");
+            encInfo->aio = e_aio_off;
+            return NULL;
+        }
+        PROGRESS(encInfo->quiet, "Overlapped I/O through %s.\n", aio_backend(encInfo->aio_queue));
+    }
+    return encInfo->aio_queue;
+}
+
+/* Carry both image streams on from file offset pos after positional I/O */
+static Status overlap_done(EncodeInfo *encInfo, uint64_t pos)
+{
+    return fseeko(encInfo->fptr_src_image, (off_t)pos, SEEK_SET) == 0 &&
+           fseeko(encInfo->fptr_stego_image, (off_t)pos, SEEK_SET) == 0 ? e_success : e_failure;
 }
 
-/* Encode secret file size */
-Status encode_secret_file_size(long file_size, EncodeInfo *encInfo)
+/* Payload source of an overlapped data stage: the secret, then its checksum */
+typedef struct
 {
-    unsigned char image_buffer[32];
+    EncodeInfo *encInfo;
+    uint64_t total;             /* payload bytes: secret plus trailer */
+    uint64_t done;
+    unsigned char *payload;     /* one window's payload bytes */
+    unsigned char *packed;      /* one window's carrier bytes, for alpha-only images */
+    uint64_t carrier;           /* carrier byte the next window starts with */
+} OverlapJob;
+
+/* aio_stream() callback: embed the payload bytes this window of pixels holds */
+static Status embed_window(void *ctx, unsigned char *buf, size_t len, uint64_t offset)
+{
+    OverlapJob *job = ctx;
+    EncodeInfo *encInfo = job->encInfo;
+    const BmpInfo *bmp = &encInfo->bmp;
+    uint64_t size = encInfo->size_secret_file;
+    size_t carrier_len = len / bmp->carrier_stride;
+    size_t n = (size_t)(carrier_len * encInfo->depth / 8);
+    size_t from_secret = 0;
+
+    (void)offset;
+    if (n > job->total - job->done)
+        n = (size_t)(job->total - job->done);
+    if (job->done < size)
+        from_secret = size - job->done < n ? (size_t)(size - job->done) : n;
+
+    if (read_secret(encInfo, job->payload, from_secret) != from_secret)
+    {
+        diag_error("Error! Secret file ended before %llu bytes\n", (unsigned long long)size);
+        return e_failure;
+    }
+
+    /* The checksum is known once the secret's last byte has been read */
+    if (from_secret < n)
+    {
+        unsigned char crc[CRC32C_BYTES];
+
+        stego_put_be(crc, encInfo->crc, CRC32C_BYTES);
+        memcpy(job->payload + from_secret, crc + (job->done + from_secret - size), n - from_secret);
+    }
 
-    if (fread(image_buffer, 1, 32, encInfo->fptr_src_image) != 32)
+    if (bmp->carrier_stride == 1)
+        lsb_embed_depth(job->payload, n, buf, encInfo->depth);
+    else
+    {
+        bmp_gather(bmp, buf, job->carrier, carrier_len, job->packed);
+        lsb_embed_depth(job->payload, n, job->packed, encInfo->depth);
+        bmp_scatter(bmp, job->packed, job->carrier, carrier_len, buf);
+    }
+    job->carrier += carrier_len;
+
+    job->done += n;
+    return e_success;
+}
+
+/*
+ * Embed the whole payload through the overlapped pipeline: image windows
+ * are read ahead and written behind while the current one is embedded.
+ */
+static Status encode_secret_file_data_overlapped(EncodeInfo *encInfo, AioQueue *q)
+{
+    const BmpInfo *bmp = &encInfo->bmp;
+    OverlapJob job = { encInfo, encInfo->size_secret_file + (encInfo->checksum ? CRC32C_BYTES : 0), 0, NULL, NULL,
+                       encInfo->carrier_pos };
+    uint64_t carrier_len = lsb_carrier_bytes(job.total, encInfo->depth);
+    uint64_t start = bmp_pixel_offset(bmp, encInfo->carrier_pos);
+    uint64_t end = start + bmp_raw_span(bmp, encInfo->carrier_pos, carrier_len);
+
+    unsigned char *owned = encInfo->aio_buf == NULL ? malloc(ENCODE_AIO_BUF_SIZE) : NULL;
+    unsigned char *bufs = encInfo->aio_buf != NULL ? encInfo->aio_buf : owned;
+    if (bufs == NULL)
         return e_failure;
+    job.payload = bufs + (size_t)AIO_DEPTH * AIO_WINDOW;
+    job.packed = job.payload + AIO_WINDOW / 8 * LSB_MAX_DEPTH;
 
-    encode_size_to_lsb((unsigned int)file_size, image_buffer);
+    Status ret = aio_stream(q, fileno(encInfo->fptr_src_image), fileno(encInfo->fptr_stego_image), start, end,
+                            AIO_WINDOW, bufs, embed_window, &job, encInfo->stats);
+    free(owned);
 
-    if (fwrite(image_buffer, 1, 32, encInfo->fptr_stego_image) != 32)
+    encInfo->carrier_pos += carrier_len;
+    encInfo->payload_pos = job.total;
+    return ret == e_success ? overlap_done(encInfo, end) : e_failure;
+}
+
+/* Compressed bytes are staged here so each embed call covers whole depth groups */
+typedef struct
+{
+    EncodeInfo *encInfo;
+    unsigned char buf[ENCODE_BLOCK_SIZE];
+    size_t len;
+    size_t block;
+    uint64_t total;
+} PayloadWriter;
+
+static Status payload_write_block(PayloadWriter *w)
+{
+    EncodeInfo *encInfo = w->encInfo;
+
+    if (!payload_fits(encInfo, w->len))
+    {
+        diag_error("Error! Compressed secret does not fit in the image.\n");
         return e_failure;
+    }
+    if (embed_payload(encInfo, w->buf, w->len) == e_failure)
+        return e_failure;
+
+    w->total += w->len;
+    w->len = 0;
+    return e_success;
+}
 
+static Status payload_write(PayloadWriter *w, const unsigned char *bytes, size_t n)
+{
+    while (n > 0)
+    {
+        size_t take = w->block - w->len < n ? w->block - w->len : n;
+
+        memcpy(w->buf + w->len, bytes, take);
+        w->len += take;
+        bytes += take;
+        n -= take;
+        if (w->len == w->block && payload_write_block(w) == e_failure)
+            return e_failure;
+    }
     return e_success;
 }
 
-/* Encode secret file data */
+/* Compress the secret one LZ_BLOCK at a time and embed the frames as they come */
+static Status encode_secret_file_data_lz(EncodeInfo *encInfo)
+{
+    PayloadWriter w = { encInfo, {0}, 0, stego_chunk_size(ENCODE_BLOCK_SIZE, encInfo->depth), 0 };
+    unsigned char *raw = malloc(LZ_BLOCK + LZ_FRAME_MAX);
+    unsigned char *frame = raw + LZ_BLOCK;
+    uint64_t remaining = encInfo->size_secret_file;
+    Status ret = e_success;
+
+    if (raw == NULL)
+    {
+        diag_error("Error! Unable to allocate compression buffers.\n");
+        return e_failure;
+    }
+
+    while (remaining > 0 && ret == e_success)
+    {
+        size_t n = remaining < LZ_BLOCK ? (size_t)remaining : LZ_BLOCK;
+
+        if (read_secret(encInfo, raw, n) != n)
+        {
+            diag_error("Error! Secret file ended before %llu bytes\n", (unsigned long long)encInfo->size_secret_file);
+            ret = e_failure;
+            break;
+        }
+        ret = payload_write(&w, frame, lz_frame_encode(raw, n, frame));
+        remaining -= n;
+    }
+
+    if (ret == e_success && encInfo->checksum)
+    {
+        unsigned char crc[CRC32C_BYTES];
+
+        stego_put_be(crc, encInfo->crc, CRC32C_BYTES);
+        ret = payload_write(&w, crc, sizeof(crc));
+    }
+    if (ret == e_success && w.len > 0)
+        ret = payload_write_block(&w);
+    if (ret == e_success)
+        PROGRESS(encInfo->quiet, "Compressed secret %llu -> %llu bytes\n",
+                 (unsigned long long)encInfo->size_secret_file, (unsigned long long)w.total);
+
+    free(raw);
+    return ret;
+}
+
+/* Encode secret file data, one block of secret_data at a time */
 Status encode_secret_file_data(EncodeInfo *encInfo)
 {
-    unsigned char image_buffer[8];
-    unsigned char ch;
+    size_t block = stego_chunk_size(sizeof(encInfo->secret_data), encInfo->depth);
+    uint64_t remaining = encInfo->size_secret_file;
+    unsigned char tail[LSB_MAX_DEPTH + CRC32C_BYTES];
+    size_t tail_len = 0;
+
+    /* Keyed: the groups are dealt over whatever follows the header */
+    if (encInfo->key != NULL &&
+        scatter_init(&encInfo->scatter, scatter_seed(encInfo->key), encInfo->carrier_pos, encInfo->bmp.carrier_bytes,
+                     encInfo->size_secret_file, encInfo->compress, encInfo->checksum, encInfo->depth) == e_failure)
+    {
+        diag_error("Error! The secret does not fit the keyed layout.\n");
+        return e_failure;
+    }
+
+    if (encInfo->compress)
+        return encode_secret_file_data_lz(encInfo);
+
+    /* Workers need positional I/O on all three files */
+    if (encInfo->threads > 1 && encInfo->size_secret_file >= PARALLEL_MIN_PAYLOAD &&
+        !encInfo->stream && encInfo->archive_count == 0 && pipe_is_seekable(encInfo->fptr_secret))
+        return encode_secret_file_data_parallel(encInfo);
+
+    /* Fixed raw windows cannot keep depth groups whole across row padding */
+    int unpadded = encInfo->bmp.row_stride == encInfo->bmp.row_carrier * encInfo->bmp.carrier_stride;
+    AioQueue *q = encInfo->key == NULL && unpadded ? overlap_queue(encInfo) : NULL;
+    if (q != NULL)
+        return encode_secret_file_data_overlapped(encInfo, q);
 
-    while (fread(&ch, 1, 1, encInfo->fptr_secret) == 1)
+    /* Exactly size_secret_file bytes: a pipe may hold more, a short one is an error */
+    while (remaining > 0)
     {
-        if (fread(image_buffer, 1, 8, encInfo->fptr_src_image) != 8)
-            return e_failure;
+        size_t n = remaining < block ? (size_t)remaining : block;
 
-        encode_byte_to_lsb(ch, image_buffer);
+        if (read_secret(encInfo, encInfo->secret_data, n) != n)
+        {
+            diag_error("Error! Secret file ended before %llu bytes\n", (unsigned long long)encInfo->size_secret_file);
+            return e_failure;
+        }
+        remaining -= n;
 
-        if (fwrite(image_buffer, 1, 8, encInfo->fptr_stego_image) != 8)
+        /* The checksum shares the secret's last depth group: hold back its bytes */
+        if (remaining == 0 && encInfo->checksum)
+        {
+            tail_len = n % encInfo->depth;
+            n -= tail_len;
+            memcpy(tail, encInfo->secret_data + n, tail_len);
+        }
+        if (embed_payload(encInfo, encInfo->secret_data, n) == e_failure)
             return e_failure;
     }
 
-    return e_success;
+    return encInfo->checksum ? encode_checksum(encInfo, tail, tail_len) : e_success;
 }
 
 /* Copy remaining bytes */
-Status copy_remaining_img_data(FILE *fptr_src, FILE *fptr_dest)
+Status copy_remaining_img_data(FILE *fptr_src, FILE *fptr_dest, Stats *stats)
 {
-    unsigned char buffer[1024];
+    unsigned char *buffer = malloc(ENCODE_TAIL_BUF_SIZE);
     size_t bytesread;
+    Status ret = buffer != NULL ? e_success : e_failure;
 
-    while ((bytesread = fread(buffer, 1, sizeof(buffer), fptr_src)) > 0)
+    while (ret == e_success && (bytesread = stats_fread(stats, buffer, ENCODE_TAIL_BUF_SIZE, fptr_src)) > 0)
     {
-        if (fwrite(buffer, 1, bytesread, fptr_dest) != bytesread)
-            return e_failure;
+        if (stats_fwrite(stats, buffer, bytesread, fptr_dest) != bytesread)
+            ret = e_failure;
     }
 
-    return e_success;
+    free(buffer);
+    return ret;
 }
 
-/* Main encoding process */
-Status do_encoding(EncodeInfo *encInfo)
+/* copy_file_range() from *in to *out until *in reaches end or the kernel refuses */
+static void copy_range_kernel(int src_fd, int64_t *in, int dst_fd, int64_t *out, uint64_t end)
 {
-    printf("\n-----ENCODING-----\n\n");
+    while ((uint64_t)*in < end)
+    {
+        ssize_t n = syscall(__NR_copy_file_range, src_fd, in, dst_fd, out, (size_t)(end - *in), 0);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;
+    }
+}
 
-    if (open_files(encInfo) == e_failure)
+/*
+ * Kernel copy of [*in, end), one data extent of the source: copy_file_range()
+ * up to the next block boundary, reflink the whole blocks after it, then
+ * copy_file_range() whatever cloning refused. The output must end at *in.
+ */
+static void copy_extent_kernel(int src_fd, int64_t *in, int dst_fd, int64_t *out, uint64_t end,
+                               uint64_t block, int *cloned)
+{
+    uint64_t aligned = ((uint64_t)*in + block - 1) / block * block;
+
+    copy_range_kernel(src_fd, in, dst_fd, out, aligned < end ? aligned : end);
+
+    /* A clone may end off a block boundary only at the source's EOF (length 0) */
+    if ((uint64_t)*in == aligned && aligned < end)
+    {
+        struct stat st;
+        int to_eof = fstat(src_fd, &st) == 0 && end == (uint64_t)st.st_size;
+        uint64_t len = to_eof ? end - aligned : (end - aligned) / block * block;
+        struct file_clone_range range = { src_fd, aligned, to_eof ? 0 : len, aligned };
+
+        if (len > 0 && ioctl(dst_fd, FICLONERANGE, &range) == 0)
+        {
+            *in = *out = (int64_t)(aligned + len);
+            *cloned = 1;
+        }
+    }
+    copy_range_kernel(src_fd, in, dst_fd, out, end);
+}
+
+/*
+ * Copy what the kernel can of the image tail without passing it through
+ * user space. Holes in a sparse carrier are skipped, so they stay holes
+ * in the output; each data extent goes through copy_extent_kernel().
+ * Both files are left positioned after the bytes copied, for the
+ * user-space copy to finish; pipes are left entirely to it.
+ */
+static Status copy_remaining_kernel(EncodeInfo *encInfo)
+{
+    int src_fd = fileno(encInfo->fptr_src_image);
+    int dst_fd = fileno(encInfo->fptr_stego_image);
+    struct stat src_st, dst_st;
+
+    if (fflush(encInfo->fptr_stego_image) != 0)
+        return e_failure;
+
+    off_t pos = ftello(encInfo->fptr_src_image);
+    if (pos < 0 || pos != ftello(encInfo->fptr_stego_image) ||
+        fstat(src_fd, &src_st) != 0 || fstat(dst_fd, &dst_st) != 0 ||
+        !S_ISREG(src_st.st_mode) || !S_ISREG(dst_st.st_mode) || (uint64_t)pos >= (uint64_t)src_st.st_size ||
+        (uint64_t)dst_st.st_size != (uint64_t)pos)
+        return e_success;
+
+    uint64_t end = (uint64_t)src_st.st_size;
+    uint64_t block = dst_st.st_blksize > 0 ? (uint64_t)dst_st.st_blksize : 4096;
+    uint64_t data_bytes = 0;
+    int64_t in = pos, out = pos;
+    int cloned = 0;
+
+    while ((uint64_t)in < end)
     {
-        printf("Error! Failed to open files.\n");
+        /* Without SEEK_DATA support everything counts as data */
+        off_t data = lseek(src_fd, in, SEEK_DATA);
+        if (data < 0)
+            data = errno == ENXIO ? (off_t)end : in;
+        off_t hole = data < (off_t)end ? lseek(src_fd, data, SEEK_HOLE) : (off_t)end;
+        if (hole < 0 || (uint64_t)hole > end)
+            hole = (off_t)end;
+
+        /* Grow the output over the hole without writing it */
+        if (data > in)
+        {
+            if (ftruncate(dst_fd, data) != 0)
+                break;
+            in = out = data;
+        }
+        if ((uint64_t)in == end)
+            break;
+
+        int64_t from = in;
+        copy_extent_kernel(src_fd, &in, dst_fd, &out, (uint64_t)hole, block, &cloned);
+        data_bytes += (uint64_t)(in - from);
+        if (in < hole)
+            break;
+    }
+
+    if ((uint64_t)in > (uint64_t)pos)
+    {
+        stats_add_write(encInfo->stats, data_bytes);
+        uint64_t sparse = (uint64_t)(in - pos) - data_bytes;
+        if (sparse > 0)
+            PROGRESS(encInfo->quiet, "Copied %llu tail bytes in the kernel%s, %llu more left sparse.\n",
+                     (unsigned long long)data_bytes, cloned ? " (reflinked)" : "", (unsigned long long)sparse);
+        else
+            PROGRESS(encInfo->quiet, "Copied %llu tail bytes in the kernel%s.\n", (unsigned long long)data_bytes,
+                     cloned ? " (reflinked)" : "");
+    }
+    return overlap_done(encInfo, (uint64_t)in);
+}
+
+/* Copy the rest of the image through the overlapped pipeline */
+static Status copy_remaining_overlapped(EncodeInfo *encInfo, AioQueue *q)
+{
+    struct stat st;
+    off_t pos = ftello(encInfo->fptr_src_image);
+
+    if (pos < 0 || fstat(fileno(encInfo->fptr_src_image), &st) != 0 ||
+        aio_stream(q, fileno(encInfo->fptr_src_image), fileno(encInfo->fptr_stego_image), (uint64_t)pos,
+                   (uint64_t)st.st_size, AIO_WINDOW, encInfo->aio_buf, NULL, NULL, encInfo->stats) == e_failure)
+        return e_failure;
+    return overlap_done(encInfo, (uint64_t)st.st_size);
+}
+
+/* Secret size: --secret-size when given, else the size of a regular file */
+static Status resolve_secret_size(EncodeInfo *encInfo)
+{
+    if (encInfo->archive_count > 0)
+    {
+        encInfo->size_secret_file = encInfo->archive.total;
+        return e_success;
+    }
+
+    if (encInfo->secret_size_given)
+    {
+        encInfo->size_secret_file = encInfo->secret_size_arg;
+        return e_success;
+    }
+
+    if (!pipe_is_seekable(encInfo->fptr_secret))
+    {
+        diag_error("Error! The size of a piped secret must be given with --secret-size\n");
         return e_failure;
     }
-    printf("Files opened successfully.\n");
 
     encInfo->size_secret_file = get_file_size(encInfo->fptr_secret);
-    rewind(encInfo->fptr_secret);
+    return e_success;
+}
+
+/* Encoding stages run on the opened files */
+static Status encode_stages(EncodeInfo *encInfo)
+{
+    stats_begin(encInfo->stats, e_stage_capacity);
+    if (resolve_secret_size(encInfo) == e_failure)
+        return e_failure;
 
     if (check_capacity(encInfo) == e_failure)
     {
-        printf("Error! Image capacity not accurate.\n");
+        diag_error("Error! Secret file does not fit in the image.\n");
         return e_failure;
     }
-    printf("Image capacity checked successfully.\n");
+    PROGRESS(encInfo->quiet, "Image capacity = %llu bytes\n", (unsigned long long)encInfo->image_capacity);
+    PROGRESS(encInfo->quiet, "Image capacity checked successfully.\n");
 
-    if (copy_bmp_header(encInfo->fptr_src_image, encInfo->fptr_stego_image) == e_failure)
+    if (open_stego_image(encInfo) == e_failure)
+        return e_failure;
+
+    stats_begin(encInfo->stats, e_stage_header);
+
+    Status copied;
+    if (pipe_is_std(encInfo->src_image_fname))
+        copied = stats_fwrite(encInfo->stats, encInfo->stream_header, encInfo->bmp.data_offset,
+                              encInfo->fptr_stego_image) == encInfo->bmp.data_offset ? e_success : e_failure;
+    else
+        copied = copy_bmp_header(encInfo->fptr_src_image, encInfo->fptr_stego_image, encInfo->bmp.data_offset,
+                                 encInfo->stats);
+    if (copied == e_failure)
     {
-        printf("Error! Failed to copy BMP header.\n");
+        diag_error("Error! Failed to copy BMP header.\n");
         return e_failure;
     }
-    printf("BMP header copied successfully.\n");
+    PROGRESS(encInfo->quiet, "BMP header copied successfully.\n");
+
+    stats_begin(encInfo->stats, e_stage_magic);
 
-    if (encode_magic_string(MAGIC_STRING, encInfo) == e_failure)
+    int v1 = encInfo->header_version == STEGO_V1;
+    if (encode_magic_string(v1 ? MAGIC_STRING : MAGIC_STRING_V2, encInfo) == e_failure)
     {
-        printf("Error! Failed to encode magic string.\n");
+        diag_error("Error! Failed to encode magic string.\n");
         return e_failure;
     }
-    printf("Encoded magic string successfully.\n");
+    PROGRESS(encInfo->quiet, "Encoded magic string successfully.\n");
+
+    if (!v1)
+    {
+        uint32_t flags = (uint32_t)(encInfo->depth - 1) | (encInfo->compress ? STEGO_FLAG_LZ : 0) |
+                         (encInfo->archive_count > 0 ? STEGO_FLAG_ARCHIVE : 0) |
+                         (encInfo->checksum ? STEGO_FLAG_CRC : 0) | (encInfo->key != NULL ? STEGO_FLAG_SCATTER : 0);
+        if (encode_header_flags(flags, encInfo) == e_failure)
+        {
+            diag_error("Error! Failed to encode header flags.\n");
+            return e_failure;
+        }
+        PROGRESS(encInfo->quiet, "Encoded header flags successfully.\n");
+    }
 
-    char *file_extn = strrchr(encInfo->secret_fname, '.');
-    if (file_extn == NULL)
+    char *file_extn = encInfo->extn_secret_file;
+    if (file_extn[0] == '\0')
     {
-        printf("Error! Unable to find extension in secret file name.\n");
+        diag_error("Error! Unable to find extension in secret file name.\n");
         return e_failure;
     }
 
     int extn_size = strlen(file_extn);
 
+    stats_begin(encInfo->stats, e_stage_extn);
+
     if (encode_secret_file_extn_size(extn_size, encInfo) == e_failure)
     {
-        printf("Error! Failed to encode secret file extension size.\n");
+        diag_error("Error! Failed to encode secret file extension size.\n");
         return e_failure;
     }
-    printf("Encoded secret file extension size successfully.\n");
+    PROGRESS(encInfo->quiet, "Encoded secret file extension size successfully.\n");
 
     if (encode_secret_file_extn(file_extn, encInfo) == e_failure)
     {
-        printf("Error! Failed to encode secret file extension.\n");
+        diag_error("Error! Failed to encode secret file extension.\n");
         return e_failure;
     }
-    printf("Encoded secret file extension successfully.\n");
+    PROGRESS(encInfo->quiet, "Encoded secret file extension successfully.\n");
+
+    stats_begin(encInfo->stats, e_stage_size);
 
     if (encode_secret_file_size(encInfo->size_secret_file, encInfo) == e_failure)
     {
-        printf("Error! Failed to encode secret file size.\n");
+        diag_error("Error! Failed to encode secret file size.\n");
         return e_failure;
     }
-    printf("Encoded secret file size successfully.\n");
+    PROGRESS(encInfo->quiet, "Encoded secret file size successfully.\n");
+
+    stats_begin(encInfo->stats, e_stage_data);
 
     if (encode_secret_file_data(encInfo) == e_failure)
     {
-        printf("Error! Failed to encode secret file data.\n");
+        diag_error("Error! Failed to encode secret file data.\n");
         return e_failure;
     }
-    printf("Encoded secret file data successfully.\n");
+    PROGRESS(encInfo->quiet, "Encoded secret file data successfully.\n");
 
-    if (copy_remaining_img_data(encInfo->fptr_src_image, encInfo->fptr_stego_image) == e_failure)
+    stats_begin(encInfo->stats, e_stage_tail);
+
+    /* The unchanged tail goes through the kernel where it can; the rest through user space */
+    AioQueue *q = overlap_queue(encInfo);
+    if (copy_remaining_kernel(encInfo) == e_failure ||
+        (q != NULL ? copy_remaining_overlapped(encInfo, q)
+                   : copy_remaining_img_data(encInfo->fptr_src_image, encInfo->fptr_stego_image, encInfo->stats)) ==
+        e_failure)
     {
-        printf("Error! Failed to copy remaining image data.\n");
+        diag_error("Error! Failed to copy remaining image data.\n");
         return e_failure;
     }
-    printf("Remaining image data copied successfully.\n");
+    PROGRESS(encInfo->quiet, "Remaining image data copied successfully.\n");
 
-    printf("\n ✅ ENCODING COMPLETED SUCCESSFULLY!\n");
+    stats_end(encInfo->stats);
     return e_success;
+}
+
+/* Main encoding process */
+Status do_encoding(EncodeInfo *encInfo)
+{
+    PROGRESS(encInfo->quiet, "\n-----ENCODING-----\n\n");
+
+    if (encInfo->depth < 1)
+        encInfo->depth = 1;
+
+    stats_begin(encInfo->stats, e_stage_open);
+    if (open_files(encInfo) == e_failure)
+    {
+        diag_error("Error! Failed to open files.\n");
+        close_files(encInfo);
+        stats_end(encInfo->stats);
+        return e_failure;
+    }
+    PROGRESS(encInfo->quiet, "Files opened successfully.\n");
+
+    Status ret = encode_stages(encInfo);
+    int created = encInfo->fptr_stego_image != NULL && !pipe_is_std(encInfo->stego_image_fname);
+
+    /* The final flush is the tail's last write */
+    stats_begin(encInfo->stats, e_stage_tail);
+    if (close_files(encInfo) == e_failure)
+    {
+        diag_error("Error! Failed to write stego image.\n");
+        ret = e_failure;
+    }
+    stats_end(encInfo->stats);
+
+    /* No half-written image is left behind */
+    if (ret == e_failure && created)
+        unlink(encInfo->stego_image_fname);
+
+    if (ret == e_success)
+        PROGRESS(encInfo->quiet, "\n ✅ ENCODING COMPLETED SUCCESSFULLY!\n");
+    return ret;
 }
\ No newline at end of file
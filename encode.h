@@ -2,7 +2,24 @@
 #define ENCODE_H
 
 #include <stdio.h>
+#include <stdint.h>
 #include "types.h" /* Contains user defined types */
+#include "bmp.h"
+#include "stats.h"
+#include "archive.h"
+#include "scatter.h"
+#include "stego.h"
+#include "aio.h"
+#include "lsb_kernel.h"
+
+/* Size of each caller-provided stdio buffer (source and stego streams) */
+#define ENCODE_IO_BUF_SIZE (64 * 1024)
+
+/* Caller-provided overlapped pipeline buffers: AIO_DEPTH windows, then one window's payload and carrier */
+#define ENCODE_AIO_BUF_SIZE ((size_t)AIO_DEPTH * AIO_WINDOW + AIO_WINDOW / 8 * LSB_MAX_DEPTH + AIO_WINDOW)
+
+/* User-space buffer for the part of the image tail the kernel could not copy */
+#define ENCODE_TAIL_BUF_SIZE (256 * 1024)
 
 /*
  * Structure to store information required for
@@ -15,18 +32,51 @@ typedef struct _EncodeInfo
 	/* Source Image info */
 	char *src_image_fname;
 	FILE *fptr_src_image;
-	uint image_capacity;
+	BmpInfo bmp;                 /* parsed once by open_files() */
+	uint64_t image_capacity;     /* usable carrier bytes */
+	uint64_t carrier_pos;        /* carrier bytes embedded so far */
 
 	/* Secret File Info */
 	char *secret_fname;
 	FILE *fptr_secret;
-	char extn_secret_file[16];   /* enough for ".longext" + NUL */
-	unsigned char secret_data[1024]; /* consider dynamic allocation for large secrets */
-	long size_secret_file;
+	char extn_secret_file[STEGO_EXTN_MAX + 1];   /* stored extension: from the name, or preset by --ext */
+	unsigned char secret_data[1024]; /* payload block fed to the embed kernel (ENCODE_BLOCK_SIZE) */
+	uint64_t size_secret_file;
+	uint64_t secret_size_arg;    /* --secret-size, required for piped secrets */
+	int secret_size_given;
+
+	/* Archive mode (-a): a TOC and the member files replace the secret file */
+	char **archive_files;
+	int archive_count;
+	ArchiveSource archive;
 
 	/* Stego Image Info */
 	char *stego_image_fname;
 	FILE *fptr_stego_image;
+
+	/* "-" carrier or output: no seeks, no workers, header kept for the copy */
+	int stream;
+	unsigned char stream_header[BMP_STREAM_HEADER_MAX];
+
+	/* Options */
+	int use_mmap;                /* encode through memory mappings */
+	int header_version;          /* STEGO_V1 for legacy "#*" output, v2 otherwise */
+	int depth;                   /* payload bits per carrier byte (1..4) */
+	int compress;                /* store the secret as LZ frames (v2 only) */
+	int checksum;                /* append the secret's CRC32C (v2 only) */
+	uint32_t crc;                /* CRC32C of the secret bytes read so far */
+	const char *key;             /* --key: scatter the data groups (v2 only) */
+	ScatterMap scatter;          /* group positions, planned once the header is written */
+	uint64_t payload_pos;        /* payload bytes embedded so far */
+	ChannelMode channels;        /* all pixel bytes, or alpha only (32bpp) */
+	int threads;                 /* data embedding workers (1 = sequential) */
+	AioMode aio;                 /* overlapped I/O backend for the data and tail stages */
+	AioQueue *aio_queue;         /* created on first use, freed by close_files() unless aio_shared */
+	int aio_shared;              /* aio_queue is the caller's, reused across jobs */
+	unsigned char *aio_buf;      /* optional ENCODE_AIO_BUF_SIZE pipeline buffers, reused across jobs */
+	int quiet;                   /* suppress progress lines */
+	Stats *stats;                /* per-stage counters for --stats, or NULL */
+	char *io_buf;                /* optional 2 * ENCODE_IO_BUF_SIZE stdio buffers, reused across jobs */
 } EncodeInfo;
 
 /* Encoding function prototypes */
@@ -34,27 +84,42 @@ typedef struct _EncodeInfo
 /* Read and validate Encode args from argv */
 Status read_and_validate_encode_args(char *argv[], EncodeInfo *encInfo);
 
+/* Read and validate archive args: -a <carrier.bmp> <output.bmp> <file>... */
+Status read_and_validate_archive_args(int argc, char *argv[], EncodeInfo *encInfo);
+
 /* Perform the encoding workflow */
 Status do_encoding(EncodeInfo *encInfo);
 
-/* Open required files */
+/* Perform the encoding workflow on memory-mapped files (encode_mmap.c) */
+Status do_encoding_mmap(EncodeInfo *encInfo);
+
+/* Replace the secret of an existing stego image, rewriting only the bytes it covers (encode_mmap.c) */
+Status do_encoding_in_place(EncodeInfo *encInfo);
+
+/* Open the carrier and the secret; the stego image is created once the capacity check passes */
 Status open_files(EncodeInfo *encInfo);
 
+/* Close the files opened by open_files() */
+Status close_files(EncodeInfo *encInfo);
+
 /* Check the image capacity is sufficient for encoding */
 Status check_capacity(EncodeInfo *encInfo);
 
-/* Get image size (width * height * bytes_per_pixel) for BMP */
-uint get_image_size_for_bmp(FILE *fptr_image);
+/* Get the pixel array size of a BMP (row padding included) */
+uint64_t get_image_size_for_bmp(FILE *fptr_image);
 
 /* Get file size in bytes */
-uint get_file_size(FILE *fptr);
+uint64_t get_file_size(FILE *fptr);
 
-/* Copy BMP image header (54 bytes) */
-Status copy_bmp_header(FILE *fptr_src_image, FILE *fptr_dest_image);
+/* Copy the BMP headers that precede the pixel array (header_size = bfOffBits) */
+Status copy_bmp_header(FILE *fptr_src_image, FILE *fptr_dest_image, uint32_t header_size, Stats *stats);
 
 /* Store Magic String */
 Status encode_magic_string(const char *magic_string, EncodeInfo *encInfo);
 
+/* Encode v2 header flags */
+Status encode_header_flags(uint32_t flags, EncodeInfo *encInfo);
+
 /* Encode extension size */
 Status encode_secret_file_extn_size(int size, EncodeInfo *encInfo);
 
@@ -62,7 +127,7 @@ Status encode_secret_file_extn_size(int size, EncodeInfo *encInfo);
 Status encode_secret_file_extn(const char *file_extn, EncodeInfo *encInfo);
 
 /* Encode secret file size */
-Status encode_secret_file_size(long file_size, EncodeInfo *encInfo);
+Status encode_secret_file_size(uint64_t file_size, EncodeInfo *encInfo);
 
 /* Encode secret file data */
 Status encode_secret_file_data(EncodeInfo *encInfo);
@@ -73,7 +138,10 @@ Status encode_byte_to_lsb(char data, unsigned char *image_buffer);
 /* Encode a 32-bit size into 32 bytes (LSBs) */
 Status encode_size_to_lsb(unsigned int size, unsigned char *imageBuffer);
 
+/* Encode a 64-bit size into 64 bytes (LSBs) */
+Status encode_size64_to_lsb(uint64_t size, unsigned char *imageBuffer);
+
 /* Copy remaining image bytes from src to stego image after encoding */
-Status copy_remaining_img_data(FILE *fptr_src, FILE *fptr_dest);
+Status copy_remaining_img_data(FILE *fptr_src, FILE *fptr_dest, Stats *stats);
 
 #endif
\ No newline at end of file
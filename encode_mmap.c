@@ -0,0 +1,305 @@
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "encode.h"
+#include "types.h"
+#include "common.h"
+#include "lsb_kernel.h"
+#include "stego.h"
+#include "pipe_io.h"
+#include "diag.h"
+
+/* A read-only or writable file mapping */
+typedef struct
+{
+    int fd;
+    unsigned char *addr;
+    size_t size;
+} Mapping;
+
+static void unmap_file(Mapping *map)
+{
+    if (map->addr != NULL && map->size > 0)
+        munmap(map->addr, map->size);
+    if (map->fd >= 0)
+        close(map->fd);
+    map->addr = NULL;
+    map->fd = -1;
+}
+
+/* Map an existing file read-only (an empty file gives a NULL mapping) */
+static Status map_input(const char *fname, Mapping *map)
+{
+    struct stat st;
+
+    map->fd = open(fname, O_RDONLY);
+    if (map->fd < 0 || fstat(map->fd, &st) != 0)
+    {
+        perror("open");
+        diag_error("Error! Unable to open file %s\n", fname);
+        return e_failure;
+    }
+
+    if ((uint64_t)st.st_size > SIZE_MAX)
+    {
+        diag_error("Error! %s is too large to map on this host\n", fname);
+        return e_failure;
+    }
+    map->size = (size_t)st.st_size;
+    if (map->size == 0)
+        return e_success;
+
+    map->addr = mmap(NULL, map->size, PROT_READ, MAP_PRIVATE, map->fd, 0);
+    if (map->addr == MAP_FAILED)
+    {
+        map->addr = NULL;
+        perror("mmap");
+        return e_failure;
+    }
+    madvise(map->addr, map->size, MADV_SEQUENTIAL);
+
+    return e_success;
+}
+
+/* Create the output file with the given size and map it writable */
+static Status map_output(const char *fname, size_t size, Mapping *map)
+{
+    map->fd = open(fname, O_RDWR | O_CREAT | O_TRUNC, 0666);
+    if (map->fd < 0)
+    {
+        perror("open");
+        diag_error("Error! Unable to open file %s\n", fname);
+        return e_failure;
+    }
+
+    if (ftruncate(map->fd, (off_t)size) != 0)
+    {
+        perror("ftruncate");
+        return e_failure;
+    }
+
+    map->size = size;
+    map->addr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, map->fd, 0);
+    if (map->addr == MAP_FAILED)
+    {
+        map->addr = NULL;
+        perror("mmap");
+        return e_failure;
+    }
+
+    return e_success;
+}
+
+/* Encoding through memory mappings: the library call copies the carrier and embeds in place */
+Status do_encoding_mmap(EncodeInfo *encInfo)
+{
+    Mapping src = { -1, NULL, 0 };
+    Mapping secret = { -1, NULL, 0 };
+    Mapping stego = { -1, NULL, 0 };
+    Status ret = e_failure;
+
+    /* Pipes, explicitly sized secrets and archives cannot be mapped; stream them instead */
+    if (pipe_is_std(encInfo->src_image_fname) || pipe_is_std(encInfo->stego_image_fname) ||
+        encInfo->secret_size_given || encInfo->archive_count > 0)
+        return do_encoding(encInfo);
+
+    PROGRESS(encInfo->quiet, "\n-----ENCODING (mmap)-----\n\n");
+
+    if (encInfo->depth < 1)
+        encInfo->depth = 1;
+
+    char *file_extn = encInfo->extn_secret_file;
+    if (file_extn[0] == '\0')
+    {
+        diag_error("Error! Unable to find extension in secret file name.\n");
+        return e_failure;
+    }
+
+    stats_begin(encInfo->stats, e_stage_open);
+    if (map_input(encInfo->src_image_fname, &src) == e_success &&
+        map_input(encInfo->secret_fname, &secret) == e_success)
+    {
+        PROGRESS(encInfo->quiet, "Files mapped successfully.\n");
+
+        stats_begin(encInfo->stats, e_stage_capacity);
+
+        if (bmp_parse(src.addr, src.size, src.size, &encInfo->bmp) == e_failure ||
+            bmp_select_channels(&encInfo->bmp, encInfo->channels) == e_failure)
+        {
+            diag_error("Error! %s: %s\n", encInfo->src_image_fname, encInfo->bmp.error);
+        }
+        else if (encInfo->header_version == STEGO_V1 && encInfo->channels == e_channels_all &&
+                 encInfo->bmp.data_offset != BMP_V1_DATA_OFFSET)
+        {
+            diag_error("Error! %s: the v1 header needs a carrier with a 54-byte BMP header.\n",
+                       encInfo->src_image_fname);
+        }
+        else
+        {
+            StegoOptions opts = { encInfo->header_version, encInfo->depth, encInfo->channels, file_extn,
+                                  encInfo->compress, encInfo->checksum, encInfo->key };
+            uint64_t max_secret = 0;
+
+            encInfo->image_capacity = encInfo->bmp.carrier_bytes;
+            encInfo->size_secret_file = secret.size;
+
+            /* Checked before the output exists; a compressed secret may beat the bound, so it is tried */
+            if (stego_capacity(src.addr, src.size, &opts, &max_secret) == e_failure ||
+                (!encInfo->compress && secret.size > max_secret))
+            {
+                diag_error("Error! Secret file does not fit: %zu bytes, the image holds at most %llu.\n",
+                       secret.size, (unsigned long long)max_secret);
+            }
+            else if (map_output(encInfo->stego_image_fname, src.size, &stego) == e_failure)
+            {
+                diag_error("Error! Failed to create stego image.\n");
+            }
+            else
+            {
+                /* Mapped I/O: one "call" per mapping, bytes touched by the copy and embed */
+                stats_begin(encInfo->stats, e_stage_data);
+                stats_add_read(encInfo->stats, src.size);
+                stats_add_read(encInfo->stats, secret.size);
+                stats_add_write(encInfo->stats, stego.size);
+
+                if (stego_encode(src.addr, src.size, secret.addr, secret.size, &opts,
+                                 stego.addr, stego.size) == e_failure)
+                {
+                    diag_error("Error! Secret file does not fit in the image.\n");
+                }
+                else
+                {
+                    PROGRESS(encInfo->quiet, "Encoded secret file into mapped image successfully.\n");
+                    ret = e_success;
+                }
+            }
+        }
+    }
+
+    /* Unmapping flushes the dirty pages of the output */
+    int created = stego.fd >= 0;
+    stats_begin(encInfo->stats, e_stage_tail);
+    unmap_file(&stego);
+    unmap_file(&secret);
+    unmap_file(&src);
+    stats_end(encInfo->stats);
+
+    /* No half-written image is left behind */
+    if (ret == e_failure && created)
+        unlink(encInfo->stego_image_fname);
+
+    if (ret == e_success)
+        PROGRESS(encInfo->quiet, "\n ✅ ENCODING COMPLETED SUCCESSFULLY!\n");
+    return ret;
+}
+
+/* Map an existing file read-write; stores go straight back to it */
+static Status map_in_place(const char *fname, Mapping *map)
+{
+    struct stat st;
+
+    map->fd = open(fname, O_RDWR);
+    if (map->fd < 0 || fstat(map->fd, &st) != 0)
+    {
+        perror("open");
+        diag_error("Error! Unable to open file %s\n", fname);
+        return e_failure;
+    }
+
+    if ((uint64_t)st.st_size > SIZE_MAX)
+    {
+        diag_error("Error! %s is too large to map on this host\n", fname);
+        return e_failure;
+    }
+    map->size = (size_t)st.st_size;
+    map->addr = map->size > 0 ? mmap(NULL, map->size, PROT_READ | PROT_WRITE, MAP_SHARED, map->fd, 0) : MAP_FAILED;
+    if (map->addr == MAP_FAILED)
+    {
+        map->addr = NULL;
+        perror("mmap");
+        return e_failure;
+    }
+
+    return e_success;
+}
+
+/*
+ * --in-place: replace the secret of an existing stego image. Only the
+ * pages holding the old and new header and payload are dirtied, so the
+ * untouched pixels are neither read nor written back.
+ */
+Status do_encoding_in_place(EncodeInfo *encInfo)
+{
+    Mapping image = { -1, NULL, 0 };
+    Mapping secret = { -1, NULL, 0 };
+    Status ret = e_failure;
+
+    if (pipe_is_std(encInfo->src_image_fname) || pipe_is_std(encInfo->secret_fname) ||
+        encInfo->secret_size_given || encInfo->archive_count > 0)
+    {
+        diag_error("Error! --in-place needs a regular image and secret file.\n");
+        return e_failure;
+    }
+
+    PROGRESS(encInfo->quiet, "\n-----ENCODING (in place)-----\n\n");
+
+    stats_begin(encInfo->stats, e_stage_open);
+    if (map_in_place(encInfo->src_image_fname, &image) == e_success &&
+        map_input(encInfo->secret_fname, &secret) == e_success)
+    {
+        StegoHeader old;
+
+        stats_begin(encInfo->stats, e_stage_magic);
+        if (stego_read_header(image.addr, image.size, &old) == e_failure)
+        {
+            diag_error("Error! %s is not a stego image; --in-place only replaces an existing secret.\n",
+                   encInfo->src_image_fname);
+        }
+        else if (old.keyed && encInfo->key == NULL)
+        {
+            diag_error("Error! The image was embedded with a key; pass it with --key.\n");
+        }
+        else
+        {
+            StegoOptions opts = { encInfo->header_version, encInfo->depth, encInfo->channels,
+                                  encInfo->extn_secret_file, encInfo->compress, encInfo->checksum, encInfo->key };
+            uint64_t first, end;
+
+            old.key = old.keyed ? encInfo->key : NULL;
+            stats_begin(encInfo->stats, e_stage_data);
+            if (stego_reencode(image.addr, image.size, &old, secret.addr, secret.size, &opts,
+                               &first, &end) == e_failure)
+            {
+                diag_error("Error! The secret does not fit, or the old payload is unreadable%s.\n",
+                       old.keyed ? " with this key" : "");
+            }
+            else
+            {
+                /* Pages touched by the rewrite; nothing else is read or written back */
+                stats_add_read(encInfo->stats, secret.size);
+                stats_add_write(encInfo->stats, end - first);
+                PROGRESS(encInfo->quiet, "Rewrote image bytes %llu..%llu of %zu in place.\n",
+                         (unsigned long long)first, (unsigned long long)end, image.size);
+                ret = e_success;
+            }
+        }
+    }
+
+    /* Flush the dirty pages before reporting success */
+    stats_begin(encInfo->stats, e_stage_tail);
+    if (ret == e_success && msync(image.addr, image.size, MS_SYNC) != 0)
+    {
+        perror("msync");
+        ret = e_failure;
+    }
+    unmap_file(&secret);
+    unmap_file(&image);
+    stats_end(encInfo->stats);
+
+    if (ret == e_success)
+        PROGRESS(encInfo->quiet, "\n ✅ ENCODING COMPLETED SUCCESSFULLY!\n");
+    return ret;
+}
@@ -0,0 +1,501 @@
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "lsb_kernel.h"
+#include "crc32c.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define LSB_KERNEL_X86 1
+#include <immintrin.h>
+#endif
+
+#define LSB_ONES    0x0101010101010101ULL
+#define LSB_CLEAR   0xFEFEFEFEFEFEFEFEULL
+
+lsb_embed_fn lsb_embed_block = lsb_embed_scalar;
+lsb_extract_fn lsb_extract_block = lsb_extract_scalar;
+lsb_rs_fn lsb_rs_count = lsb_rs_scalar;
+
+static const char *kernel_name = "scalar";
+
+/* Little-endian 64-bit load/store (compiles to a single mov on x86) */
+static inline uint64_t load_le64(const unsigned char *p)
+{
+    uint64_t v = 0;
+    for (int i = 7; i >= 0; i--)
+        v = (v << 8) | p[i];
+    return v;
+}
+
+static inline void store_le64(unsigned char *p, uint64_t v)
+{
+    for (int i = 0; i < 8; i++)
+    {
+        p[i] = (unsigned char)v;
+        v >>= 8;
+    }
+}
+
+/* Spread the 8 bits of a byte into 8 bytes, MSB into byte 0 */
+static inline uint64_t spread_bits(unsigned char b)
+{
+    uint64_t x = (uint64_t)b * LSB_ONES;
+    x &= 0x0102040810204080ULL;
+    x = (x + 0x7F7F7F7F7F7F7F7FULL) & 0x8080808080808080ULL;
+    return x >> 7;
+}
+
+/* Gather the LSBs of 8 bytes into one byte, byte 0 into the MSB */
+static inline unsigned char gather_bits(uint64_t x)
+{
+    return (unsigned char)(((x & LSB_ONES) * 0x8040201008040201ULL) >> 56);
+}
+
+void lsb_embed_scalar(const unsigned char *data, size_t n, unsigned char *carrier)
+{
+    for (size_t i = 0; i < n; i++, carrier += 8)
+        store_le64(carrier, (load_le64(carrier) & LSB_CLEAR) | spread_bits(data[i]));
+}
+
+void lsb_extract_scalar(const unsigned char *carrier, size_t n, unsigned char *data)
+{
+    for (size_t i = 0; i < n; i++, carrier += 8)
+        data[i] = gather_bits(load_le64(carrier));
+}
+
+/* RS discrimination function: variation along a group of four */
+static inline int rs_variation(int a, int b, int c, int d)
+{
+    return abs(b - a) + abs(c - b) + abs(d - c);
+}
+
+/* F1 swaps 2k and 2k+1 (LSB flip); F-1 swaps 2k-1 and 2k */
+static inline int rs_flip_neg(int v)
+{
+    return ((v + 1) ^ 1) - 1;
+}
+
+static inline void rs_group(int a, int b, int c, int d, uint64_t *counts)
+{
+    int f = rs_variation(a, b, c, d);
+    int fp = rs_variation(a, b ^ 1, c ^ 1, d);
+    int fn = rs_variation(a, rs_flip_neg(b), rs_flip_neg(c), d);
+
+    counts[0] += fp > f;
+    counts[1] += fp < f;
+    counts[2] += fn > f;
+    counts[3] += fn < f;
+}
+
+void lsb_rs_scalar(const unsigned char *p, const unsigned char *mask, size_t n, size_t stride, uint64_t *counts)
+{
+    for (size_t i = 0; i < n; i++)
+    {
+        if (!mask[i])
+            continue;
+        int a = p[i], b = p[i + stride], c = p[i + 2 * stride], d = p[i + 3 * stride];
+
+        rs_group(a, b, c, d, counts);
+        rs_group(a ^ 1, b ^ 1, c ^ 1, d ^ 1, counts + 4);
+    }
+}
+
+#ifdef LSB_KERNEL_X86
+
+/* Steps between spills of the 16-bit RS lane counters */
+#define RS_FLUSH 32767
+
+/* SSE2: 2 payload bytes <-> 16 carrier bytes per step */
+__attribute__((target("sse2")))
+static void lsb_embed_sse2(const unsigned char *data, size_t n, unsigned char *carrier)
+{
+    const __m128i bitsel = _mm_set_epi8(1, 2, 4, 8, 16, 32, 64, (char)128,
+                                        1, 2, 4, 8, 16, 32, 64, (char)128);
+    const __m128i one = _mm_set1_epi8(1);
+    const __m128i clear = _mm_set1_epi8((char)0xFE);
+    size_t i = 0;
+
+    for (; i + 2 <= n; i += 2, carrier += 16)
+    {
+        __m128i v = _mm_cvtsi32_si128(data[i] | (data[i + 1] << 8));
+        v = _mm_unpacklo_epi8(v, v);
+        v = _mm_unpacklo_epi16(v, v);
+        v = _mm_unpacklo_epi32(v, v);  /* d0 x8, d1 x8 */
+        v = _mm_and_si128(_mm_cmpeq_epi8(_mm_and_si128(v, bitsel), bitsel), one);
+
+        __m128i c = _mm_loadu_si128((const __m128i *)carrier);
+        _mm_storeu_si128((__m128i *)carrier, _mm_or_si128(_mm_and_si128(c, clear), v));
+    }
+    lsb_embed_scalar(data + i, n - i, carrier);
+}
+
+__attribute__((target("sse2")))
+static void lsb_extract_sse2(const unsigned char *carrier, size_t n, unsigned char *data)
+{
+    size_t i = 0;
+
+    for (; i + 2 <= n; i += 2, carrier += 16)
+    {
+        __m128i c = _mm_loadu_si128((const __m128i *)carrier);
+        /* Reverse the bytes of each 8-byte group so byte 0 lands in bit 7 */
+        c = _mm_shufflelo_epi16(c, 0x1B);
+        c = _mm_shufflehi_epi16(c, 0x1B);
+        c = _mm_or_si128(_mm_slli_epi16(c, 8), _mm_srli_epi16(c, 8));
+        unsigned int m = (unsigned int)_mm_movemask_epi8(_mm_slli_epi16(c, 7));
+        data[i] = (unsigned char)m;
+        data[i + 1] = (unsigned char)(m >> 8);
+    }
+    lsb_extract_scalar(carrier, n - i, data + i);
+}
+
+/* AVX2: 4 payload bytes <-> 32 carrier bytes per step */
+__attribute__((target("avx2")))
+static void lsb_embed_avx2(const unsigned char *data, size_t n, unsigned char *carrier)
+{
+    const __m256i spread = _mm256_setr_epi8(0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 1, 1, 1, 1,
+                                            2, 2, 2, 2, 2, 2, 2, 2, 3, 3, 3, 3, 3, 3, 3, 3);
+    const __m256i bitsel = _mm256_set1_epi64x(0x0102040810204080LL);
+    const __m256i one = _mm256_set1_epi8(1);
+    const __m256i clear = _mm256_set1_epi8((char)0xFE);
+    size_t i = 0;
+
+    for (; i + 4 <= n; i += 4, carrier += 32)
+    {
+        uint32_t word;
+        memcpy(&word, data + i, 4);
+        __m256i v = _mm256_shuffle_epi8(_mm256_set1_epi32((int)word), spread);
+        v = _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_and_si256(v, bitsel), bitsel), one);
+
+        __m256i c = _mm256_loadu_si256((const __m256i *)carrier);
+        _mm256_storeu_si256((__m256i *)carrier, _mm256_or_si256(_mm256_and_si256(c, clear), v));
+    }
+    lsb_embed_sse2(data + i, n - i, carrier);
+}
+
+__attribute__((target("avx2")))
+static void lsb_extract_avx2(const unsigned char *carrier, size_t n, unsigned char *data)
+{
+    const __m256i reverse = _mm256_setr_epi8(7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8,
+                                             7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8);
+    size_t i = 0;
+
+    for (; i + 4 <= n; i += 4, carrier += 32)
+    {
+        __m256i c = _mm256_loadu_si256((const __m256i *)carrier);
+        c = _mm256_slli_epi16(_mm256_shuffle_epi8(c, reverse), 7);
+        uint32_t m = (uint32_t)_mm256_movemask_epi8(c);
+        memcpy(data + i, &m, 4);
+    }
+    lsb_extract_sse2(carrier, n - i, data + i);
+}
+
+/*
+ * RS counts, SSE2: every position is classified in 16-bit lanes, 8 at a
+ * time, and the mask keeps the group starts. Lanes count down by adding
+ * the all-ones compare results.
+ */
+__attribute__((target("sse2")))
+static inline __m128i rs_variation_sse2(__m128i a, __m128i b, __m128i c, __m128i d)
+{
+    __m128i ab = _mm_max_epi16(_mm_sub_epi16(a, b), _mm_sub_epi16(b, a));
+    __m128i bc = _mm_max_epi16(_mm_sub_epi16(b, c), _mm_sub_epi16(c, b));
+    __m128i cd = _mm_max_epi16(_mm_sub_epi16(c, d), _mm_sub_epi16(d, c));
+    return _mm_add_epi16(_mm_add_epi16(ab, bc), cd);
+}
+
+__attribute__((target("sse2")))
+static inline void rs_classify_sse2(__m128i a, __m128i b, __m128i c, __m128i d, __m128i m, __m128i *acc)
+{
+    const __m128i one = _mm_set1_epi16(1);
+    __m128i f = rs_variation_sse2(a, b, c, d);
+    __m128i fp = rs_variation_sse2(a, _mm_xor_si128(b, one), _mm_xor_si128(c, one), d);
+    __m128i bn = _mm_sub_epi16(_mm_xor_si128(_mm_add_epi16(b, one), one), one);
+    __m128i cn = _mm_sub_epi16(_mm_xor_si128(_mm_add_epi16(c, one), one), one);
+    __m128i fn = rs_variation_sse2(a, bn, cn, d);
+
+    acc[0] = _mm_add_epi16(acc[0], _mm_and_si128(_mm_cmpgt_epi16(fp, f), m));
+    acc[1] = _mm_add_epi16(acc[1], _mm_and_si128(_mm_cmpgt_epi16(f, fp), m));
+    acc[2] = _mm_add_epi16(acc[2], _mm_and_si128(_mm_cmpgt_epi16(fn, f), m));
+    acc[3] = _mm_add_epi16(acc[3], _mm_and_si128(_mm_cmpgt_epi16(f, fn), m));
+}
+
+/* Add the (negative) lane counters to counts and clear them */
+__attribute__((target("sse2")))
+static void rs_flush_sse2(__m128i *acc, uint64_t *counts)
+{
+    int16_t lanes[8];
+
+    for (int k = 0; k < 8; k++)
+    {
+        _mm_storeu_si128((__m128i *)lanes, acc[k]);
+        for (int j = 0; j < 8; j++)
+            counts[k] -= lanes[j];
+        acc[k] = _mm_setzero_si128();
+    }
+}
+
+__attribute__((target("sse2")))
+static void lsb_rs_sse2(const unsigned char *p, const unsigned char *mask, size_t n, size_t stride,
+                        uint64_t *counts)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i one = _mm_set1_epi16(1);
+    __m128i acc[8];
+    size_t i = 0, steps = 0;
+
+    for (int k = 0; k < 8; k++)
+        acc[k] = zero;
+    for (; i + 8 <= n; i += 8)
+    {
+        __m128i m = _mm_loadl_epi64((const __m128i *)(mask + i));
+        __m128i a = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(p + i)), zero);
+        __m128i b = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(p + i + stride)), zero);
+        __m128i c = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(p + i + 2 * stride)), zero);
+        __m128i d = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(p + i + 3 * stride)), zero);
+
+        m = _mm_unpacklo_epi8(m, m);
+        rs_classify_sse2(a, b, c, d, m, acc);
+        rs_classify_sse2(_mm_xor_si128(a, one), _mm_xor_si128(b, one), _mm_xor_si128(c, one),
+                         _mm_xor_si128(d, one), m, acc + 4);
+        if (++steps == RS_FLUSH)
+        {
+            rs_flush_sse2(acc, counts);
+            steps = 0;
+        }
+    }
+    rs_flush_sse2(acc, counts);
+    lsb_rs_scalar(p + i, mask + i, n - i, stride, counts);
+}
+
+/* RS counts, AVX2: 16 lanes per step */
+__attribute__((target("avx2")))
+static inline __m256i rs_variation_avx2(__m256i a, __m256i b, __m256i c, __m256i d)
+{
+    return _mm256_add_epi16(_mm256_add_epi16(_mm256_abs_epi16(_mm256_sub_epi16(b, a)),
+                                             _mm256_abs_epi16(_mm256_sub_epi16(c, b))),
+                            _mm256_abs_epi16(_mm256_sub_epi16(d, c)));
+}
+
+__attribute__((target("avx2")))
+static inline void rs_classify_avx2(__m256i a, __m256i b, __m256i c, __m256i d, __m256i m, __m256i *acc)
+{
+    const __m256i one = _mm256_set1_epi16(1);
+    __m256i f = rs_variation_avx2(a, b, c, d);
+    __m256i fp = rs_variation_avx2(a, _mm256_xor_si256(b, one), _mm256_xor_si256(c, one), d);
+    __m256i bn = _mm256_sub_epi16(_mm256_xor_si256(_mm256_add_epi16(b, one), one), one);
+    __m256i cn = _mm256_sub_epi16(_mm256_xor_si256(_mm256_add_epi16(c, one), one), one);
+    __m256i fn = rs_variation_avx2(a, bn, cn, d);
+
+    acc[0] = _mm256_add_epi16(acc[0], _mm256_and_si256(_mm256_cmpgt_epi16(fp, f), m));
+    acc[1] = _mm256_add_epi16(acc[1], _mm256_and_si256(_mm256_cmpgt_epi16(f, fp), m));
+    acc[2] = _mm256_add_epi16(acc[2], _mm256_and_si256(_mm256_cmpgt_epi16(fn, f), m));
+    acc[3] = _mm256_add_epi16(acc[3], _mm256_and_si256(_mm256_cmpgt_epi16(f, fn), m));
+}
+
+__attribute__((target("avx2")))
+static void rs_flush_avx2(__m256i *acc, uint64_t *counts)
+{
+    int16_t lanes[16];
+
+    for (int k = 0; k < 8; k++)
+    {
+        _mm256_storeu_si256((__m256i *)lanes, acc[k]);
+        for (int j = 0; j < 16; j++)
+            counts[k] -= lanes[j];
+        acc[k] = _mm256_setzero_si256();
+    }
+}
+
+/* 16 bytes widened to 16-bit lanes */
+#define RS_LOAD_AVX2(q) _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(q)))
+
+__attribute__((target("avx2")))
+static void lsb_rs_avx2(const unsigned char *p, const unsigned char *mask, size_t n, size_t stride,
+                        uint64_t *counts)
+{
+    const __m256i one = _mm256_set1_epi16(1);
+    __m256i acc[8];
+    size_t i = 0, steps = 0;
+
+    for (int k = 0; k < 8; k++)
+        acc[k] = _mm256_setzero_si256();
+    for (; i + 16 <= n; i += 16)
+    {
+        __m256i m = _mm256_cvtepi8_epi16(_mm_loadu_si128((const __m128i *)(mask + i)));
+        __m256i a = RS_LOAD_AVX2(p + i);
+        __m256i b = RS_LOAD_AVX2(p + i + stride);
+        __m256i c = RS_LOAD_AVX2(p + i + 2 * stride);
+        __m256i d = RS_LOAD_AVX2(p + i + 3 * stride);
+
+        rs_classify_avx2(a, b, c, d, m, acc);
+        rs_classify_avx2(_mm256_xor_si256(a, one), _mm256_xor_si256(b, one), _mm256_xor_si256(c, one),
+                         _mm256_xor_si256(d, one), m, acc + 4);
+        if (++steps == RS_FLUSH)
+        {
+            rs_flush_avx2(acc, counts);
+            steps = 0;
+        }
+    }
+    rs_flush_avx2(acc, counts);
+    lsb_rs_sse2(p + i, mask + i, n - i, stride, counts);
+}
+
+#endif /* LSB_KERNEL_X86 */
+
+/*
+ * Depth-k group kernels: k payload bytes <-> 8 carrier bytes. Called with
+ * a constant depth from the wrappers below so every shift and mask is
+ * folded at compile time and the loops fully unroll.
+ */
+static inline void embed_groups(const unsigned char *data, size_t groups, unsigned char *carrier,
+                                const int depth)
+{
+    const unsigned char mask = (unsigned char)((1u << depth) - 1);
+
+    for (size_t g = 0; g < groups; g++, data += depth, carrier += 8)
+    {
+        uint32_t w = 0;
+        for (int i = 0; i < depth; i++)
+            w = (w << 8) | data[i];
+        for (int j = 0; j < 8; j++)
+            carrier[j] = (unsigned char)((carrier[j] & ~mask) | ((w >> (depth * (7 - j))) & mask));
+    }
+}
+
+static inline void extract_groups(const unsigned char *carrier, size_t groups, unsigned char *data,
+                                  const int depth)
+{
+    const unsigned char mask = (unsigned char)((1u << depth) - 1);
+
+    for (size_t g = 0; g < groups; g++, data += depth, carrier += 8)
+    {
+        uint32_t w = 0;
+        for (int j = 0; j < 8; j++)
+            w = (w << depth) | (carrier[j] & mask);
+        for (int i = depth - 1; i >= 0; i--, w >>= 8)
+            data[i] = (unsigned char)w;
+    }
+}
+
+#define DEFINE_DEPTH_KERNELS(k)                                                                   \
+    static void embed_groups_##k(const unsigned char *d, size_t g, unsigned char *c)              \
+    {                                                                                             \
+        embed_groups(d, g, c, k);                                                                 \
+    }                                                                                             \
+    static void extract_groups_##k(const unsigned char *c, size_t g, unsigned char *d)            \
+    {                                                                                             \
+        extract_groups(c, g, d, k);                                                               \
+    }
+
+DEFINE_DEPTH_KERNELS(2)
+DEFINE_DEPTH_KERNELS(3)
+DEFINE_DEPTH_KERNELS(4)
+
+typedef void (*group_embed_fn)(const unsigned char *, size_t, unsigned char *);
+typedef void (*group_extract_fn)(const unsigned char *, size_t, unsigned char *);
+
+static const group_embed_fn group_embed[LSB_MAX_DEPTH + 1] = {
+    NULL, NULL, embed_groups_2, embed_groups_3, embed_groups_4
+};
+static const group_extract_fn group_extract[LSB_MAX_DEPTH + 1] = {
+    NULL, NULL, extract_groups_2, extract_groups_3, extract_groups_4
+};
+
+void lsb_embed_depth(const unsigned char *data, size_t n, unsigned char *carrier, int depth)
+{
+    if (depth <= 1)
+    {
+        lsb_embed_block(data, n, carrier);
+        return;
+    }
+
+    size_t groups = n / depth;
+    size_t rest = n % depth;
+    group_embed[depth](data, groups, carrier);
+
+    if (rest > 0)
+    {
+        /* Partial last group: only the carrier bytes it covers are touched */
+        unsigned char pad[LSB_MAX_DEPTH] = {0};
+        unsigned char tmp[8];
+        size_t used = (size_t)lsb_carrier_bytes(rest, depth);
+
+        memcpy(pad, data + groups * depth, rest);
+        memcpy(tmp, carrier + groups * 8, used);
+        group_embed[depth](pad, 1, tmp);
+        memcpy(carrier + groups * 8, tmp, used);
+    }
+}
+
+void lsb_extract_depth(const unsigned char *carrier, size_t n, unsigned char *data, int depth)
+{
+    if (depth <= 1)
+    {
+        lsb_extract_block(carrier, n, data);
+        return;
+    }
+
+    size_t groups = n / depth;
+    size_t rest = n % depth;
+    group_extract[depth](carrier, groups, data);
+
+    if (rest > 0)
+    {
+        unsigned char tmp[8] = {0};
+        unsigned char out[LSB_MAX_DEPTH];
+
+        memcpy(tmp, carrier + groups * 8, (size_t)lsb_carrier_bytes(rest, depth));
+        group_extract[depth](tmp, 1, out);
+        memcpy(data + groups * depth, out, rest);
+    }
+}
+
+int lsb_kernel_select(const char *name)
+{
+#ifdef LSB_KERNEL_X86
+    __builtin_cpu_init();
+    if (strcmp(name, "avx2") == 0 && __builtin_cpu_supports("avx2"))
+    {
+        lsb_embed_block = lsb_embed_avx2;
+        lsb_extract_block = lsb_extract_avx2;
+        lsb_rs_count = lsb_rs_avx2;
+        kernel_name = "avx2";
+        return 1;
+    }
+    if (strcmp(name, "sse2") == 0 && __builtin_cpu_supports("sse2"))
+    {
+        lsb_embed_block = lsb_embed_sse2;
+        lsb_extract_block = lsb_extract_sse2;
+        lsb_rs_count = lsb_rs_sse2;
+        kernel_name = "sse2";
+        return 1;
+    }
+#endif
+    if (strcmp(name, "scalar") != 0)
+        return 0;
+    lsb_embed_block = lsb_embed_scalar;
+    lsb_extract_block = lsb_extract_scalar;
+    lsb_rs_count = lsb_rs_scalar;
+    kernel_name = "scalar";
+    return 1;
+}
+
+static pthread_once_t kernel_once = PTHREAD_ONCE_INIT;
+
+static void kernel_detect(void)
+{
+    crc32c_init();
+    if (!lsb_kernel_select("avx2") && !lsb_kernel_select("sse2"))
+        lsb_kernel_select("scalar");
+}
+
+void lsb_kernel_init(void)
+{
+    pthread_once(&kernel_once, kernel_detect);
+}
+
+const char *lsb_kernel_name(void)
+{
+    return kernel_name;
+}
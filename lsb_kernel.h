@@ -0,0 +1,68 @@
+#ifndef LSB_KERNEL_H
+#define LSB_KERNEL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Block kernels for LSB embedding / extraction.
+ * Payload byte i lives in carrier bytes [8*i, 8*i + 8), MSB first,
+ * exactly like encode_byte_to_lsb() / decode_byte_from_lsb().
+ * The best variant (AVX2, SSE2 or scalar) is picked once by lsb_kernel_init().
+ */
+
+/* Embed n payload bytes into the LSBs of 8*n carrier bytes */
+typedef void (*lsb_embed_fn)(const unsigned char *data, size_t n, unsigned char *carrier);
+
+/* Extract n payload bytes from the LSBs of 8*n carrier bytes */
+typedef void (*lsb_extract_fn)(const unsigned char *carrier, size_t n, unsigned char *data);
+
+/* Active kernels (scalar until lsb_kernel_init() is called) */
+extern lsb_embed_fn lsb_embed_block;
+extern lsb_extract_fn lsb_extract_block;
+
+/* Detect CPU features and select the fastest kernels (CRC32C's too); only the first call does it */
+void lsb_kernel_init(void);
+
+/* Name of the selected kernel variant ("avx2", "sse2" or "scalar") */
+const char *lsb_kernel_name(void);
+
+/* Switch to the named variant (make check runs each); 0 if the build or CPU lacks it */
+int lsb_kernel_select(const char *name);
+
+/*
+ * Depth-k embedding (k = 1..4 bits per carrier byte): every k payload
+ * bytes fill exactly 8 carrier bytes, k bits each, MSB first. Depth 1
+ * is the layout above and uses the SIMD kernels; 2..4 use kernels
+ * specialised at compile time for their depth.
+ */
+#define LSB_MAX_DEPTH 4
+
+/* Carrier bytes holding n payload bytes at the given depth */
+static inline uint64_t lsb_carrier_bytes(uint64_t n, int depth)
+{
+    return (8 * n + depth - 1) / depth;
+}
+
+void lsb_embed_depth(const unsigned char *data, size_t n, unsigned char *carrier, int depth);
+void lsb_extract_depth(const unsigned char *carrier, size_t n, unsigned char *data, int depth);
+
+/*
+ * RS steganalysis counts (scan.c). For every i < n with mask[i] set, the
+ * group (p[i], p[i + stride], p[i + 2 * stride], p[i + 3 * stride]) is
+ * classified as regular or singular under the flipping masks +M and -M
+ * (0 1 1 0): counts[0..3] gain R+M, S+M, R-M, S-M for the bytes as given,
+ * counts[4..7] the same with every LSB flipped. p holds n + 3 * stride
+ * bytes.
+ */
+typedef void (*lsb_rs_fn)(const unsigned char *p, const unsigned char *mask, size_t n, size_t stride,
+                          uint64_t *counts);
+
+extern lsb_rs_fn lsb_rs_count;
+
+/* Portable variants, always available */
+void lsb_embed_scalar(const unsigned char *data, size_t n, unsigned char *carrier);
+void lsb_extract_scalar(const unsigned char *carrier, size_t n, unsigned char *data);
+void lsb_rs_scalar(const unsigned char *p, const unsigned char *mask, size_t n, size_t stride, uint64_t *counts);
+
+#endif
@@ -0,0 +1,193 @@
+#include <string.h>
+#include "lz.h"
+#include "common.h"
+
+#define LZ_MIN_MATCH    4
+#define LZ_HASH_BITS    12
+#define LZ_MAX_OFFSET   65535
+
+static inline uint32_t read32(const unsigned char *p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint32_t hash32(uint32_t v)
+{
+    return (v * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+/* Append a length continuation (the part of len above 14 in the token) */
+static unsigned char *put_length(unsigned char *op, const unsigned char *end, size_t len)
+{
+    for (; len >= 255; len -= 255)
+    {
+        if (op >= end)
+            return NULL;
+        *op++ = 255;
+    }
+    if (op >= end)
+        return NULL;
+    *op++ = (unsigned char)len;
+    return op;
+}
+
+/* Emit literals [lit, lit + lit_len) followed by an optional match */
+static unsigned char *put_sequence(unsigned char *op, const unsigned char *end, const unsigned char *lit,
+                                   size_t lit_len, size_t offset, size_t match_len)
+{
+    size_t mcode = match_len ? match_len - LZ_MIN_MATCH : 0;
+    unsigned char *token = op++;
+
+    if (op > end)
+        return NULL;
+    *token = (unsigned char)((lit_len < 15 ? lit_len : 15) << 4);
+    if (lit_len >= 15 && (op = put_length(op, end, lit_len - 15)) == NULL)
+        return NULL;
+
+    if ((size_t)(end - op) < lit_len)
+        return NULL;
+    memcpy(op, lit, lit_len);
+    op += lit_len;
+
+    if (match_len == 0)
+        return op;
+
+    if (end - op < 2)
+        return NULL;
+    *op++ = (unsigned char)offset;
+    *op++ = (unsigned char)(offset >> 8);
+
+    *token |= (unsigned char)(mcode < 15 ? mcode : 15);
+    if (mcode >= 15)
+        op = put_length(op, end, mcode - 15);
+    return op;
+}
+
+size_t lz_compress(const unsigned char *src, size_t n, unsigned char *dst, size_t cap)
+{
+    uint32_t table[1 << LZ_HASH_BITS];
+    const unsigned char *end = dst + (cap < n ? cap : n);  /* no point going past n */
+    unsigned char *op = dst;
+    size_t ip = 0, anchor = 0;
+
+    memset(table, 0, sizeof(table));
+
+    while (n >= LZ_MIN_MATCH && ip + LZ_MIN_MATCH <= n)
+    {
+        uint32_t seq = read32(src + ip);
+        uint32_t h = hash32(seq);
+        size_t ref = table[h];
+
+        table[h] = (uint32_t)ip + 1;  /* 0 marks an empty slot */
+        if (ref == 0 || ip - (ref - 1) > LZ_MAX_OFFSET || read32(src + ref - 1) != seq)
+        {
+            /* Skip faster through data that does not match */
+            ip += 1 + ((ip - anchor) >> 6);
+            continue;
+        }
+        ref--;
+
+        size_t len = LZ_MIN_MATCH;
+        while (ip + len < n && src[ref + len] == src[ip + len])
+            len++;
+
+        op = put_sequence(op, end, src + anchor, ip - anchor, ip - ref, len);
+        if (op == NULL)
+            return 0;
+        ip += len;
+        anchor = ip;
+    }
+
+    op = put_sequence(op, end, src + anchor, n - anchor, 0, 0);
+    if (op == NULL || (size_t)(op - dst) >= n)
+        return 0;
+    return (size_t)(op - dst);
+}
+
+/* Read a length continuation; 0 on overrun */
+static int get_length(const unsigned char **ip, const unsigned char *end, size_t *len)
+{
+    unsigned char b;
+
+    do
+    {
+        if (*ip >= end)
+            return 0;
+        b = *(*ip)++;
+        *len += b;
+    } while (b == 255);
+    return 1;
+}
+
+Status lz_decompress(const unsigned char *src, size_t n, unsigned char *dst, size_t raw_len)
+{
+    const unsigned char *ip = src, *end = src + n;
+    size_t op = 0;
+
+    while (ip < end)
+    {
+        unsigned char token = *ip++;
+        size_t lit = token >> 4;
+
+        if (lit == 15 && !get_length(&ip, end, &lit))
+            return e_failure;
+        if ((size_t)(end - ip) < lit || raw_len - op < lit)
+            return e_failure;
+        memcpy(dst + op, ip, lit);
+        ip += lit;
+        op += lit;
+
+        if (ip == end)
+            break;  /* last sequence: literals only */
+
+        if (end - ip < 2)
+            return e_failure;
+        size_t offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+
+        size_t len = token & 15;
+        if (len == 15 && !get_length(&ip, end, &len))
+            return e_failure;
+        len += LZ_MIN_MATCH;
+
+        if (offset == 0 || offset > op || raw_len - op < len)
+            return e_failure;
+
+        /* Byte copy: overlapping matches repeat the pattern */
+        for (size_t i = 0; i < len; i++, op++)
+            dst[op] = dst[op - offset];
+    }
+
+    return op == raw_len ? e_success : e_failure;
+}
+
+size_t lz_frame_encode(const unsigned char *raw, size_t n, unsigned char *frame)
+{
+    size_t body = lz_compress(raw, n, frame + LZ_FRAME_HEADER, n);
+    uint32_t word = (uint32_t)body;
+
+    if (body == 0)
+    {
+        memcpy(frame + LZ_FRAME_HEADER, raw, n);
+        body = n;
+        word = (uint32_t)n | LZ_FRAME_STORED;
+    }
+
+    stego_put_be(frame, word, LZ_FRAME_HEADER);
+    return LZ_FRAME_HEADER + body;
+}
+
+Status lz_frame_header(const unsigned char *hdr, size_t raw_len, size_t *body_len, int *stored)
+{
+    uint32_t word = (uint32_t)stego_get_be(hdr, LZ_FRAME_HEADER);
+
+    *stored = (word & LZ_FRAME_STORED) != 0;
+    *body_len = word & ~LZ_FRAME_STORED;
+
+    /* Stored bodies are the whole block; compressed ones are strictly smaller */
+    if (*stored ? *body_len != raw_len : (*body_len == 0 || *body_len >= raw_len))
+        return e_failure;
+    return e_success;
+}
@@ -0,0 +1,44 @@
+#ifndef LZ_H
+#define LZ_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "types.h"
+
+/*
+ * Small LZ77 block codec for compressible secrets (LZ4-style sequences:
+ * token, literals, 16-bit offset, match length). Reentrant, no
+ * allocation: the match table lives on the caller's stack.
+ *
+ * A compressed payload is a series of frames, one per LZ_BLOCK raw bytes
+ * (the last one shorter): a 4-byte big-endian word holding the body
+ * length, with LZ_FRAME_STORED set when the body is the raw block.
+ */
+
+#define LZ_BLOCK            (64 * 1024)
+#define LZ_FRAME_HEADER     4
+#define LZ_FRAME_STORED     0x80000000u
+#define LZ_FRAME_MAX        (LZ_FRAME_HEADER + LZ_BLOCK)
+
+/* Compress n bytes into dst; returns 0 when the result would not be smaller than n */
+size_t lz_compress(const unsigned char *src, size_t n, unsigned char *dst, size_t cap);
+
+/* Decompress exactly raw_len bytes; fails on any malformed or short input */
+Status lz_decompress(const unsigned char *src, size_t n, unsigned char *dst, size_t raw_len);
+
+/* Write the frame for one raw block (n <= LZ_BLOCK) and return its length */
+size_t lz_frame_encode(const unsigned char *raw, size_t n, unsigned char *frame);
+
+/*
+ * Parse a frame header for a block of raw_len bytes: sets the body length
+ * and whether it is stored. Fails on lengths no encoder would write.
+ */
+Status lz_frame_header(const unsigned char *hdr, size_t raw_len, size_t *body_len, int *stored);
+
+/* Worst-case framed size of n raw bytes */
+static inline uint64_t lz_framed_bound(uint64_t n)
+{
+    return n + LZ_FRAME_HEADER * ((n + LZ_BLOCK - 1) / LZ_BLOCK);
+}
+
+#endif
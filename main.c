@@ -1,20 +1,284 @@
 #include <stdio.h>
 #include <string.h>
+#include <stdlib.h>
 #include "encode.h"
 #include "decode.h"
 #include "types.h"
+#include "lsb_kernel.h"
+#include "common.h"
+#include "parallel.h"
+#include "batch.h"
+#include "probe.h"
+#include "stats.h"
+#include "pipe_io.h"
+#include "serve.h"
+#include "bmp_index.h"
+#include "scan.h"
+
+/* Options that may appear anywhere after the operation */
+typedef struct
+{
+    int use_mmap;
+    int in_place;
+    int legacy;
+    int alpha;
+    int compress;
+    int checksum;
+    int stats;
+    int quiet;
+    uint64_t secret_size;
+    int secret_size_given;
+    uint64_t range_offset;
+    uint64_t range_len;
+    int range_given;
+    const char *archive_entry;
+    const char *key;
+    const char *extn;
+    const char *serve;
+    int depth;
+    int threads;
+    size_t block_size;
+    AioMode aio;
+} Options;
 
 void print_usage()
 {
     printf("\nUsage:\n\n");
     printf("For Encoding : ./a.out -e <source_image.bmp> <secret.txt> <output_image.bmp> (OPTIONAL)\n");
     printf("For Decoding : ./a.out -d <stego_image.bmp> <output_file>\n");
+    printf("Pipes        : \"-\" as an image or output streams through stdin/stdout\n");
+    printf("               ./a.out -e - secret.txt - < in.bmp > out.bmp\n");
+    printf("               ./a.out -e - /dev/fd/3 - --secret-size N --ext .txt 3< secret\n");
+    printf("               ./a.out -d - - < stego.bmp > secret\n");
+    printf("For Archive  : ./a.out -a <source_image.bmp> <output_image.bmp> <file>...   (decode with -d\n");
+    printf("               into a directory, or --file NAME for one member)\n");
+    printf("For Inspect  : ./a.out -i <image.bmp | directory>   (header only, one JSON line per image)\n");
+    printf("For Index    : ./a.out -x <image.bmp | directory>   (build <image>%s sidecars: geometry and a\n",
+           BMP_INDEX_SUFFIX);
+    printf("               busy-tile map for capacity queries, reused while the image is unchanged)\n");
+    printf("For Scan     : ./a.out -s <image.bmp | directory>   (chi-square and RS steganalysis, one JSON\n");
+    printf("               line per image with the estimated embedding rate)\n");
+    printf("For Batch    : ./a.out -b <manifest>   (lines: \"e carrier secret output\" / \"d stego output\" /\n");
+    printf("               \"i image\")\n");
+    printf("For Serving  : ./a.out --serve <socket>   (encode/decode/inspect requests over a Unix socket,\n");
+    printf("               one manifest line per length-prefixed message; see serve.h)\n");
+    printf("\nOptions:\n");
+    printf("  --mmap             encode through memory-mapped files instead of stdio\n");
+    printf("  --in-place         -e <stego_image.bmp> <secret>: replace the secret of an existing stego\n");
+    printf("                     image, rewriting only the bytes the old and new payloads cover\n");
+    printf("  --legacy           write the v1 \"#*\" header (32-bit sizes) for old decoders\n");
+    printf("  --depth <1-4>      payload bits per carrier byte when encoding (default 1)\n");
+    printf("  --compress         LZ-compress the secret before embedding (v2 header only)\n");
+    printf("  --checksum         store a CRC32C of the secret, verified on decode (exit status %d on\n",
+           STEGO_EXIT_CHECKSUM);
+    printf("                     mismatch; v2 header only)\n");
+    printf("  --key <KEY>        scatter the payload over the image at positions derived from KEY;\n");
+    printf("                     decoding needs the same KEY (v2 header only; not encryption)\n");
+    printf("  --alpha            embed only in the alpha channel of a 32bpp image (detected on decode,\n");
+    printf("                     except from a pipe)\n");
+    printf("  --secret-size <N>  secret length in bytes, required when the secret is a pipe\n");
+    printf("  --ext <.ext>       extension stored with the secret instead of the one in its name\n");
+    printf("  --range <OFF:LEN>  decode only LEN secret bytes starting at byte OFF\n");
+    printf("  --file <NAME>      decode only the archive member NAME (--range is relative to it)\n");
+    printf("  --block-size <N>   decode pixel slice size in bytes, K/M suffix allowed (64K-4M)\n");
+    printf("  -j <N>             worker threads for the payload (default: number of cores)\n");
+    printf("  --aio <MODE>       encode I/O: auto (io_uring, else I/O threads), uring, threads or off\n");
+    printf("                     (plain stdio); auto overlaps reads and writes with embedding\n");
+    printf("  --stats            print per-stage time, bytes and I/O calls as JSON on stderr\n");
+    printf("  --quiet            suppress progress lines (errors are still printed)\n");
 }
 
 OperationType check_operation_type(char *);
 
+/* Parse a byte count with an optional K or M suffix; 0 on error */
+static size_t parse_size(const char *str)
+{
+    char *end;
+    unsigned long long val = strtoull(str, &end, 10);
+
+    if (end == str)
+        return 0;
+    if (*end == 'K' || *end == 'k')
+        val *= 1024, end++;
+    else if (*end == 'M' || *end == 'm')
+        val *= 1024 * 1024, end++;
+
+    return *end == '\0' ? (size_t)val : 0;
+}
+
+/* Parse OFFSET:LEN byte counts for --range */
+static Status parse_range(const char *str, uint64_t *offset, uint64_t *len)
+{
+    char *end;
+
+    *offset = strtoull(str, &end, 10);
+    if (end == str || *end != ':')
+        return e_failure;
+
+    str = end + 1;
+    *len = strtoull(str, &end, 10);
+    return end != str && *end == '\0' ? e_success : e_failure;
+}
+
+/* Strip options out of argv, leaving positional args in place */
+static int extract_options(int argc, char *argv[], Options *opts)
+{
+    int out = 1;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-j") == 0 && i + 1 < argc)
+        {
+            opts->threads = atoi(argv[++i]);
+            if (opts->threads < 1)
+            {
+                printf(" ❌ ERROR ! -j needs a positive thread count\n");
+                return -1;
+            }
+            continue;
+        }
+
+        if (strncmp(argv[i], "--", 2) != 0)
+        {
+            argv[out++] = argv[i];
+            continue;
+        }
+
+        if (strcmp(argv[i], "--mmap") == 0)
+            opts->use_mmap = 1;
+        else if (strcmp(argv[i], "--in-place") == 0)
+            opts->in_place = 1;
+        else if (strcmp(argv[i], "--legacy") == 0)
+            opts->legacy = 1;
+        else if (strcmp(argv[i], "--alpha") == 0)
+            opts->alpha = 1;
+        else if (strcmp(argv[i], "--compress") == 0)
+            opts->compress = 1;
+        else if (strcmp(argv[i], "--checksum") == 0)
+            opts->checksum = 1;
+        else if (strcmp(argv[i], "--stats") == 0)
+            opts->stats = 1;
+        else if (strcmp(argv[i], "--quiet") == 0)
+            opts->quiet = 1;
+        else if (strcmp(argv[i], "--depth") == 0 && i + 1 < argc)
+        {
+            opts->depth = atoi(argv[++i]);
+            if (opts->depth < 1 || opts->depth > LSB_MAX_DEPTH)
+            {
+                printf(" ❌ ERROR ! Depth must be between 1 and %d\n", LSB_MAX_DEPTH);
+                return -1;
+            }
+        }
+        else if (strcmp(argv[i], "--secret-size") == 0 && i + 1 < argc)
+        {
+            char *end;
+            opts->secret_size = strtoull(argv[++i], &end, 10);
+            if (*end != '\0' || end == argv[i])
+            {
+                printf(" ❌ ERROR ! --secret-size needs a byte count\n");
+                return -1;
+            }
+            opts->secret_size_given = 1;
+        }
+        else if (strcmp(argv[i], "--range") == 0 && i + 1 < argc)
+        {
+            if (parse_range(argv[++i], &opts->range_offset, &opts->range_len) == e_failure)
+            {
+                printf(" ❌ ERROR ! --range needs OFFSET:LEN byte counts\n");
+                return -1;
+            }
+            opts->range_given = 1;
+        }
+        else if (strcmp(argv[i], "--file") == 0 && i + 1 < argc)
+            opts->archive_entry = argv[++i];
+        else if (strcmp(argv[i], "--serve") == 0 && i + 1 < argc)
+            opts->serve = argv[++i];
+        else if (strcmp(argv[i], "--aio") == 0 && i + 1 < argc)
+        {
+            const char *mode = argv[++i];
+            if (strcmp(mode, "auto") == 0)
+                opts->aio = e_aio_auto;
+            else if (strcmp(mode, "uring") == 0)
+                opts->aio = e_aio_uring;
+            else if (strcmp(mode, "threads") == 0)
+                opts->aio = e_aio_threads;
+            else if (strcmp(mode, "off") == 0)
+                opts->aio = e_aio_off;
+            else
+            {
+                printf(" ❌ ERROR ! --aio needs auto, uring, threads or off\n");
+                return -1;
+            }
+        }
+        else if (strcmp(argv[i], "--key") == 0 && i + 1 < argc)
+        {
+            opts->key = argv[++i];
+            if (opts->key[0] == '\0')
+            {
+                printf(" ❌ ERROR ! --key needs a non-empty passphrase\n");
+                return -1;
+            }
+        }
+        else if (strcmp(argv[i], "--ext") == 0 && i + 1 < argc)
+        {
+            opts->extn = argv[++i];
+            if (opts->extn[0] != '.' || strlen(opts->extn) < 2 || strlen(opts->extn) > STEGO_EXTN_MAX)
+            {
+                printf(" ❌ ERROR ! --ext needs an extension like .txt (at most %d characters)\n", STEGO_EXTN_MAX);
+                return -1;
+            }
+        }
+        else if (strcmp(argv[i], "--block-size") == 0 && i + 1 < argc)
+        {
+            opts->block_size = parse_size(argv[++i]);
+            if (opts->block_size < DECODE_BUF_MIN || opts->block_size > DECODE_BUF_MAX)
+            {
+                printf(" ❌ ERROR ! Block size must be between 64K and 4M\n");
+                return -1;
+            }
+        }
+        else
+        {
+            printf(" ❌ ERROR ! Unknown option %s\n", argv[i]);
+            return -1;
+        }
+    }
+
+    argv[out] = NULL;
+    return out;
+}
+
+/* Settings shared by every job of a batch or server run */
+static BatchConfig batch_config(const Options *opts)
+{
+    BatchConfig cfg = {
+        opts->threads, opts->legacy ? STEGO_V1 : STEGO_V2, opts->depth,
+        opts->alpha ? e_channels_alpha : e_channels_all, opts->use_mmap, opts->block_size,
+        opts->compress, opts->checksum, opts->key, opts->aio
+    };
+    return cfg;
+}
+
 int main(int argc, char *argv[])
 {
+    Options opts = {0};
+
+    argc = extract_options(argc, argv, &opts);
+    if (argc < 0)
+    {
+        print_usage();
+        return 1;
+    }
+
+    if (opts.serve != NULL)
+    {
+        lsb_kernel_init();
+        if (opts.threads == 0)
+            opts.threads = parallel_default_threads();
+        BatchConfig serveCfg = batch_config(&opts);
+        return run_serve(opts.serve, &serveCfg) != e_success;
+    }
+
     if(argc < 2)
     {
         printf(" ❌ Error ! Insufficient arguments\n");
@@ -22,43 +286,158 @@ int main(int argc, char *argv[])
         return 1;
     }
 
+    lsb_kernel_init();
+
+    if (opts.threads == 0)
+        opts.threads = parallel_default_threads();
+
     OperationType op = check_operation_type(argv[1]);
 
+    /* Data on stdout: keep progress chatter out of the stream */
+    if ((op == e_encode && argc > 4 && pipe_is_std(argv[4])) ||
+        ((op == e_archive || op == e_decode) && argc > 3 && pipe_is_std(argv[3])))
+        opts.quiet = 1;
+    Stats stats;
+    Stats *statsp = NULL;
+
+    if (opts.stats)
+    {
+        stats_init(&stats);
+        statsp = &stats;
+    }
+
     switch(op)
     {
         case e_encode:
-            printf("Selected operation : Encode\n");
-            EncodeInfo encInfo;
-            if (read_and_validate_encode_args(argv, &encInfo) == e_success)
+        case e_archive:
+            PROGRESS(opts.quiet, "Selected operation : %s\n", op == e_archive ? "Archive" : "Encode");
+            EncodeInfo encInfo = {0};
+            encInfo.use_mmap = opts.use_mmap;
+            encInfo.header_version = opts.legacy ? STEGO_V1 : STEGO_V2;
+            encInfo.depth = opts.depth;
+            encInfo.channels = opts.alpha ? e_channels_alpha : e_channels_all;
+            encInfo.compress = opts.compress;
+            encInfo.checksum = opts.checksum;
+            encInfo.key = opts.key;
+            encInfo.aio = opts.aio;
+            encInfo.threads = opts.threads;
+            encInfo.quiet = opts.quiet;
+            encInfo.stats = statsp;
+            encInfo.secret_size_arg = opts.secret_size;
+            encInfo.secret_size_given = opts.secret_size_given;
+            if (opts.extn != NULL)
+                strcpy(encInfo.extn_secret_file, opts.extn);
+            if (opts.in_place && (op == e_archive || argc > 4))
+            {
+                printf(" ❌ ERROR ! --in-place takes an image and a secret, no output\n");
+                print_usage();
+                return 1;
+            }
+            if ((op == e_archive ? read_and_validate_archive_args(argc, argv, &encInfo)
+                                 : read_and_validate_encode_args(argv, &encInfo)) == e_success)
             {
-                if (do_encoding(&encInfo) != e_success)
+                if (opts.in_place)
+                    encInfo.stego_image_fname = encInfo.src_image_fname;
+                Status ret = opts.in_place ? do_encoding_in_place(&encInfo)
+                             : encInfo.use_mmap ? do_encoding_mmap(&encInfo) : do_encoding(&encInfo);
+                if (ret != e_success)
                     printf(" ❌ ERROR: Encoding failed\n");
+                if (statsp != NULL)
+                    stats_print_json(statsp, "encode", ret, stderr);
+                if (ret != e_success)
+                    return 1;
             }
             else
             {
                 printf(" ❌ ERROR ! Validation failed\n");
                 print_usage();
+                return 1;
             }
             break;
 
         case e_decode:
-            printf("Selected operation : Decode\n");
-            DecodeInfo decInfo;
+            PROGRESS(opts.quiet, "Selected operation : Decode\n");
+            DecodeInfo decInfo = {0};
+            decInfo.buf_size = opts.block_size;
+            decInfo.threads = opts.threads;
+            decInfo.quiet = opts.quiet;
+            decInfo.channels = opts.alpha ? e_channels_alpha : e_channels_all;
+            decInfo.stats = statsp;
+            decInfo.range_given = opts.range_given;
+            decInfo.range_offset = opts.range_offset;
+            decInfo.range_len = opts.range_len;
+            decInfo.archive_entry = opts.archive_entry;
+            decInfo.key = opts.key;
             if (read_and_validate_decode_args(argv, &decInfo) == e_success)
             {
-                if (do_decoding(&decInfo) != e_success)
+                Status ret = do_decoding(&decInfo);
+                if (ret != e_success)
                     printf(" ❌ Error ! Decoding failed\n");
+                if (statsp != NULL)
+                    stats_print_json(statsp, "decode", ret, stderr);
+                if (decInfo.checksum_failed)
+                    return STEGO_EXIT_CHECKSUM;
+                /* A bad --range or --file is only found once the header is read */
+                if (ret != e_success)
+                    return 1;
             }
             else
             {
                 printf(" ❌ Error ! Validation failed\n");
                 print_usage();
+                return 1;
+            }
+            break;
+
+        case e_batch:
+            if (argc < 3)
+            {
+                printf(" ❌ ERROR ! Manifest not provided\n");
+                print_usage();
+                return 1;
+            }
+            BatchConfig batchCfg = batch_config(&opts);
+            if (run_batch(argv[2], &batchCfg) != e_success)
+                return 1;
+            break;
+
+        case e_inspect:
+            if (argc < 3)
+            {
+                printf(" ❌ ERROR ! Image or directory not provided\n");
+                print_usage();
+                return 1;
+            }
+            if (run_probe(argv[2], opts.threads, opts.alpha ? e_channels_alpha : e_channels_all) != e_success)
+                return 1;
+            break;
+
+        case e_index:
+            if (argc < 3)
+            {
+                printf(" ❌ ERROR ! Image or directory not provided\n");
+                print_usage();
+                return 1;
             }
+            if (run_index(argv[2], opts.threads) != e_success)
+                return 1;
+            break;
+
+        case e_scan:
+            if (argc < 3)
+            {
+                printf(" ❌ ERROR ! Image or directory not provided\n");
+                print_usage();
+                return 1;
+            }
+            if (run_scan(argv[2], opts.threads, opts.alpha ? e_channels_alpha : e_channels_all) != e_success)
+                return 1;
             break;
 
         default:
             printf(" ❌ ERROR ! Unsupported operation\n");
             print_usage();
+            return 1;
     }
     return 0;
 }
@@ -71,5 +450,20 @@ OperationType check_operation_type(char *symbol)
     if(strcmp(symbol, "-d") == 0)
         return e_decode;
 
+    if(strcmp(symbol, "-a") == 0)
+        return e_archive;
+
+    if(strcmp(symbol, "-b") == 0)
+        return e_batch;
+
+    if(strcmp(symbol, "-i") == 0)
+        return e_inspect;
+
+    if(strcmp(symbol, "-x") == 0)
+        return e_index;
+
+    if(strcmp(symbol, "-s") == 0)
+        return e_scan;
+
     return e_unsupported;
 }
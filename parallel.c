@@ -0,0 +1,139 @@
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "parallel.h"
+
+typedef struct
+{
+    chunk_fn fn;
+    void *ctx;
+    uint64_t total;
+    uint64_t chunk;
+    uint64_t next;          /* next chunk start, guarded by lock */
+    int failed;
+    pthread_mutex_t lock;
+} ChunkQueue;
+
+typedef struct
+{
+    ChunkQueue *queue;
+    int worker;
+} WorkerArg;
+
+int parallel_default_threads(void)
+{
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (int)n : 1;
+}
+
+static void *chunk_worker(void *arg)
+{
+    WorkerArg *w = arg;
+    ChunkQueue *q = w->queue;
+
+    for (;;)
+    {
+        pthread_mutex_lock(&q->lock);
+        uint64_t start = q->next;
+        int stop = q->failed || start >= q->total;
+        if (!stop)
+            q->next += q->chunk;
+        pthread_mutex_unlock(&q->lock);
+
+        if (stop)
+            break;
+
+        uint64_t len = q->total - start < q->chunk ? q->total - start : q->chunk;
+        if (q->fn(q->ctx, w->worker, start, len) == e_failure)
+        {
+            pthread_mutex_lock(&q->lock);
+            q->failed = 1;
+            pthread_mutex_unlock(&q->lock);
+            break;
+        }
+    }
+
+    return NULL;
+}
+
+Status parallel_for_chunks(int threads, uint64_t total, uint64_t chunk, chunk_fn fn, void *ctx)
+{
+    ChunkQueue q = { fn, ctx, total, chunk, 0, 0, PTHREAD_MUTEX_INITIALIZER };
+    uint64_t nchunks = (total + chunk - 1) / chunk;
+
+    if (threads < 1)
+        threads = 1;
+    if ((uint64_t)threads > nchunks)
+        threads = nchunks > 0 ? (int)nchunks : 1;
+
+    pthread_t *tids = malloc(threads * sizeof(*tids));
+    WorkerArg *args = malloc(threads * sizeof(*args));
+    if (tids == NULL || args == NULL)
+    {
+        free(tids);
+        free(args);
+        return e_failure;
+    }
+
+    /* Worker 0 runs on the calling thread */
+    int started = 1;
+    for (int i = 0; i < threads; i++)
+    {
+        args[i].queue = &q;
+        args[i].worker = i;
+        if (i > 0 && pthread_create(&tids[i], NULL, chunk_worker, &args[i]) == 0)
+            started++;
+        else if (i > 0)
+            break;
+    }
+
+    chunk_worker(&args[0]);
+
+    for (int i = 1; i < started; i++)
+        pthread_join(tids[i], NULL);
+
+    free(tids);
+    free(args);
+    pthread_mutex_destroy(&q.lock);
+
+    return q.failed ? e_failure : e_success;
+}
+
+Status pread_full(int fd, void *buf, size_t len, off_t offset)
+{
+    unsigned char *p = buf;
+
+    while (len > 0)
+    {
+        ssize_t n = pread(fd, p, len, offset);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return e_failure;
+        p += n;
+        len -= (size_t)n;
+        offset += n;
+    }
+
+    return e_success;
+}
+
+Status pwrite_full(int fd, const void *buf, size_t len, off_t offset)
+{
+    const unsigned char *p = buf;
+
+    while (len > 0)
+    {
+        ssize_t n = pwrite(fd, p, len, offset);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return e_failure;
+        p += n;
+        len -= (size_t)n;
+        offset += n;
+    }
+
+    return e_success;
+}
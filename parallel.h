@@ -0,0 +1,31 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <stdint.h>
+#include <sys/types.h>
+#include "types.h"
+
+/* Payload bytes handed to a worker at a time */
+#define PARALLEL_CHUNK (256 * 1024)
+
+/* Payloads smaller than this are not worth spinning up threads for */
+#define PARALLEL_MIN_PAYLOAD (4 * PARALLEL_CHUNK)
+
+/* Process payload bytes [start, start + len) on worker number `worker` */
+typedef Status (*chunk_fn)(void *ctx, int worker, uint64_t start, uint64_t len);
+
+/* Number of online cores (at least 1) */
+int parallel_default_threads(void);
+
+/*
+ * Split [0, total) into chunks and run fn on them from `threads` workers.
+ * Workers pull the next chunk from a shared counter; the first failure
+ * stops the remaining chunks from being started.
+ */
+Status parallel_for_chunks(int threads, uint64_t total, uint64_t chunk, chunk_fn fn, void *ctx);
+
+/* Positional I/O that retries short transfers; e_failure on error or EOF */
+Status pread_full(int fd, void *buf, size_t len, off_t offset);
+Status pwrite_full(int fd, const void *buf, size_t len, off_t offset);
+
+#endif
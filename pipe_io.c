@@ -0,0 +1,35 @@
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "pipe_io.h"
+
+FILE *pipe_stdin(void)
+{
+    return stdin;
+}
+
+FILE *pipe_stdout(void)
+{
+    fflush(stdout);
+
+    int fd = dup(STDOUT_FILENO);
+    if (fd < 0)
+        return NULL;
+
+    FILE *fp = fdopen(fd, "wb");
+    if (fp == NULL)
+    {
+        close(fd);
+        return NULL;
+    }
+
+    dup2(STDERR_FILENO, STDOUT_FILENO);
+    return fp;
+}
+
+int pipe_is_seekable(FILE *fp)
+{
+    struct stat st;
+
+    return fstat(fileno(fp), &st) == 0 && S_ISREG(st.st_mode);
+}
@@ -0,0 +1,28 @@
+#ifndef PIPE_IO_H
+#define PIPE_IO_H
+
+#include <stdio.h>
+#include <string.h>
+
+/*
+ * "-" in place of a file name streams through stdin / stdout. Pipes
+ * cannot seek, so such runs read everything front to back exactly once.
+ */
+static inline int pipe_is_std(const char *fname)
+{
+    return fname != NULL && strcmp(fname, "-") == 0;
+}
+
+/* stdin as the binary input stream */
+FILE *pipe_stdin(void);
+
+/*
+ * The original stdout as the binary output stream. Progress and error
+ * lines printed afterwards go to stderr so they cannot corrupt the data.
+ */
+FILE *pipe_stdout(void);
+
+/* Non-zero if fp refers to a regular file (positional I/O allowed) */
+int pipe_is_seekable(FILE *fp);
+
+#endif
@@ -0,0 +1,259 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <pthread.h>
+#include <time.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include "probe.h"
+#include "decode.h"
+#include "common.h"
+#include "parallel.h"
+#include "stats.h"
+#include "crc32c.h"
+
+/* State shared by the probe workers */
+typedef struct
+{
+    char **files;
+    ChannelMode channels;
+
+    pthread_mutex_t out_lock;   /* guards stdout and the counters below */
+    uint64_t stego;
+    uint64_t clean;
+    uint64_t errors;
+} ProbeRun;
+
+static double now_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+Status probe_image(const char *fname, ChannelMode channels, ProbeResult *res)
+{
+    DecodeInfo decInfo = {0};
+    unsigned char slice[PROBE_BUF_SIZE];
+
+    memset(res, 0, sizeof(*res));
+    decInfo.stego_image_fname = (char *)fname;
+    decInfo.img_buf = slice;
+    decInfo.buf_size = sizeof(slice);
+    decInfo.channels = channels;
+    decInfo.quiet = 1;
+    decInfo.probe = 1;
+
+    decInfo.fptr_stego_image = fopen(fname, "rb");
+    if (decInfo.fptr_stego_image == NULL)
+    {
+        res->error = "unable to open the file";
+        return e_failure;
+    }
+
+    if (bmp_read_header(decInfo.fptr_stego_image, &decInfo.bmp) == e_failure ||
+        bmp_select_channels(&decInfo.bmp, channels) == e_failure)
+    {
+        res->error = decInfo.bmp.error;
+        close_decode_files(&decInfo);
+        return e_failure;
+    }
+    decInfo.raw_left = decInfo.bmp.pixel_bytes;
+
+    /* Only the header stages run; the slice never refills past the first read */
+    if (decode_magic_string(&decInfo) == e_success &&
+        decode_header_flags(&decInfo) == e_success &&
+        decode_secret_file_extn_size(&decInfo) == e_success &&
+        decode_secret_file_extn(&decInfo) == e_success &&
+        decode_secret_file_size(&decInfo) == e_success)
+    {
+        uint64_t room = (decInfo.bmp.carrier_bytes - decInfo.carrier_pos) * decInfo.depth / 8;
+
+        /* A keyed layout only uses whole groups */
+        if (decInfo.header_flags & STEGO_FLAG_SCATTER)
+            room = (decInfo.bmp.carrier_bytes - decInfo.carrier_pos) / 8 * decInfo.depth;
+
+        /* The checksum trailer takes payload room after the secret */
+        if (decInfo.header_flags & STEGO_FLAG_CRC)
+            room = room > CRC32C_BYTES ? room - CRC32C_BYTES : 0;
+
+        res->compressed = (decInfo.header_flags & STEGO_FLAG_LZ) != 0;
+        if (res->compressed || decInfo.size_secret_file <= room)
+        {
+            res->stego = 1;
+            res->archive = (decInfo.header_flags & STEGO_FLAG_ARCHIVE) != 0;
+            res->checksum = (decInfo.header_flags & STEGO_FLAG_CRC) != 0;
+            res->keyed = (decInfo.header_flags & STEGO_FLAG_SCATTER) != 0;
+            res->header_version = decInfo.header_version;
+            res->depth = decInfo.depth;
+            res->channels = decInfo.bmp.channels;
+            strcpy(res->extn, decInfo.extn_secret_file);
+            res->secret_size = decInfo.size_secret_file;
+            res->remaining = res->compressed ? 0 : room - decInfo.size_secret_file;
+        }
+    }
+
+    if (!res->stego)
+    {
+        /* Clean image: everything is free at depth 1 in the requested channels */
+        bmp_select_channels(&decInfo.bmp, channels);
+        res->channels = decInfo.bmp.channels;
+        res->remaining = decInfo.bmp.carrier_bytes / 8;
+    }
+
+    close_decode_files(&decInfo);
+    return e_success;
+}
+
+void probe_print_json(const char *fname, Status status, const ProbeResult *res, FILE *out)
+{
+    fprintf(out, "{\"file\":");
+    json_print_string(fname, out);
+
+    if (status == e_failure)
+    {
+        fprintf(out, ",\"error\":");
+        json_print_string(res->error, out);
+        fprintf(out, "}");
+        return;
+    }
+
+    fprintf(out, ",\"stego\":%s,\"channels\":\"%s\"", res->stego ? "true" : "false",
+            res->channels == e_channels_alpha ? "alpha" : "all");
+    if (res->stego)
+    {
+        fprintf(out, ",\"version\":%d,\"depth\":%d,\"compressed\":%s,\"extension\":",
+                res->header_version, res->depth, res->compressed ? "true" : "false");
+        json_print_string(res->extn, out);
+        fprintf(out, ",\"archive\":%s,\"checksum\":%s,\"keyed\":%s,\"payload_bytes\":%llu",
+                res->archive ? "true" : "false", res->checksum ? "true" : "false", res->keyed ? "true" : "false",
+                (unsigned long long)res->secret_size);
+    }
+
+    if (res->stego && res->compressed)
+        fprintf(out, ",\"remaining_bytes\":null}");
+    else
+        fprintf(out, ",\"remaining_bytes\":%llu}", (unsigned long long)res->remaining);
+}
+
+/* One JSON line per image; the caller holds the output lock */
+static void print_result(const char *fname, Status status, const ProbeResult *res)
+{
+    probe_print_json(fname, status, res, stdout);
+    printf("\n");
+}
+
+static Status probe_job(void *ctx, int worker, uint64_t index, uint64_t len)
+{
+    ProbeRun *run = ctx;
+    ProbeResult res;
+    const char *fname = run->files[index];
+
+    (void)worker;
+    (void)len;
+    Status status = probe_image(fname, run->channels, &res);
+
+    pthread_mutex_lock(&run->out_lock);
+    if (status == e_failure)
+        run->errors++;
+    else if (res.stego)
+        run->stego++;
+    else
+        run->clean++;
+    print_result(fname, status, &res);
+    pthread_mutex_unlock(&run->out_lock);
+
+    return e_success;
+}
+
+char **list_bmp_files(const char *dir, size_t *count)
+{
+    DIR *dp = opendir(dir);
+    char **files = NULL;
+    size_t n = 0, cap = 0;
+    struct dirent *ent;
+
+    if (dp == NULL)
+        return NULL;
+
+    while ((ent = readdir(dp)) != NULL)
+    {
+        const char *dot = strrchr(ent->d_name, '.');
+        if (dot == NULL || strcasecmp(dot, ".bmp") != 0 ||
+            (ent->d_type != DT_REG && ent->d_type != DT_UNKNOWN))
+            continue;
+
+        if (n == cap)
+        {
+            cap = cap ? 2 * cap : 1024;
+            char **grown = realloc(files, cap * sizeof(*files));
+            if (grown == NULL)
+                break;
+            files = grown;
+        }
+
+        size_t len = strlen(dir) + strlen(ent->d_name) + 2;
+        files[n] = malloc(len);
+        if (files[n] == NULL)
+            break;
+        snprintf(files[n], len, "%s/%s", dir, ent->d_name);
+        n++;
+    }
+
+    closedir(dp);
+    *count = n;
+    if (files == NULL)
+        files = calloc(1, sizeof(*files));
+    return files;
+}
+
+Status run_probe(const char *path, int workers, ChannelMode channels)
+{
+    struct stat st;
+
+    if (stat(path, &st) != 0)
+    {
+        perror("stat");
+        printf("Error! Unable to inspect %s\n", path);
+        return e_failure;
+    }
+
+    if (!S_ISDIR(st.st_mode))
+    {
+        ProbeResult res;
+        Status status = probe_image(path, channels, &res);
+        print_result(path, status, &res);
+        return status;
+    }
+
+    size_t nfiles = 0;
+    char **files = list_bmp_files(path, &nfiles);
+    if (files == NULL)
+    {
+        printf("Error! Unable to read directory %s\n", path);
+        return e_failure;
+    }
+
+    if (workers < 1)
+        workers = 1;
+    if ((size_t)workers > nfiles)
+        workers = nfiles > 0 ? (int)nfiles : 1;
+
+    ProbeRun run = { files, channels, PTHREAD_MUTEX_INITIALIZER, 0, 0, 0 };
+    double start = now_seconds();
+    parallel_for_chunks(workers, nfiles, 1, probe_job, &run);
+    double elapsed = now_seconds() - start;
+
+    printf("{\"summary\":{\"files\":%zu,\"stego\":%llu,\"clean\":%llu,\"errors\":%llu,\"workers\":%d,"
+           "\"seconds\":%.3f,\"files_per_sec\":%.1f}}\n",
+           nfiles, (unsigned long long)run.stego, (unsigned long long)run.clean,
+           (unsigned long long)run.errors, workers, elapsed, elapsed > 0 ? nfiles / elapsed : 0.0);
+
+    for (size_t i = 0; i < nfiles; i++)
+        free(files[i]);
+    free(files);
+    pthread_mutex_destroy(&run.out_lock);
+
+    return e_success;
+}
@@ -0,0 +1,52 @@
+#ifndef PROBE_H
+#define PROBE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include "types.h"
+#include "bmp.h"
+#include "stego.h"
+
+/*
+ * Inspect mode (-i): decode only the stego header of an image, or of
+ * every .bmp in a directory, and print one JSON line per image.
+ */
+
+/* Decode slice for a probe: holds the largest header even in alpha-only mode */
+#define PROBE_BUF_SIZE 1024
+
+typedef struct
+{
+    int stego;                  /* a header with a plausible size was found */
+    int header_version;
+    int depth;
+    int compressed;             /* remaining is unknown without reading the frames */
+    int archive;                /* the secret is a multi-file archive */
+    int checksum;               /* a CRC32C of the secret follows it */
+    int keyed;                  /* the payload is scattered by a key */
+    ChannelMode channels;
+    char extn[STEGO_EXTN_MAX + 1];
+    uint64_t secret_size;
+    uint64_t remaining;         /* payload bytes still free at this depth */
+    const char *error;          /* unreadable or unsupported image */
+} ProbeResult;
+
+/* Probe one image; e_failure (with res->error set) if it cannot be parsed */
+Status probe_image(const char *fname, ChannelMode channels, ProbeResult *res);
+
+/* The JSON object for one probed image, without a trailing newline */
+void probe_print_json(const char *fname, Status status, const ProbeResult *res, FILE *out);
+
+/*
+ * "dir/name" for every *.bmp entry directly inside dir (count set), or
+ * NULL if dir cannot be read; the caller frees each name and the array.
+ */
+char **list_bmp_files(const char *dir, size_t *count);
+
+/*
+ * Probe a file, or every .bmp directly inside a directory on `workers`
+ * threads (followed by a summary line). Fails if path cannot be read.
+ */
+Status run_probe(const char *path, int workers, ChannelMode channels);
+
+#endif
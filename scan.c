@@ -0,0 +1,360 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/stat.h>
+#include "scan.h"
+#include "parallel.h"
+#include "probe.h"
+#include "stats.h"
+#include "lsb_kernel.h"
+
+/* Widest pixel row the scanner buffers */
+#define SCAN_ROW_MAX (256 * 1024 * 1024)
+
+/* Per-image counters; heap allocated, the histograms are 256 KB */
+typedef struct
+{
+    uint64_t hist[SCAN_SEGMENTS][4][256];  /* four partial tables per segment */
+    uint64_t rs[8];             /* R+M, S+M, R-M, S-M; then the same with every LSB flipped */
+    uint64_t groups;
+} ScanCounts;
+
+/* State shared by the scan workers */
+typedef struct
+{
+    char **files;
+    ChannelMode channels;
+
+    pthread_mutex_t out_lock;   /* guards stdout and the counters below */
+    uint64_t suspicious;
+    uint64_t tagged;
+    uint64_t errors;
+    uint64_t bytes;
+} ScanRun;
+
+static double now_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * Count n bytes, stride apart, into four partial histograms: consecutive
+ * increments hit different tables, so runs of equal bytes do not stall
+ * on the same counter.
+ */
+static void count_bytes(const unsigned char *p, uint64_t n, uint32_t stride, uint64_t (*h)[256])
+{
+    uint64_t i = 0;
+
+    for (; i + 4 <= n; i += 4, p += 4 * stride)
+    {
+        h[0][p[0]]++;
+        h[1][p[stride]]++;
+        h[2][p[2 * stride]]++;
+        h[3][p[3 * stride]]++;
+    }
+    for (; i < n; i++, p += stride)
+        h[0][*p]++;
+}
+
+/*
+ * RS groups are four neighbouring pixels of one channel along the row.
+ * The mask marks the first byte of each group in the row; lsb_rs_count
+ * classifies the marked positions, n bytes in. Returns n, 0 when the row
+ * holds no whole group.
+ */
+static uint64_t rs_mask(int32_t width, uint32_t px, uint32_t first, uint32_t nchannels, unsigned char *mask)
+{
+    uint64_t n = width >= 4 ? ((uint64_t)(width / 4) * 4 - 3) * px : 0;
+
+    for (uint64_t i = 0; i < n; i++)
+    {
+        uint32_t ch = i % px;
+        mask[i] = (i / px) % 4 == 0 && ch >= first && ch < first + nchannels ? 0xFF : 0;
+    }
+    return n;
+}
+
+/* Upper tail of the chi-square distribution (Wilson-Hilferty approximation) */
+static double chi_square_tail(double chi, int df)
+{
+    double v = 2.0 / (9.0 * df);
+    double z = (cbrt(chi / df) - (1.0 - v)) / sqrt(v);
+
+    return 0.5 * erfc(z / sqrt(2.0));
+}
+
+/* p-value that the pairs 2k/2k+1 were evened out by LSB replacement */
+static double chi_square_p(const uint64_t *hist)
+{
+    double chi = 0;
+    int pairs = 0;
+
+    for (int k = 0; k < 128; k++)
+    {
+        double expect = (hist[2 * k] + hist[2 * k + 1]) / 2.0;
+
+        /* Sparse categories only add noise */
+        if (expect < 5)
+            continue;
+        double diff = hist[2 * k] - expect;
+        chi += diff * diff / expect;
+        pairs++;
+    }
+
+    return pairs < 2 ? 0.0 : chi_square_tail(chi, pairs - 1);
+}
+
+/* Solve the RS equations for the embedding rate, clipped to [0, 1] */
+static double rs_estimate(const ScanCounts *sc)
+{
+    if (sc->groups == 0)
+        return 0.0;
+
+    double n = (double)sc->groups;
+    double d0 = (sc->rs[0] - (double)sc->rs[1]) / n;
+    double dn0 = (sc->rs[2] - (double)sc->rs[3]) / n;
+    double d1 = (sc->rs[4] - (double)sc->rs[5]) / n;
+    double dn1 = (sc->rs[6] - (double)sc->rs[7]) / n;
+    double a = 2 * (d1 + d0), b = dn0 - dn1 - d1 - 3 * d0, c = d0 - dn0;
+    double x;
+
+    if (fabs(a) < 1e-12)
+    {
+        if (fabs(b) < 1e-12)
+            return 0.0;
+        x = -c / b;
+    }
+    else
+    {
+        double disc = b * b - 4 * a * c;
+        double root = sqrt(disc > 0 ? disc : 0);
+        double x1 = (-b + root) / (2 * a), x2 = (-b - root) / (2 * a);
+        x = fabs(x1) < fabs(x2) ? x1 : x2;
+    }
+
+    double p = x / (x - 0.5);
+    return p < 0 ? 0.0 : p > 1 ? 1.0 : p;
+}
+
+/* Fold the per-segment counts into the chi-square results */
+static void chi_square_rates(const ScanCounts *sc, ScanResult *res)
+{
+    uint64_t prefix[256] = {0};
+    int embedded = 1;
+
+    /* The longest prefix that still looks embedded, as a sequential embedder leaves it */
+    for (int s = 0; s < SCAN_SEGMENTS; s++)
+    {
+        for (int v = 0; v < 256; v++)
+            prefix[v] += sc->hist[s][0][v] + sc->hist[s][1][v] + sc->hist[s][2][v] + sc->hist[s][3][v];
+
+        res->chi_p = chi_square_p(prefix);
+        if (embedded && res->chi_p > 0.5)
+            res->chi_rate = (double)(s + 1) / SCAN_SEGMENTS;
+        else
+            embedded = 0;
+    }
+}
+
+/* Read the pixel rows and gather the counts */
+static Status scan_pixels(FILE *fp, const BmpInfo *bmp, ScanCounts *sc, ScanResult *res)
+{
+    uint32_t px = bmp->bpp / 8;
+    uint32_t first = bmp->carrier_channel;
+    uint32_t nchannels = bmp->channels == e_channels_alpha ? 1 : px;
+    uint64_t rows = bmp->pixel_bytes / bmp->row_stride;
+    uint64_t per_read = SCAN_BUF_SIZE / bmp->row_stride > 0 ? SCAN_BUF_SIZE / bmp->row_stride : 1;
+    uint64_t row_groups = (uint64_t)(bmp->width / 4) * nchannels;
+    uint64_t rs_len;
+    unsigned char *buf, *mask;
+
+    if (bmp->row_stride > SCAN_ROW_MAX)
+    {
+        res->error = "pixel rows too wide to scan";
+        return e_failure;
+    }
+    if ((buf = malloc(per_read * bmp->row_stride)) == NULL)
+    {
+        res->error = "out of memory";
+        return e_failure;
+    }
+    if ((mask = malloc(bmp->row_stride)) == NULL)
+    {
+        res->error = "out of memory";
+        free(buf);
+        return e_failure;
+    }
+    rs_len = rs_mask(bmp->width, px, first, nchannels, mask);
+
+    for (uint64_t r = 0; r < rows;)
+    {
+        uint64_t n = rows - r < per_read ? rows - r : per_read;
+
+        if (fread(buf, bmp->row_stride, n, fp) != n)
+        {
+            res->error = "unable to read the pixel data";
+            free(mask);
+            free(buf);
+            return e_failure;
+        }
+
+        for (uint64_t i = 0; i < n; i++, r++)
+        {
+            const unsigned char *row = buf + i * bmp->row_stride;
+            uint64_t (*h)[256] = sc->hist[r * SCAN_SEGMENTS / rows];
+
+            /* Row padding carries nothing worth testing */
+            if (nchannels == px)
+                count_bytes(row, (uint64_t)bmp->width * px, 1, h);
+            else
+                count_bytes(row + first, (uint64_t)bmp->width, px, h);
+            lsb_rs_count(row, mask, rs_len, px, sc->rs);
+            sc->groups += row_groups;
+        }
+    }
+
+    res->bytes = rows * (uint64_t)bmp->width * nchannels;
+    free(mask);
+    free(buf);
+    return e_success;
+}
+
+Status scan_image(const char *fname, ChannelMode channels, ScanResult *res)
+{
+    BmpInfo bmp;
+    ProbeResult probe;
+    ScanCounts *sc;
+    Status ret = e_failure;
+
+    memset(res, 0, sizeof(*res));
+    FILE *fp = fopen(fname, "rb");
+    if (fp == NULL)
+    {
+        res->error = "unable to open the file";
+        return e_failure;
+    }
+
+    if (bmp_read_header(fp, &bmp) == e_failure ||
+        bmp_select_channels(&bmp, channels) == e_failure)
+        res->error = bmp.error;
+    else if ((sc = calloc(1, sizeof(*sc))) == NULL)
+        res->error = "out of memory";
+    else
+    {
+        ret = scan_pixels(fp, &bmp, sc, res);
+        if (ret == e_success)
+        {
+            chi_square_rates(sc, res);
+            res->rs_rate = rs_estimate(sc);
+            res->suspicion = res->chi_rate > res->rs_rate ? res->chi_rate : res->rs_rate;
+        }
+        free(sc);
+    }
+    fclose(fp);
+
+    /* Our own payloads are reported as such, not only as a score */
+    if (ret == e_success && probe_image(fname, channels, &probe) == e_success)
+        res->tagged = probe.stego;
+    return ret;
+}
+
+/* One JSON line per image; the caller holds the output lock */
+static void print_result(const char *fname, Status status, const ScanResult *res)
+{
+    printf("{\"file\":");
+    json_print_string(fname, stdout);
+
+    if (status == e_failure)
+    {
+        printf(",\"error\":");
+        json_print_string(res->error, stdout);
+        printf("}\n");
+        return;
+    }
+
+    printf(",\"tagged\":%s,\"bytes\":%llu,\"chi_square_p\":%.4f,\"chi_square_rate\":%.3f,\"rs_rate\":%.3f,"
+           "\"suspicion\":%.3f}\n",
+           res->tagged ? "true" : "false", (unsigned long long)res->bytes, res->chi_p, res->chi_rate,
+           res->rs_rate, res->suspicion);
+}
+
+static Status scan_job(void *ctx, int worker, uint64_t index, uint64_t len)
+{
+    ScanRun *run = ctx;
+    ScanResult res;
+    const char *fname = run->files[index];
+
+    (void)worker;
+    (void)len;
+    Status status = scan_image(fname, run->channels, &res);
+
+    pthread_mutex_lock(&run->out_lock);
+    if (status == e_failure)
+        run->errors++;
+    else
+    {
+        run->bytes += res.bytes;
+        run->tagged += res.tagged;
+        run->suspicious += res.suspicion >= SCAN_SUSPICIOUS;
+    }
+    print_result(fname, status, &res);
+    pthread_mutex_unlock(&run->out_lock);
+
+    return e_success;
+}
+
+Status run_scan(const char *path, int workers, ChannelMode channels)
+{
+    struct stat st;
+
+    if (stat(path, &st) != 0)
+    {
+        perror("stat");
+        printf("Error! Unable to scan %s\n", path);
+        return e_failure;
+    }
+
+    if (!S_ISDIR(st.st_mode))
+    {
+        ScanResult res;
+        Status status = scan_image(path, channels, &res);
+        print_result(path, status, &res);
+        return status;
+    }
+
+    size_t nfiles = 0;
+    char **files = list_bmp_files(path, &nfiles);
+    if (files == NULL)
+    {
+        printf("Error! Unable to read directory %s\n", path);
+        return e_failure;
+    }
+
+    if (workers < 1)
+        workers = 1;
+    if ((size_t)workers > nfiles)
+        workers = nfiles > 0 ? (int)nfiles : 1;
+
+    ScanRun run = { files, channels, PTHREAD_MUTEX_INITIALIZER, 0, 0, 0, 0 };
+    double start = now_seconds();
+    parallel_for_chunks(workers, nfiles, 1, scan_job, &run);
+    double elapsed = now_seconds() - start;
+
+    printf("{\"summary\":{\"files\":%zu,\"suspicious\":%llu,\"tagged\":%llu,\"errors\":%llu,\"workers\":%d,"
+           "\"seconds\":%.3f,\"mb_per_sec\":%.1f}}\n",
+           nfiles, (unsigned long long)run.suspicious, (unsigned long long)run.tagged,
+           (unsigned long long)run.errors, workers, elapsed, elapsed > 0 ? run.bytes / elapsed / 1e6 : 0.0);
+
+    for (size_t i = 0; i < nfiles; i++)
+        free(files[i]);
+    free(files);
+    pthread_mutex_destroy(&run.out_lock);
+
+    return e_success;
+}
@@ -0,0 +1,54 @@
+#ifndef SCAN_H
+#define SCAN_H
+
+#include <stdint.h>
+#include "types.h"
+#include "bmp.h"
+
+/*
+ * Scan mode (-s): LSB steganalysis of an image, or of every .bmp in a
+ * directory, for payloads with or without our header. Two estimates per
+ * image, over the carrier bytes of the selected channels:
+ *
+ *  - chi-square pair analysis (Westfeld-Pfitzmann): LSB replacement
+ *    evens out the counts of each value pair 2k/2k+1. The p-value is
+ *    taken over growing prefixes of the pixel array; the longest prefix
+ *    that still looks embedded estimates a sequential payload.
+ *  - RS analysis (Fridrich): regular/singular group counts under the
+ *    flipping masks +M and -M, on the image and with every LSB flipped,
+ *    give the embedding rate of randomly spread payloads too.
+ *
+ * One JSON line per image with both rates and a suspicion score (the
+ * larger one), plus a summary line with the throughput for a directory.
+ */
+
+/* Prefixes the chi-square test is run on */
+#define SCAN_SEGMENTS 32
+
+/* Suspicion at or above which an image counts as suspicious in the summary */
+#define SCAN_SUSPICIOUS 0.2
+
+/* Pixel rows read per step, at least one row */
+#define SCAN_BUF_SIZE (1024 * 1024)
+
+typedef struct
+{
+    int tagged;                 /* our own stego header is present */
+    uint64_t bytes;             /* carrier bytes analysed */
+    double chi_p;               /* chi-square p-value over the whole carrier */
+    double chi_rate;            /* fraction of the carrier (from the start) that looks embedded */
+    double rs_rate;             /* RS estimate of the embedding rate */
+    double suspicion;           /* max of the two rates, 0..1 */
+    const char *error;
+} ScanResult;
+
+/* Analyse one image; e_failure (res->error set) if it cannot be read */
+Status scan_image(const char *fname, ChannelMode channels, ScanResult *res);
+
+/*
+ * Scan a file, or every .bmp directly inside a directory on `workers`
+ * threads (followed by a summary line). Fails if path cannot be read.
+ */
+Status run_scan(const char *path, int workers, ChannelMode channels);
+
+#endif
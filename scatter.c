@@ -0,0 +1,113 @@
+#include <string.h>
+#include "scatter.h"
+#include "crc32c.h"
+#include "lz.h"
+
+uint64_t scatter_seed(const char *key)
+{
+    uint64_t h = 0xCBF29CE484222325ULL;    /* FNV-1a */
+
+    for (; *key != '\0'; key++)
+        h = (h ^ (unsigned char)*key) * 0x100000001B3ULL;
+    return scatter_mix(h);
+}
+
+/* floor(rem * 2^64 / div) for rem < div, by shift-and-subtract */
+static uint64_t frac_div(uint64_t rem, uint64_t div)
+{
+    uint64_t q = 0;
+
+    for (int i = 63; i >= 0; i--)
+    {
+        int carry = rem >> 63;
+
+        rem <<= 1;
+        if (carry || rem >= div)
+        {
+            rem -= div;
+            q |= 1ULL << i;
+        }
+    }
+    return q;
+}
+
+Status scatter_init(ScatterMap *map, uint64_t seed, uint64_t first, uint64_t carrier_bytes,
+                    uint64_t secret_size, int compressed, int checksum, int depth)
+{
+    uint64_t payload = compressed ? lz_framed_bound(secret_size) : secret_size;
+
+    memset(map, 0, sizeof(*map));
+    if (first > carrier_bytes)
+        return e_failure;
+
+    map->seed = seed;
+    map->first = first;
+    map->units = (carrier_bytes - first) / 8;
+    map->groups = scatter_groups(payload + (checksum ? CRC32C_BYTES : 0), depth);
+
+    if (map->groups > map->units)
+    {
+        if (!compressed)
+            return e_failure;
+        map->groups = map->units;
+    }
+    if (map->groups > 0)
+    {
+        map->tile = map->units / map->groups;
+        map->tile_frac = frac_div(map->units % map->groups, map->groups);
+    }
+    return e_success;
+}
+
+size_t scatter_window(const ScatterMap *map, uint64_t g, uint64_t left, uint64_t w, uint64_t end, uint64_t max,
+                      uint64_t *limit)
+{
+    size_t n = 0;
+
+    *limit = end - w > max ? w + max : end;
+    while (n < left)
+    {
+        uint64_t pos = scatter_pos(map, g + n);
+
+        if (pos >= *limit)
+            break;
+        /* A group straddling the end starts the next window */
+        if (pos + 8 > *limit)
+        {
+            *limit = pos;
+            break;
+        }
+        n++;
+    }
+    return n;
+}
+
+void scatter_gather(const ScatterMap *map, const BmpInfo *bmp, const unsigned char *raw, uint64_t base,
+                    uint64_t g, size_t n, unsigned char *packed)
+{
+    for (size_t i = 0; i < n; i++)
+    {
+        uint64_t pos = scatter_pos(map, g + i);
+        const unsigned char *src = raw + (bmp_raw_pos(bmp, pos) - bmp_raw_pos(bmp, base));
+
+        if (bmp_contiguous(bmp))
+            memcpy(packed + 8 * i, src, 8);
+        else
+            bmp_gather(bmp, src, pos, 8, packed + 8 * i);
+    }
+}
+
+void scatter_put(const ScatterMap *map, const BmpInfo *bmp, const unsigned char *packed, uint64_t base,
+                 uint64_t g, size_t n, unsigned char *raw)
+{
+    for (size_t i = 0; i < n; i++)
+    {
+        uint64_t pos = scatter_pos(map, g + i);
+        unsigned char *dst = raw + (bmp_raw_pos(bmp, pos) - bmp_raw_pos(bmp, base));
+
+        if (bmp_contiguous(bmp))
+            memcpy(dst, packed + 8 * i, 8);
+        else
+            bmp_scatter(bmp, packed + 8 * i, pos, 8, dst);
+    }
+}
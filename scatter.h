@@ -0,0 +1,106 @@
+#ifndef SCATTER_H
+#define SCATTER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "types.h"
+#include "bmp.h"
+
+/*
+ * Keyed scattered embedding (v2 flag STEGO_FLAG_SCATTER). The carrier
+ * bytes after the header are cut into units of 8, one depth group each.
+ * Payload group g of U gets its own tile of the A units,
+ * [g * A / U, (g + 1) * A / U), and sits at an offset inside it drawn from
+ * a counter-based PRNG keyed by the passphrase. Positions rise with g, so
+ * encode and decode still sweep the carrier in order, and any group's
+ * position is computed directly: ranges and workers start anywhere.
+ *
+ * The key only places the groups; it does not encrypt them.
+ */
+
+typedef struct
+{
+    uint64_t seed;              /* from the key */
+    uint64_t first;             /* carrier byte where the region starts */
+    uint64_t units;             /* 8-byte units in the region */
+    uint64_t groups;            /* payload groups dealt out over them */
+    uint64_t tile;              /* whole units per tile ... */
+    uint64_t tile_frac;         /* ... plus this fraction of 2^64 */
+} ScatterMap;
+
+/* 64-bit seed for a passphrase */
+uint64_t scatter_seed(const char *key);
+
+/*
+ * Plan the region [first, carrier_bytes) for a secret: its groups plus
+ * the checksum's. A compressed secret plans for its incompressible bound,
+ * capped at the units there are. Fails if an uncompressed secret does not
+ * fit.
+ */
+Status scatter_init(ScatterMap *map, uint64_t seed, uint64_t first, uint64_t carrier_bytes,
+                    uint64_t secret_size, int compressed, int checksum, int depth);
+
+/* Groups of payload at most `payload` bytes long fill at this depth */
+static inline uint64_t scatter_groups(uint64_t payload, int depth)
+{
+    return (payload + depth - 1) / depth;
+}
+
+/* splitmix64 finalizer */
+static inline uint64_t scatter_mix(uint64_t x)
+{
+    x += 0x9E3779B97F4A7C15ULL;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+    return x ^ (x >> 31);
+}
+
+/* High 64 bits of the 128-bit product a * b */
+static inline uint64_t scatter_mulhi(uint64_t a, uint64_t b)
+{
+#ifdef __SIZEOF_INT128__
+    return (uint64_t)(((unsigned __int128)a * b) >> 64);
+#else
+    uint64_t a_lo = (uint32_t)a, a_hi = a >> 32;
+    uint64_t b_lo = (uint32_t)b, b_hi = b >> 32;
+    uint64_t lo_lo = a_lo * b_lo, hi_lo = a_hi * b_lo, lo_hi = a_lo * b_hi;
+    uint64_t mid = (lo_lo >> 32) + (uint32_t)hi_lo + (uint32_t)lo_hi;
+
+    return a_hi * b_hi + (hi_lo >> 32) + (lo_hi >> 32) + (mid >> 32);
+#endif
+}
+
+/* First unit of tile g */
+static inline uint64_t scatter_tile(const ScatterMap *map, uint64_t g)
+{
+    return g * map->tile + scatter_mulhi(g, map->tile_frac);
+}
+
+/* Carrier byte holding the first bit of payload group g (g < map->groups) */
+static inline uint64_t scatter_pos(const ScatterMap *map, uint64_t g)
+{
+    uint64_t lo = scatter_tile(map, g);
+    uint64_t width = scatter_tile(map, g + 1) - lo;
+    uint64_t r = scatter_mix(map->seed ^ (g * 0xD6E8FEB86659FD93ULL));
+
+    return map->first + 8 * (lo + scatter_mulhi(r, width));
+}
+
+/*
+ * Next window of an in-order sweep over carrier bytes [w, end): at most
+ * max bytes, never splitting a group. Sets *limit to its end and returns
+ * how many of the left groups from g lie inside it.
+ */
+size_t scatter_window(const ScatterMap *map, uint64_t g, uint64_t left, uint64_t w, uint64_t end, uint64_t max,
+                      uint64_t *limit);
+
+/*
+ * Move groups [g, g + n) between raw pixel data and packed 8-byte groups.
+ * raw points at the pixel holding carrier byte base (base <= every group).
+ */
+void scatter_gather(const ScatterMap *map, const BmpInfo *bmp, const unsigned char *raw, uint64_t base,
+                    uint64_t g, size_t n, unsigned char *packed);
+void scatter_put(const ScatterMap *map, const BmpInfo *bmp, const unsigned char *packed, uint64_t base,
+                 uint64_t g, size_t n, unsigned char *raw);
+
+#endif
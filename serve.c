@@ -0,0 +1,481 @@
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include "serve.h"
+#include "common.h"
+
+/* A client connection; freed once it is closed and no job still needs it */
+typedef struct
+{
+    int fd;
+    int seq;                    /* requests read so far */
+    int pending;                /* jobs queued or running, guarded by the state lock */
+    int open;                   /* still polled for requests */
+    pthread_mutex_t write_lock; /* one reply at a time */
+    size_t len;
+    unsigned char buf[4 + SERVE_MAX_REQUEST];
+} ServeConn;
+
+typedef struct ServeJob
+{
+    struct ServeJob *next;
+    ServeConn *conn;
+    BatchJob job;               /* job.line is owned */
+    int stats;                  /* a "stats" request */
+    double received;
+} ServeJob;
+
+typedef struct
+{
+    const BatchConfig *cfg;
+    pthread_mutex_t lock;       /* guards the queue, connection refcounts and counters */
+    pthread_cond_t work;
+    ServeJob *head;
+    ServeJob *tail;
+    int queued;                 /* jobs waiting for a worker, at most SERVE_MAX_QUEUE */
+    int stop;
+
+    int workers;
+    int connections;
+    uint64_t served;
+    uint64_t ok;
+    uint64_t failed;
+    uint64_t busy;              /* requests turned away by a full queue */
+    double total_ms;
+    double max_ms;
+    double started;
+} ServeState;
+
+typedef struct
+{
+    ServeState *st;
+    BatchWorker bufs;
+} ServeWorker;
+
+static volatile sig_atomic_t serve_stop;
+
+static void on_stop_signal(int sig)
+{
+    (void)sig;
+    serve_stop = 1;
+}
+
+static double now_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static Status send_all(int fd, const void *buf, size_t len)
+{
+    const unsigned char *p = buf;
+
+    while (len > 0)
+    {
+        ssize_t n = send(fd, p, len, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return e_failure;
+        p += n;
+        len -= (size_t)n;
+    }
+    return e_success;
+}
+
+/* Length-prefixed reply; a client that went away is simply not answered */
+static void send_reply(ServeConn *conn, const char *text, size_t len)
+{
+    unsigned char hdr[4];
+
+    stego_put_be(hdr, len, 4);
+    pthread_mutex_lock(&conn->write_lock);
+    if (send_all(conn->fd, hdr, sizeof(hdr)) == e_success)
+        send_all(conn->fd, text, len);
+    pthread_mutex_unlock(&conn->write_lock);
+}
+
+static void free_conn(ServeConn *conn)
+{
+    close(conn->fd);
+    pthread_mutex_destroy(&conn->write_lock);
+    free(conn);
+}
+
+/* Drop a job's hold on its connection; the caller holds the state lock */
+static void release_conn(ServeState *st, ServeConn *conn)
+{
+    if (--conn->pending == 0 && !conn->open)
+    {
+        st->connections--;
+        free_conn(conn);
+    }
+}
+
+static void print_stats(ServeState *st, int seq, FILE *out)
+{
+    pthread_mutex_lock(&st->lock);
+    fprintf(out, "{\"seq\":%d,\"op\":\"stats\",\"served\":%llu,\"ok\":%llu,\"failed\":%llu,\"busy\":%llu,"
+            "\"workers\":%d,\"connections\":%d,\"uptime_s\":%.3f,\"mean_ms\":%.3f,\"max_ms\":%.3f}",
+            seq, (unsigned long long)st->served, (unsigned long long)st->ok, (unsigned long long)st->failed,
+            (unsigned long long)st->busy, st->workers, st->connections, now_seconds() - st->started,
+            st->served > 0 ? st->total_ms / st->served : 0.0, st->max_ms);
+    pthread_mutex_unlock(&st->lock);
+}
+
+static void *serve_worker(void *arg)
+{
+    ServeWorker *w = arg;
+    ServeState *st = w->st;
+
+    for (;;)
+    {
+        pthread_mutex_lock(&st->lock);
+        while (st->head == NULL && !st->stop)
+            pthread_cond_wait(&st->work, &st->lock);
+        ServeJob *sj = st->head;
+        if (sj != NULL && (st->head = sj->next) == NULL)
+            st->tail = NULL;
+        if (sj != NULL)
+            st->queued--;
+        pthread_mutex_unlock(&st->lock);
+
+        /* Stopping: the queue is drained first */
+        if (sj == NULL)
+            break;
+
+        char *text = NULL;
+        size_t len = 0;
+        FILE *out = open_memstream(&text, &len);
+        BatchResult res;
+
+        if (sj->stats)
+        {
+            if (out != NULL)
+                print_stats(st, sj->job.lineno, out);
+        }
+        else
+        {
+            double queued = (now_seconds() - sj->received) * 1e3;
+
+            batch_run_job(st->cfg, &sj->job, &w->bufs, &res);
+            res.queue_ms = queued;
+            if (out != NULL)
+                batch_print_result(&sj->job, &res, "seq", out);
+        }
+        if (out != NULL && fclose(out) == 0)
+            send_reply(sj->conn, text, len);
+        free(text);
+
+        pthread_mutex_lock(&st->lock);
+        if (!sj->stats)
+        {
+            st->served++;
+            if (res.status == e_success)
+                st->ok++;
+            else
+                st->failed++;
+            st->total_ms += res.ms;
+            if (res.ms > st->max_ms)
+                st->max_ms = res.ms;
+        }
+        release_conn(st, sj->conn);
+        pthread_mutex_unlock(&st->lock);
+
+        free(sj->job.line);
+        free(sj);
+    }
+    return NULL;
+}
+
+/* Turn a request away without running it: the queue is full */
+static void send_busy(ServeConn *conn, const ServeJob *sj)
+{
+    const BatchJob *job = &sj->job;
+    const char *op = sj->stats ? "stats" : job->op == e_encode ? "encode" : job->op == e_decode ? "decode" :
+                     job->op == e_inspect ? "inspect" : "invalid";
+    char text[128];
+    int len = snprintf(text, sizeof(text), "{\"seq\":%d,\"op\":\"%s\",\"status\":\"busy\","
+                       "\"error\":\"server queue is full, retry later\"}", job->lineno, op);
+
+    send_reply(conn, text, (size_t)len);
+}
+
+/* Queue the request in conn->buf[4 .. 4 + n), or answer busy when SERVE_MAX_QUEUE jobs already wait */
+static Status queue_request(ServeState *st, ServeConn *conn, size_t n)
+{
+    ServeJob *sj = calloc(1, sizeof(*sj));
+    char *line = malloc(n + 1);
+
+    if (sj == NULL || line == NULL)
+    {
+        free(sj);
+        free(line);
+        return e_failure;
+    }
+    memcpy(line, conn->buf + 4, n);
+    line[n] = '\0';
+
+    sj->conn = conn;
+    sj->received = now_seconds();
+    sj->stats = strcmp(line, "stats") == 0;
+    if (!batch_parse_job(line, &sj->job))
+        sj->job.op = e_unsupported;
+    sj->job.line = line;
+    sj->job.lineno = conn->seq++;
+
+    pthread_mutex_lock(&st->lock);
+    if (st->queued >= SERVE_MAX_QUEUE)
+    {
+        st->busy++;
+        pthread_mutex_unlock(&st->lock);
+        send_busy(conn, sj);
+        free(line);
+        free(sj);
+        return e_success;
+    }
+    st->queued++;
+    conn->pending++;
+    if (st->tail != NULL)
+        st->tail->next = sj;
+    else
+        st->head = sj;
+    st->tail = sj;
+    pthread_cond_signal(&st->work);
+    pthread_mutex_unlock(&st->lock);
+    return e_success;
+}
+
+/* Read what arrived and queue every complete request; fails when the connection is done */
+static Status read_requests(ServeState *st, ServeConn *conn)
+{
+    ssize_t got = read(conn->fd, conn->buf + conn->len, sizeof(conn->buf) - conn->len);
+
+    if (got < 0 && errno == EINTR)
+        return e_success;
+    if (got <= 0)
+        return e_failure;
+    conn->len += (size_t)got;
+
+    while (conn->len >= 4)
+    {
+        size_t n = (size_t)stego_get_be(conn->buf, 4);
+
+        if (n == 0 || n > SERVE_MAX_REQUEST)
+            return e_failure;
+        if (conn->len < 4 + n)
+            break;
+        if (queue_request(st, conn, n) == e_failure)
+            return e_failure;
+        conn->len -= 4 + n;
+        memmove(conn->buf, conn->buf + 4 + n, conn->len);
+    }
+    return e_success;
+}
+
+/* Listening socket at path; a stale socket file nobody answers on is replaced */
+static int open_listener(const char *path)
+{
+    struct sockaddr_un addr;
+    struct stat st;
+    int fd;
+
+    if (strlen(path) >= sizeof(addr.sun_path))
+    {
+        printf("Error! Socket path %s is too long\n", path);
+        return -1;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+
+    if (stat(path, &st) == 0 && S_ISSOCK(st.st_mode))
+    {
+        fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd >= 0 && connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0)
+        {
+            close(fd);
+            printf("Error! A server is already listening on %s\n", path);
+            return -1;
+        }
+        if (fd >= 0)
+            close(fd);
+        unlink(path);
+    }
+
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0 || bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(fd, 64) != 0)
+    {
+        perror("socket");
+        printf("Error! Unable to listen on %s\n", path);
+        if (fd >= 0)
+            close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+Status run_serve(const char *socket_path, const BatchConfig *cfg)
+{
+    ServeState st = { cfg, PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, NULL, NULL, 0, 0,
+                      0, 0, 0, 0, 0, 0, 0, 0, now_seconds() };
+    int workers = cfg->workers < 1 ? 1 : cfg->workers;
+    ServeWorker *pool = calloc(workers, sizeof(*pool));
+    pthread_t *tids = calloc(workers, sizeof(*tids));
+    struct pollfd *fds = NULL;
+    ServeConn **conns = NULL;
+    size_t nconns = 0, cap = 0;
+    struct sigaction sa;
+
+    if (pool == NULL || tids == NULL)
+    {
+        free(pool);
+        free(tids);
+        return e_failure;
+    }
+
+    int listen_fd = open_listener(socket_path);
+    if (listen_fd < 0)
+    {
+        free(pool);
+        free(tids);
+        return e_failure;
+    }
+
+    /* No SA_RESTART: a stop signal interrupts poll() */
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_stop_signal;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    /* Worker buffers are allocated once and reused by every request */
+    for (int i = 0; i < workers; i++)
+    {
+        pool[i].st = &st;
+        if (batch_worker_init(&pool[i].bufs, cfg) == e_failure ||
+            pthread_create(&tids[i], NULL, serve_worker, &pool[i]) != 0)
+        {
+            batch_worker_free(&pool[i].bufs);
+            break;
+        }
+        st.workers++;
+    }
+
+    if (st.workers == 0)
+        printf("Error! Unable to start server workers.\n");
+    else
+    {
+        printf("Serving on %s with %d workers.\n", socket_path, st.workers);
+        fflush(stdout);
+    }
+
+    while (st.workers > 0 && !serve_stop)
+    {
+        if (nconns + 1 > cap)
+        {
+            cap = cap ? 2 * cap : 16;
+            struct pollfd *grown_fds = realloc(fds, cap * sizeof(*fds));
+            if (grown_fds == NULL)
+                break;
+            fds = grown_fds;
+            ServeConn **grown_conns = realloc(conns, cap * sizeof(*conns));
+            if (grown_conns == NULL)
+                break;
+            conns = grown_conns;
+        }
+
+        fds[0].fd = listen_fd;
+        fds[0].events = POLLIN;
+        for (size_t i = 0; i < nconns; i++)
+        {
+            fds[i + 1].fd = conns[i]->fd;
+            fds[i + 1].events = POLLIN;
+        }
+
+        if (poll(fds, nconns + 1, -1) < 0)
+            continue;
+
+        /* Connections first: accepting may grow conns past what was polled */
+        size_t kept = 0;
+        for (size_t i = 0; i < nconns; i++)
+        {
+            ServeConn *conn = conns[i];
+
+            if (!(fds[i + 1].revents & (POLLIN | POLLHUP | POLLERR)) || read_requests(&st, conn) == e_success)
+            {
+                conns[kept++] = conn;
+                continue;
+            }
+
+            /* Closed or misbehaving: stop reading, free once its replies are out */
+            pthread_mutex_lock(&st.lock);
+            conn->open = 0;
+            if (conn->pending == 0)
+            {
+                st.connections--;
+                free_conn(conn);
+            }
+            pthread_mutex_unlock(&st.lock);
+        }
+        nconns = kept;
+
+        if (fds[0].revents & POLLIN)
+        {
+            int fd = accept(listen_fd, NULL, NULL);
+            ServeConn *conn = fd >= 0 ? calloc(1, sizeof(*conn)) : NULL;
+
+            if (conn == NULL)
+            {
+                if (fd >= 0)
+                    close(fd);
+                continue;
+            }
+            conn->fd = fd;
+            conn->open = 1;
+            pthread_mutex_init(&conn->write_lock, NULL);
+            conns[nconns++] = conn;
+            pthread_mutex_lock(&st.lock);
+            st.connections++;
+            pthread_mutex_unlock(&st.lock);
+        }
+    }
+
+    /* Stop accepting, let the workers drain the queue, then drop the clients */
+    close(listen_fd);
+    unlink(socket_path);
+
+    pthread_mutex_lock(&st.lock);
+    st.stop = 1;
+    pthread_cond_broadcast(&st.work);
+    pthread_mutex_unlock(&st.lock);
+    for (int i = 0; i < st.workers; i++)
+    {
+        pthread_join(tids[i], NULL);
+        batch_worker_free(&pool[i].bufs);
+    }
+
+    for (size_t i = 0; i < nconns; i++)
+        free_conn(conns[i]);
+
+    printf("Server stopped after %llu requests (%llu failed).\n", (unsigned long long)st.served,
+           (unsigned long long)st.failed);
+
+    free(conns);
+    free(fds);
+    free(pool);
+    free(tids);
+    pthread_cond_destroy(&st.work);
+    pthread_mutex_destroy(&st.lock);
+    return st.workers > 0 ? e_success : e_failure;
+}
@@ -0,0 +1,36 @@
+#ifndef SERVE_H
+#define SERVE_H
+
+#include "types.h"
+#include "batch.h"
+
+/*
+ * Daemon mode (--serve SOCKET): a warm process runs encode, decode and
+ * probe jobs for clients of a Unix stream socket, on a fixed pool of
+ * workers whose buffers are allocated once.
+ *
+ * Every message is a 4-byte big-endian length followed by that many
+ * bytes. A request is one batch manifest line ("e carrier secret out",
+ * "d stego out", "i image") or "stats"; paths are resolved by the
+ * server. The reply is one JSON object: the batch result with "seq" (the
+ * request's number on its connection, from 0) and per-request "ms" and
+ * "queue_ms", and "error" when it failed. Requests sent back to back
+ * run concurrently, so replies may come back out of order. When
+ * SERVE_MAX_QUEUE requests are already waiting, a new one is answered at
+ * once with "status":"busy" and can be sent again later.
+ *
+ * The encode settings (--depth, --key, ...) are the server's, as in batch
+ * mode. SIGINT/SIGTERM stop accepting, finish the queued jobs and remove
+ * the socket.
+ */
+
+/* Largest request accepted; longer ones close the connection */
+#define SERVE_MAX_REQUEST 8192
+
+/* Requests waiting for a worker; past this, one is answered "status":"busy" without running */
+#define SERVE_MAX_QUEUE 64
+
+/* Serve until a stop signal; fails if the socket cannot be set up */
+Status run_serve(const char *socket_path, const BatchConfig *cfg);
+
+#endif
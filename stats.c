@@ -0,0 +1,128 @@
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "stats.h"
+#include "lsb_kernel.h"
+
+static const char *stage_names[e_stage_count] = {
+    "open", "capacity", "header", "magic", "extension", "size", "data", "tail"
+};
+
+static double now_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void stats_init(Stats *stats)
+{
+    memset(stats, 0, sizeof(*stats));
+    stats->current = e_stage_count;
+    stats->start = now_seconds();
+}
+
+void stats_begin(Stats *stats, StageId stage)
+{
+    if (stats == NULL)
+        return;
+
+    stats_end(stats);
+    stats->current = stage;
+    stats->stage_start = now_seconds();
+}
+
+void stats_end(Stats *stats)
+{
+    if (stats == NULL || stats->current == e_stage_count)
+        return;
+
+    stats->stage[stats->current].seconds += now_seconds() - stats->stage_start;
+    stats->current = e_stage_count;
+}
+
+/* I/O outside any stage (e.g. header parsing) is charged to open */
+static StageStats *running_stage(Stats *stats)
+{
+    return &stats->stage[stats->current == e_stage_count ? e_stage_open : stats->current];
+}
+
+void stats_add_read(Stats *stats, uint64_t bytes)
+{
+    if (stats == NULL)
+        return;
+
+    StageStats *st = running_stage(stats);
+    __atomic_fetch_add(&st->bytes_read, bytes, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&st->read_calls, 1, __ATOMIC_RELAXED);
+}
+
+void stats_add_write(Stats *stats, uint64_t bytes)
+{
+    if (stats == NULL)
+        return;
+
+    StageStats *st = running_stage(stats);
+    __atomic_fetch_add(&st->bytes_written, bytes, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&st->write_calls, 1, __ATOMIC_RELAXED);
+}
+
+size_t stats_fread(Stats *stats, void *buf, size_t n, FILE *fp)
+{
+    size_t got = fread(buf, 1, n, fp);
+    stats_add_read(stats, got);
+    return got;
+}
+
+size_t stats_fwrite(Stats *stats, const void *buf, size_t n, FILE *fp)
+{
+    size_t put = fwrite(buf, 1, n, fp);
+    stats_add_write(stats, put);
+    return put;
+}
+
+void json_print_string(const char *str, FILE *out)
+{
+    fputc('"', out);
+    for (; str != NULL && *str; str++)
+    {
+        unsigned char c = (unsigned char)*str;
+        if (c == '"' || c == '\\')
+            fprintf(out, "\\%c", c);
+        else if (c < 0x20)
+            fprintf(out, "\\u%04x", c);
+        else
+            fputc(c, out);
+    }
+    fputc('"', out);
+}
+
+void stats_print_json(const Stats *stats, const char *op, Status result, FILE *out)
+{
+    StageStats total = {0};
+
+    fprintf(out, "{\"op\":\"%s\",\"status\":\"%s\",\"kernel\":\"%s\",\"stages\":[",
+            op, result == e_success ? "ok" : "failed", lsb_kernel_name());
+
+    for (int i = 0; i < e_stage_count; i++)
+    {
+        const StageStats *st = &stats->stage[i];
+
+        fprintf(out, "%s{\"stage\":\"%s\",\"seconds\":%.6f,\"bytes_read\":%llu,\"bytes_written\":%llu,"
+                "\"read_calls\":%llu,\"write_calls\":%llu}",
+                i ? "," : "", stage_names[i], st->seconds,
+                (unsigned long long)st->bytes_read, (unsigned long long)st->bytes_written,
+                (unsigned long long)st->read_calls, (unsigned long long)st->write_calls);
+
+        total.bytes_read += st->bytes_read;
+        total.bytes_written += st->bytes_written;
+        total.read_calls += st->read_calls;
+        total.write_calls += st->write_calls;
+    }
+
+    fprintf(out, "],\"total_seconds\":%.6f,\"bytes_read\":%llu,\"bytes_written\":%llu,"
+            "\"read_calls\":%llu,\"write_calls\":%llu}\n",
+            now_seconds() - stats->start,
+            (unsigned long long)total.bytes_read, (unsigned long long)total.bytes_written,
+            (unsigned long long)total.read_calls, (unsigned long long)total.write_calls);
+}
@@ -0,0 +1,66 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include "types.h"
+
+/*
+ * Per-stage counters for --stats: wall time, bytes moved and the number
+ * of read/write calls. A NULL Stats pointer turns every hook into a no-op.
+ */
+
+typedef enum
+{
+    e_stage_open,
+    e_stage_capacity,
+    e_stage_header,     /* BMP header copy */
+    e_stage_magic,      /* magic string and v2 flags */
+    e_stage_extn,       /* extension size and extension */
+    e_stage_size,
+    e_stage_data,
+    e_stage_tail,       /* remaining image copy */
+    e_stage_count
+} StageId;
+
+typedef struct
+{
+    double seconds;
+    uint64_t bytes_read;
+    uint64_t bytes_written;
+    uint64_t read_calls;
+    uint64_t write_calls;
+} StageStats;
+
+typedef struct
+{
+    StageId current;
+    double stage_start;
+    double start;
+    StageStats stage[e_stage_count];
+} Stats;
+
+/* Reset the counters and start the wall clock */
+void stats_init(Stats *stats);
+
+/* Close the running stage (if any) and start timing `stage` */
+void stats_begin(Stats *stats, StageId stage);
+
+/* Close the running stage */
+void stats_end(Stats *stats);
+
+/* Count I/O against the running stage; safe to call from workers */
+void stats_add_read(Stats *stats, uint64_t bytes);
+void stats_add_write(Stats *stats, uint64_t bytes);
+
+/* fread/fwrite of n bytes, counted */
+size_t stats_fread(Stats *stats, void *buf, size_t n, FILE *fp);
+size_t stats_fwrite(Stats *stats, const void *buf, size_t n, FILE *fp);
+
+/* Print a JSON string literal, escaping quotes and control characters */
+void json_print_string(const char *str, FILE *out);
+
+/* Print the JSON summary for an operation ("encode" / "decode") */
+void stats_print_json(const Stats *stats, const char *op, Status result, FILE *out);
+
+#endif
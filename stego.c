@@ -0,0 +1,708 @@
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "stego.h"
+#include "common.h"
+#include "lsb_kernel.h"
+#include "lz.h"
+#include "archive.h"
+#include "crc32c.h"
+#include "scatter.h"
+
+/* Payload bytes moved through the gather buffer at a time */
+#define STEGO_BLOCK 1024
+
+/* Fill in the defaults of a zero-initialised StegoOptions */
+static Status resolve_options(const StegoOptions *opts, int *version, int *depth)
+{
+    *version = opts->header_version == 0 ? STEGO_V2 : opts->header_version;
+    *depth = opts->depth == 0 ? 1 : opts->depth;
+
+    if ((*version != STEGO_V1 && *version != STEGO_V2) || *depth < 1 || *depth > LSB_MAX_DEPTH)
+        return e_failure;
+    if (*version == STEGO_V1 && (*depth != 1 || opts->compress || opts->checksum || opts->key != NULL))
+        return e_failure;
+
+    return e_success;
+}
+
+/* Embed len bytes at the given depth into the carrier bytes starting at *pos */
+static void embed_mem(unsigned char *image, const BmpInfo *bmp, uint64_t *pos,
+                      const unsigned char *bytes, uint64_t len, int depth)
+{
+    unsigned char packed[8 * STEGO_BLOCK];
+    size_t block = stego_chunk_size(STEGO_BLOCK, depth);
+
+    if (bmp_contiguous(bmp))
+    {
+        lsb_embed_depth(bytes, len, image + bmp_carrier_offset(bmp, *pos), depth);
+        *pos += lsb_carrier_bytes(len, depth);
+        return;
+    }
+
+    /* Strided or padded carriers: gather a block, embed, scatter it back */
+    while (len > 0)
+    {
+        size_t n = len < block ? (size_t)len : block;
+        size_t carrier_len = (size_t)lsb_carrier_bytes(n, depth);
+        unsigned char *raw = image + bmp_pixel_offset(bmp, *pos);
+
+        bmp_gather(bmp, raw, *pos, carrier_len, packed);
+        lsb_embed_depth(bytes, n, packed, depth);
+        bmp_scatter(bmp, packed, *pos, carrier_len, raw);
+
+        *pos += carrier_len;
+        bytes += n;
+        len -= n;
+    }
+}
+
+/* Extract len bytes at the given depth from the carrier bytes starting at *pos */
+static void extract_mem(const unsigned char *image, const BmpInfo *bmp, uint64_t *pos,
+                        unsigned char *bytes, uint64_t len, int depth)
+{
+    unsigned char packed[8 * STEGO_BLOCK];
+    size_t block = stego_chunk_size(STEGO_BLOCK, depth);
+
+    if (bmp_contiguous(bmp))
+    {
+        lsb_extract_depth(image + bmp_carrier_offset(bmp, *pos), len, bytes, depth);
+        *pos += lsb_carrier_bytes(len, depth);
+        return;
+    }
+
+    while (len > 0)
+    {
+        size_t n = len < block ? (size_t)len : block;
+        size_t carrier_len = (size_t)lsb_carrier_bytes(n, depth);
+
+        bmp_gather(bmp, image + bmp_pixel_offset(bmp, *pos), *pos, carrier_len, packed);
+        lsb_extract_depth(packed, n, bytes, depth);
+
+        *pos += carrier_len;
+        bytes += n;
+        len -= n;
+    }
+}
+
+/*
+ * Keyed layout: move payload bytes [off, off + len) between the
+ * scattered groups and bytes. Embedding starts on a group boundary.
+ */
+static void embed_scattered(unsigned char *image, const BmpInfo *bmp, const ScatterMap *map, int depth,
+                            uint64_t off, const unsigned char *bytes, uint64_t len)
+{
+    unsigned char packed[8 * STEGO_BLOCK];
+    unsigned char *raw = image + bmp->data_offset;
+    uint64_t g = off / depth;
+
+    while (len > 0)
+    {
+        size_t n = scatter_groups(len, depth) < STEGO_BLOCK ? (size_t)scatter_groups(len, depth) : STEGO_BLOCK;
+        size_t take = n * depth < len ? n * depth : (size_t)len;
+
+        scatter_gather(map, bmp, raw, 0, g, n, packed);
+        lsb_embed_depth(bytes, take, packed, depth);
+        scatter_put(map, bmp, packed, 0, g, n, raw);
+
+        g += n;
+        bytes += take;
+        len -= take;
+    }
+}
+
+static void extract_scattered(const unsigned char *image, const BmpInfo *bmp, const ScatterMap *map, int depth,
+                              uint64_t off, unsigned char *bytes, uint64_t len)
+{
+    unsigned char packed[8 * STEGO_BLOCK];
+    unsigned char group_bytes[LSB_MAX_DEPTH * STEGO_BLOCK];
+
+    while (len > 0)
+    {
+        size_t skip = off % depth;
+        uint64_t groups = scatter_groups(skip + len, depth);
+        size_t n = groups < STEGO_BLOCK ? (size_t)groups : STEGO_BLOCK;
+        size_t take = n * depth - skip < len ? n * depth - skip : (size_t)len;
+
+        scatter_gather(map, bmp, image + bmp->data_offset, 0, off / depth, n, packed);
+        lsb_extract_depth(packed, skip + take, group_bytes, depth);
+        memcpy(bytes, group_bytes + skip, take);
+
+        off += take;
+        bytes += take;
+        len -= take;
+    }
+}
+
+/* Keyed header: its layout in map, or failure without the key */
+static Status header_layout(const StegoHeader *hdr, const BmpInfo *bmp, ScatterMap *map, const ScatterMap **layout)
+{
+    *layout = NULL;
+    if (!hdr->keyed)
+        return hdr->key == NULL ? e_success : e_failure;
+    if (hdr->key == NULL ||
+        scatter_init(map, scatter_seed(hdr->key), hdr->data_pos, bmp->carrier_bytes, hdr->secret_size,
+                     hdr->compressed, hdr->checksum, hdr->depth) == e_failure)
+        return e_failure;
+    *layout = map;
+    return e_success;
+}
+
+/* Carrier bytes for a header version: v1 images keep the original contiguous layout */
+static Status select_layout(BmpInfo *bmp, int version, ChannelMode channels)
+{
+    if (bmp_select_channels(bmp, channels) == e_failure)
+        return e_failure;
+    if (version == STEGO_V1 && channels == e_channels_all)
+        bmp_select_v1_layout(bmp);
+    return e_success;
+}
+
+/* Payload bytes the layout holds */
+static uint64_t layout_room(const BmpInfo *bmp, uint64_t data_pos, int depth, const ScatterMap *map)
+{
+    if (map != NULL)
+        return map->groups * depth;
+    return (bmp->carrier_bytes - data_pos) * depth / 8;
+}
+
+Status stego_capacity(const unsigned char *image, size_t image_len, const StegoOptions *opts,
+                      uint64_t *max_secret)
+{
+    BmpInfo bmp;
+    int version, depth;
+    size_t extn_len = opts->extension != NULL ? strlen(opts->extension) : 0;
+
+    if (resolve_options(opts, &version, &depth) == e_failure ||
+        bmp_parse(image, image_len, image_len, &bmp) == e_failure ||
+        select_layout(&bmp, version, opts->channels) == e_failure)
+        return e_failure;
+
+    uint64_t header = stego_header_bytes(version, extn_len);
+    uint64_t room = bmp.carrier_bytes > header ? bmp.carrier_bytes - header : 0;
+
+    /* A keyed layout only uses whole groups */
+    *max_secret = opts->key != NULL ? room / 8 * depth : room * depth / 8;
+    if (opts->checksum)
+        *max_secret = *max_secret > CRC32C_BYTES ? *max_secret - CRC32C_BYTES : 0;
+    if (opts->compress)
+    {
+        /* Incompressible data still pays a frame header per block */
+        uint64_t frames = (*max_secret + LZ_FRAME_MAX - 1) / LZ_FRAME_MAX;
+        *max_secret = *max_secret > frames * LZ_FRAME_HEADER ? *max_secret - frames * LZ_FRAME_HEADER : 0;
+    }
+    if (version == STEGO_V1 && *max_secret > UINT32_MAX)
+        *max_secret = UINT32_MAX;
+    return e_success;
+}
+
+/* A secret ready to embed: payload bytes and the layout they fit in */
+typedef struct
+{
+    BmpInfo bmp;
+    int version;
+    int depth;
+    const char *magic;
+    size_t extn_len;
+    const unsigned char *payload;
+    unsigned char *frames;      /* owned LZ frames, or NULL */
+    uint64_t payload_len;
+    ScatterMap map;
+} EncodePlan;
+
+/* Compress if asked and check that the secret fits image; nothing is written */
+static Status plan_encode(const unsigned char *image, size_t image_len,
+                          const unsigned char *secret, size_t secret_len,
+                          const StegoOptions *opts, EncodePlan *plan)
+{
+    const char *extn = opts->extension;
+
+    plan->frames = NULL;
+    if (extn == NULL || strlen(extn) == 0 || strlen(extn) > STEGO_EXTN_MAX ||
+        resolve_options(opts, &plan->version, &plan->depth) == e_failure ||
+        bmp_parse(image, image_len, image_len, &plan->bmp) == e_failure)
+        return e_failure;
+
+    /* A v1 payload starts at byte 54; a longer header would be overwritten */
+    if ((plan->version == STEGO_V1 && opts->channels == e_channels_all &&
+         plan->bmp.data_offset != BMP_V1_DATA_OFFSET) ||
+        select_layout(&plan->bmp, plan->version, opts->channels) == e_failure)
+        return e_failure;
+
+    plan->magic = plan->version == STEGO_V1 ? MAGIC_STRING : MAGIC_STRING_V2;
+    plan->extn_len = strlen(extn);
+    plan->payload = secret;
+    plan->payload_len = secret_len;
+
+    uint64_t trailer = opts->checksum ? CRC32C_BYTES : 0;
+    uint64_t header = stego_header_bytes(plan->version, plan->extn_len);
+
+    if (plan->version == STEGO_V1 && secret_len > UINT32_MAX)
+        return e_failure;
+
+    if (opts->compress)
+    {
+        plan->frames = malloc(lz_framed_bound(secret_len) + 1);
+        if (plan->frames == NULL)
+            return e_failure;
+
+        plan->payload_len = 0;
+        for (size_t off = 0; off < secret_len; off += LZ_BLOCK)
+        {
+            size_t n = secret_len - off < LZ_BLOCK ? secret_len - off : LZ_BLOCK;
+            plan->payload_len += lz_frame_encode(secret + off, n, plan->frames + plan->payload_len);
+        }
+        plan->payload = plan->frames;
+    }
+
+    if (opts->key != NULL
+        ? header > plan->bmp.carrier_bytes ||
+          scatter_init(&plan->map, scatter_seed(opts->key), header, plan->bmp.carrier_bytes, secret_len,
+                       opts->compress, opts->checksum, plan->depth) == e_failure ||
+          scatter_groups(plan->payload_len + trailer, plan->depth) > plan->map.groups
+        : header + lsb_carrier_bytes(plan->payload_len + trailer, plan->depth) > plan->bmp.carrier_bytes)
+    {
+        free(plan->frames);
+        plan->frames = NULL;
+        return e_failure;
+    }
+    return e_success;
+}
+
+/* Write the header and payload of plan into out; returns the carrier position after the linear part */
+static uint64_t embed_plan(unsigned char *out, const EncodePlan *plan, const unsigned char *secret, size_t secret_len,
+                           const StegoOptions *opts)
+{
+    const BmpInfo *bmp = &plan->bmp;
+    const unsigned char *payload = plan->payload;
+    uint64_t payload_len = plan->payload_len;
+    int depth = plan->depth;
+    unsigned char field[8];
+    uint64_t pos = 0;
+
+    lsb_kernel_init();
+    embed_mem(out, bmp, &pos, (const unsigned char *)plan->magic, strlen(plan->magic), 1);
+
+    if (plan->version != STEGO_V1)
+    {
+        uint32_t flags = (uint32_t)(depth - 1) | (opts->compress ? STEGO_FLAG_LZ : 0) |
+                         (opts->checksum ? STEGO_FLAG_CRC : 0) | (opts->key != NULL ? STEGO_FLAG_SCATTER : 0);
+        stego_put_be(field, flags, 4);
+        embed_mem(out, bmp, &pos, field, 4, 1);
+    }
+
+    stego_put_be(field, plan->extn_len, 4);
+    embed_mem(out, bmp, &pos, field, 4, 1);
+    embed_mem(out, bmp, &pos, (const unsigned char *)opts->extension, plan->extn_len, 1);
+
+    int size_len = plan->version == STEGO_V1 ? 4 : 8;
+    stego_put_be(field, secret_len, size_len);
+    embed_mem(out, bmp, &pos, field, size_len, 1);
+
+    uint64_t data_pos = pos;
+    if (opts->key != NULL)
+        embed_scattered(out, bmp, &plan->map, depth, 0, payload, payload_len);
+    else
+        embed_mem(out, bmp, &pos, payload, payload_len, depth);
+
+    if (opts->checksum)
+    {
+        /* The CRC continues the depth stream: re-embed the last partial group with it */
+        unsigned char tail[LSB_MAX_DEPTH + CRC32C_BYTES];
+        size_t tail_len = payload_len % depth;
+
+        if (tail_len > 0)
+            memcpy(tail, payload + payload_len - tail_len, tail_len);
+        stego_put_be(tail + tail_len, crc32c_update(0, secret, secret_len), CRC32C_BYTES);
+        pos = data_pos + payload_len / depth * 8;
+        if (opts->key != NULL)
+            embed_scattered(out, bmp, &plan->map, depth, payload_len - tail_len, tail, tail_len + CRC32C_BYTES);
+        else
+            embed_mem(out, bmp, &pos, tail, tail_len + CRC32C_BYTES, depth);
+    }
+    return pos;
+}
+
+Status stego_encode(const unsigned char *image, size_t image_len,
+                    const unsigned char *secret, size_t secret_len,
+                    const StegoOptions *opts, unsigned char *out, size_t out_len)
+{
+    EncodePlan plan;
+
+    if (out_len < image_len ||
+        plan_encode(image, image_len, secret, secret_len, opts, &plan) == e_failure)
+        return e_failure;
+
+    if (out != image)
+        memcpy(out, image, image_len);
+    embed_plan(out, &plan, secret, secret_len, opts);
+
+    free(plan.frames);
+    return e_success;
+}
+
+/* Parse the header fields with the carrier bytes selected in bmp */
+static Status read_header_fields(const unsigned char *image, const BmpInfo *bmp, StegoHeader *hdr)
+{
+    unsigned char field[8];
+    char magic[sizeof(MAGIC_STRING)] = {0};
+    uint64_t pos = 0;
+
+    /* Magic, flags and extension size are always there; check the room first */
+    if (bmp->carrier_bytes < stego_header_bytes(STEGO_V1, 0))
+        return e_failure;
+
+    extract_mem(image, bmp, &pos, (unsigned char *)magic, strlen(MAGIC_STRING), 1);
+    if (strcmp(magic, MAGIC_STRING) == 0)
+        hdr->version = STEGO_V1;
+    else if (strcmp(magic, MAGIC_STRING_V2) == 0)
+        hdr->version = STEGO_V2;
+    else
+        return e_failure;
+
+    hdr->depth = 1;
+    if (hdr->version == STEGO_V2)
+    {
+        if (bmp->carrier_bytes < stego_header_bytes(STEGO_V2, 0))
+            return e_failure;
+
+        extract_mem(image, bmp, &pos, field, 4, 1);
+        uint32_t flags = (uint32_t)stego_get_be(field, 4);
+        if (flags & ~STEGO_FLAGS_KNOWN)
+            return e_failure;
+        hdr->depth = (int)(flags & STEGO_FLAG_DEPTH_MASK) + 1;
+        hdr->compressed = (flags & STEGO_FLAG_LZ) != 0;
+        hdr->archive = (flags & STEGO_FLAG_ARCHIVE) != 0;
+        hdr->checksum = (flags & STEGO_FLAG_CRC) != 0;
+        hdr->keyed = (flags & STEGO_FLAG_SCATTER) != 0;
+    }
+
+    extract_mem(image, bmp, &pos, field, 4, 1);
+    uint64_t extn_len = stego_get_be(field, 4);
+    if (extn_len == 0 || extn_len > STEGO_EXTN_MAX ||
+        bmp->carrier_bytes < stego_header_bytes(hdr->version, extn_len))
+        return e_failure;
+
+    extract_mem(image, bmp, &pos, (unsigned char *)hdr->extension, extn_len, 1);
+    hdr->extension[extn_len] = '\0';
+
+    int size_len = hdr->version == STEGO_V1 ? 4 : 8;
+    extract_mem(image, bmp, &pos, field, size_len, 1);
+    hdr->secret_size = stego_get_be(field, size_len);
+    hdr->data_pos = pos;
+
+    /* A compressed secret is bounded by its frames, checked while decoding */
+    uint64_t payload = hdr->secret_size + (hdr->checksum ? CRC32C_BYTES : 0);
+    if (!hdr->compressed &&
+        (hdr->keyed ? scatter_groups(payload, hdr->depth) > (bmp->carrier_bytes - pos) / 8
+                    : lsb_carrier_bytes(payload, hdr->depth) > bmp->carrier_bytes - pos))
+        return e_failure;
+
+    return e_success;
+}
+
+Status stego_read_header(const unsigned char *image, size_t image_len, StegoHeader *hdr)
+{
+    BmpInfo bmp;
+
+    memset(hdr, 0, sizeof(*hdr));
+    if (bmp_parse(image, image_len, image_len, &bmp) == e_failure)
+        return e_failure;
+
+    lsb_kernel_init();
+
+    /* v1 images put the header right after byte 54, row padding included */
+    BmpInfo v1 = bmp;
+    bmp_select_v1_layout(&v1);
+    hdr->channels = e_channels_all;
+    if (read_header_fields(image, &v1, hdr) == e_success && hdr->version == STEGO_V1)
+        return e_success;
+
+    memset(hdr, 0, sizeof(*hdr));
+    hdr->channels = e_channels_all;
+    if (read_header_fields(image, &bmp, hdr) == e_success && hdr->version == STEGO_V2)
+        return e_success;
+
+    /* 32bpp images may carry the payload in the alpha bytes only */
+    if (bmp.bpp != 32 || bmp_select_channels(&bmp, e_channels_alpha) == e_failure)
+        return e_failure;
+
+    memset(hdr, 0, sizeof(*hdr));
+    hdr->channels = e_channels_alpha;
+    return read_header_fields(image, &bmp, hdr);
+}
+
+/*
+ * Extract payload bytes [off, off + len) in any order: start at the depth
+ * group holding byte off and drop the bytes before it. map is the keyed
+ * layout, or NULL.
+ */
+static void extract_range(const unsigned char *image, const BmpInfo *bmp, uint64_t data_pos, int depth,
+                          const ScatterMap *map, uint64_t off, size_t len, unsigned char *out)
+{
+    uint64_t pos = data_pos + off / depth * 8;
+    size_t skip = off % depth;
+
+    if (map != NULL)
+    {
+        extract_scattered(image, bmp, map, depth, off, out, len);
+        return;
+    }
+
+    if (skip > 0 && len > 0)
+    {
+        /* Partial first group; never reads past the carrier bytes of the range */
+        unsigned char group[LSB_MAX_DEPTH];
+        size_t take = depth - skip < len ? depth - skip : len;
+
+        extract_mem(image, bmp, &pos, group, skip + take, depth);
+        memcpy(out, group + skip, take);
+        out += take;
+        len -= take;
+    }
+    extract_mem(image, bmp, &pos, out, len, depth);
+}
+
+/*
+ * Decode secret bytes [first, first + count) from the LZ frames. Frames
+ * before the range are skipped by their length word without being read;
+ * every frame is bounds-checked against the carrier. *end is the payload
+ * offset just past the last frame read.
+ */
+static Status decode_frames(const unsigned char *image, const BmpInfo *bmp, const StegoHeader *hdr,
+                            const ScatterMap *map, uint64_t first, uint64_t count, unsigned char *out, uint64_t *end)
+{
+    uint64_t room = layout_room(bmp, hdr->data_pos, hdr->depth, map);
+    unsigned char *body = malloc(2 * LZ_BLOCK);
+    unsigned char *raw = body + LZ_BLOCK;
+    uint64_t off = 0;
+    Status ret = e_success;
+
+    if (body == NULL)
+        return e_failure;
+
+    for (uint64_t done = 0; done < first + count && ret == e_success;)
+    {
+        size_t n = hdr->secret_size - done < LZ_BLOCK ? (size_t)(hdr->secret_size - done) : LZ_BLOCK;
+        unsigned char word[LZ_FRAME_HEADER];
+        size_t body_len;
+        int stored;
+
+        ret = e_failure;
+        if (room - off < LZ_FRAME_HEADER)
+            break;
+        extract_range(image, bmp, hdr->data_pos, hdr->depth, map, off, LZ_FRAME_HEADER, word);
+        off += LZ_FRAME_HEADER;
+
+        if (lz_frame_header(word, n, &body_len, &stored) == e_failure || room - off < body_len)
+            break;
+
+        if (done + n > first)
+        {
+            extract_range(image, bmp, hdr->data_pos, hdr->depth, map, off, body_len, stored ? raw : body);
+            if (!stored && lz_decompress(body, body_len, raw, n) == e_failure)
+                break;
+
+            uint64_t from = first > done ? first : done;
+            uint64_t to = first + count < done + n ? first + count : done + n;
+            memcpy(out + (from - first), raw + (from - done), (size_t)(to - from));
+        }
+        ret = e_success;
+        off += body_len;
+        done += n;
+    }
+
+    free(body);
+    *end = off;
+    return ret;
+}
+
+Status stego_decode_range(const unsigned char *image, size_t image_len, const StegoHeader *hdr,
+                          uint64_t offset, size_t len, unsigned char *out)
+{
+    BmpInfo bmp;
+    ScatterMap map;
+    const ScatterMap *layout;
+
+    if (offset > hdr->secret_size || len > hdr->secret_size - offset ||
+        hdr->depth < 1 || hdr->depth > LSB_MAX_DEPTH ||
+        bmp_parse(image, image_len, image_len, &bmp) == e_failure ||
+        select_layout(&bmp, hdr->version, hdr->channels) == e_failure ||
+        hdr->data_pos > bmp.carrier_bytes ||
+        header_layout(hdr, &bmp, &map, &layout) == e_failure)
+        return e_failure;
+
+    uint64_t end;
+
+    lsb_kernel_init();
+    if (hdr->compressed)
+        return decode_frames(image, &bmp, hdr, layout, offset, len, out, &end);
+
+    if (hdr->secret_size > layout_room(&bmp, hdr->data_pos, hdr->depth, layout))
+        return e_failure;
+
+    extract_range(image, &bmp, hdr->data_pos, hdr->depth, layout, offset, len, out);
+    return e_success;
+}
+
+Status stego_decode(const unsigned char *image, size_t image_len, const StegoHeader *hdr,
+                    unsigned char *out, size_t out_len)
+{
+    BmpInfo bmp;
+    ScatterMap map;
+    const ScatterMap *layout;
+    uint64_t end = hdr->secret_size;
+    unsigned char stored[CRC32C_BYTES];
+
+    if (out_len < hdr->secret_size)
+        return e_failure;
+    if (!hdr->checksum)
+        return stego_decode_range(image, image_len, hdr, 0, (size_t)hdr->secret_size, out);
+
+    if (hdr->depth < 1 || hdr->depth > LSB_MAX_DEPTH ||
+        bmp_parse(image, image_len, image_len, &bmp) == e_failure ||
+        select_layout(&bmp, hdr->version, hdr->channels) == e_failure ||
+        hdr->data_pos > bmp.carrier_bytes ||
+        header_layout(hdr, &bmp, &map, &layout) == e_failure)
+        return e_failure;
+
+    lsb_kernel_init();
+    if (hdr->compressed)
+    {
+        if (decode_frames(image, &bmp, hdr, layout, 0, hdr->secret_size, out, &end) == e_failure)
+            return e_failure;
+    }
+    else if (stego_decode_range(image, image_len, hdr, 0, (size_t)hdr->secret_size, out) == e_failure)
+        return e_failure;
+
+    /* The CRC32C follows the last payload byte in the same depth stream */
+    if (end + CRC32C_BYTES > layout_room(&bmp, hdr->data_pos, hdr->depth, layout))
+        return e_failure;
+    extract_range(image, &bmp, hdr->data_pos, hdr->depth, layout, end, CRC32C_BYTES, stored);
+
+    return (uint32_t)stego_get_be(stored, CRC32C_BYTES) == crc32c_update(0, out, (size_t)hdr->secret_size)
+           ? e_success : e_failure;
+}
+
+Status stego_archive_entry(const unsigned char *image, size_t image_len, const StegoHeader *hdr,
+                           const char *name, uint64_t *offset, uint64_t *size)
+{
+    unsigned char head[ARCHIVE_TOC_FIXED];
+    uint32_t count, toc_len;
+    Status ret = e_failure;
+
+    if (!hdr->archive || hdr->secret_size < sizeof(head) ||
+        stego_decode_range(image, image_len, hdr, 0, sizeof(head), head) == e_failure ||
+        archive_toc_header(head, hdr->secret_size, &count, &toc_len) == e_failure)
+        return e_failure;
+
+    unsigned char *toc = malloc(toc_len);
+    ArchiveEntry *entries = malloc((count ? count : 1) * sizeof(*entries));
+
+    if (toc != NULL && entries != NULL &&
+        stego_decode_range(image, image_len, hdr, 0, toc_len, toc) == e_success &&
+        archive_parse_toc(toc, toc_len, hdr->secret_size, entries, count) == e_success)
+    {
+        const ArchiveEntry *e = archive_find(entries, count, name);
+        if (e != NULL)
+        {
+            *offset = e->offset;
+            *size = e->size;
+            ret = e_success;
+        }
+    }
+
+    free(toc);
+    free(entries);
+    return ret;
+}
+
+/*
+ * Overwrite the header and payload carrier bytes described by hdr with
+ * noise at the depth they were written with. Returns the carrier position
+ * after the linear part.
+ */
+static uint64_t scrub_payload(unsigned char *image, const BmpInfo *bmp, const StegoHeader *hdr,
+                              const ScatterMap *map, uint64_t payload_len)
+{
+    unsigned char noise[LSB_MAX_DEPTH * STEGO_BLOCK];
+    struct timespec ts;
+    uint64_t pos = 0;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    uint64_t state = scatter_mix((uint64_t)ts.tv_nsec ^ ((uint64_t)ts.tv_sec << 30) ^ (uintptr_t)image);
+
+    for (uint64_t off = 0; off < hdr->data_pos / 8 + payload_len;)
+    {
+        int header = off < hdr->data_pos / 8;
+        uint64_t left = header ? hdr->data_pos / 8 - off : hdr->data_pos / 8 + payload_len - off;
+        /* Blocks stay whole depth groups so the next one starts on a group boundary */
+        size_t n = left < (uint64_t)STEGO_BLOCK * hdr->depth ? (size_t)left : (size_t)STEGO_BLOCK * hdr->depth;
+
+        for (size_t i = 0; i < n; i += 8)
+        {
+            uint64_t r = scatter_mix(state += 0x9e3779b97f4a7c15ULL);
+            memcpy(noise + i, &r, n - i < 8 ? n - i : 8);
+        }
+
+        if (header)
+            embed_mem(image, bmp, &pos, noise, n, 1);
+        else if (map != NULL)
+            embed_scattered(image, bmp, map, hdr->depth, off - hdr->data_pos / 8, noise, n);
+        else
+            embed_mem(image, bmp, &pos, noise, n, hdr->depth);
+        off += n;
+    }
+    return pos;
+}
+
+/* File offset just past carrier byte pos - 1 (pos > 0) */
+static uint64_t carrier_end(const BmpInfo *bmp, uint64_t pos)
+{
+    return bmp_carrier_offset(bmp, pos - 1) + 1;
+}
+
+Status stego_reencode(unsigned char *image, size_t image_len, const StegoHeader *old,
+                      const unsigned char *secret, size_t secret_len, const StegoOptions *opts,
+                      uint64_t *first, uint64_t *end)
+{
+    BmpInfo bmp;
+    ScatterMap map;
+    const ScatterMap *layout;
+    EncodePlan plan;
+    uint64_t payload_len = old->secret_size;
+
+    if (old->depth < 1 || old->depth > LSB_MAX_DEPTH ||
+        bmp_parse(image, image_len, image_len, &bmp) == e_failure ||
+        select_layout(&bmp, old->version, old->channels) == e_failure ||
+        old->data_pos > bmp.carrier_bytes ||
+        header_layout(old, &bmp, &map, &layout) == e_failure)
+        return e_failure;
+
+    /* Frames are walked by their length words to find where the old payload ends */
+    lsb_kernel_init();
+    if (old->compressed && decode_frames(image, &bmp, old, layout, old->secret_size, 0, NULL, &payload_len) == e_failure)
+        return e_failure;
+    if (old->checksum)
+        payload_len += CRC32C_BYTES;
+    if (layout != NULL ? scatter_groups(payload_len, old->depth) > layout->groups
+                       : payload_len > layout_room(&bmp, old->data_pos, old->depth, NULL))
+        return e_failure;
+
+    /* Nothing is touched unless the new secret fits */
+    if (plan_encode(image, image_len, secret, secret_len, opts, &plan) == e_failure)
+        return e_failure;
+
+    uint64_t old_end = scrub_payload(image, &bmp, old, layout, payload_len);
+    uint64_t new_end = embed_plan(image, &plan, secret, secret_len, opts);
+
+    /* Keyed payloads may touch any carrier byte */
+    *first = bmp_carrier_offset(&bmp, 0) < bmp_carrier_offset(&plan.bmp, 0)
+             ? bmp_carrier_offset(&bmp, 0) : bmp_carrier_offset(&plan.bmp, 0);
+    old_end = layout != NULL ? carrier_end(&bmp, bmp.carrier_bytes) : carrier_end(&bmp, old_end);
+    new_end = opts->key != NULL ? carrier_end(&plan.bmp, plan.bmp.carrier_bytes) : carrier_end(&plan.bmp, new_end);
+    *end = old_end > new_end ? old_end : new_end;
+
+    free(plan.frames);
+    return e_success;
+}
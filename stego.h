@@ -0,0 +1,98 @@
+#ifndef STEGO_H
+#define STEGO_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "types.h"
+#include "bmp.h"
+
+/*
+ * In-memory library API (libstego): whole BMP images and secrets are
+ * passed as buffers. Every call is reentrant: no global state beyond the
+ * kernel selection made once on first use, and no stdio.
+ */
+
+/* Encode settings; zero-initialised means v2 header, 1 bit, all channels */
+typedef struct
+{
+    int header_version;         /* STEGO_V1 or STEGO_V2 (0 = v2) */
+    int depth;                  /* payload bits per carrier byte, 1..4 (0 = 1) */
+    ChannelMode channels;       /* all pixel bytes, or alpha only (32bpp) */
+    const char *extension;      /* stored with the secret, e.g. ".txt" */
+    int compress;               /* store the secret as LZ frames (v2 only) */
+    int checksum;               /* store the secret's CRC32C after it (v2 only) */
+    const char *key;            /* scatter the payload by this passphrase (v2 only), or NULL */
+} StegoOptions;
+
+/* Longest extension that fits the header (without the NUL) */
+#define STEGO_EXTN_MAX 15
+
+/* Header found in a stego image */
+typedef struct
+{
+    int version;
+    int depth;
+    ChannelMode channels;       /* detected: all bytes or alpha only */
+    char extension[STEGO_EXTN_MAX + 1];
+    uint64_t secret_size;       /* uncompressed size */
+    int compressed;
+    int archive;                /* the secret is a TOC plus member files */
+    int checksum;               /* stego_decode() verifies the stored CRC32C */
+    int keyed;                  /* payload scattered by a passphrase */
+    uint64_t data_pos;          /* carrier byte where the payload starts */
+    const char *key;            /* set by the caller before decoding a keyed image */
+} StegoHeader;
+
+/*
+ * Largest secret (bytes) that image can carry with these options. With
+ * compression this is the bound for incompressible data; compressible
+ * secrets may be larger, and stego_encode() decides.
+ */
+Status stego_capacity(const unsigned char *image, size_t image_len, const StegoOptions *opts,
+                      uint64_t *max_secret);
+
+/*
+ * Write image with the secret embedded into out (out_len >= image_len).
+ * out may be the image itself to embed in place.
+ */
+Status stego_encode(const unsigned char *image, size_t image_len,
+                    const unsigned char *secret, size_t secret_len,
+                    const StegoOptions *opts, unsigned char *out, size_t out_len);
+
+/*
+ * Replace the secret of the stego image in place. old is its header from
+ * stego_read_header() (old->key set for a keyed image). Nothing changes
+ * unless the new secret fits; then the old header and payload carrier
+ * bytes are overwritten with noise and the new ones embedded. Only bytes
+ * in [*first, *end) of image may have changed.
+ */
+Status stego_reencode(unsigned char *image, size_t image_len, const StegoHeader *old,
+                      const unsigned char *secret, size_t secret_len, const StegoOptions *opts,
+                      uint64_t *first, uint64_t *end);
+
+/* Find and validate the header; hdr->secret_size tells how big out must be */
+Status stego_read_header(const unsigned char *image, size_t image_len, StegoHeader *hdr);
+
+/*
+ * Extract the secret described by hdr into out (out_len >= hdr->secret_size).
+ * With hdr->checksum it fails if the secret does not match its CRC32C.
+ */
+Status stego_decode(const unsigned char *image, size_t image_len, const StegoHeader *hdr,
+                    unsigned char *out, size_t out_len);
+
+/*
+ * Extract only secret bytes [offset, offset + len) into out. Uncompressed
+ * payloads are read straight from the carrier bytes holding the range;
+ * compressed ones decode just the frames that overlap it.
+ */
+Status stego_decode_range(const unsigned char *image, size_t image_len, const StegoHeader *hdr,
+                          uint64_t offset, size_t len, unsigned char *out);
+
+/*
+ * Look up member name of an archive secret (hdr->archive): its secret
+ * offset and size, ready for stego_decode_range(). Only the TOC is read.
+ */
+Status stego_archive_entry(const unsigned char *image, size_t image_len, const StegoHeader *hdr,
+                           const char *name, uint64_t *offset, uint64_t *size);
+
+#endif
@@ -15,6 +15,11 @@ typedef enum
 {
     e_encode,
     e_decode,
+    e_archive,
+    e_batch,
+    e_inspect,
+    e_index,
+    e_scan,
     e_unsupported
 } OperationType;
 